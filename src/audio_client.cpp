@@ -2,19 +2,49 @@
 
 #include <portaudio.h>
 
+#include <atomic>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 static PaStream *pa_stream;
 
 static int num_channels;
+static int sample_rate;
 static AudioCallback user_callback;
 
+// Written by the audio thread only, read by anyone through audio_client_get_stats
+static std::atomic_int output_underflows;
+static std::atomic_int output_overflows;
+static std::atomic_int callback_jitter_us;
+static std::atomic_int output_latency_us;
+static PaTime last_dac_time;
+
 static int pa_callback(const void *inputBuffer, void *outputBuffer,
                        unsigned long framesPerBuffer,
                        const PaStreamCallbackTimeInfo* timeInfo,
                        PaStreamCallbackFlags statusFlags,
                        void *userData) {
+    if (statusFlags & paOutputUnderflow) {
+        ++output_underflows;
+    }
+    if (statusFlags & paOutputOverflow) {
+        ++output_overflows;
+    }
+
+    // Successive buffers should reach the DAC exactly one buffer apart
+    if (timeInfo && timeInfo->outputBufferDacTime > 0) {
+        if (last_dac_time > 0) {
+            double step = timeInfo->outputBufferDacTime - last_dac_time;
+            double expected = (double)framesPerBuffer / sample_rate;
+            int jitter_us = (int)(fabs(step - expected) * 1000000.0);
+            int decayed_us = callback_jitter_us * 63 / 64;
+            callback_jitter_us = jitter_us > decayed_us ? jitter_us : decayed_us;
+        }
+        last_dac_time = timeInfo->outputBufferDacTime;
+        output_latency_us = (int)((timeInfo->outputBufferDacTime - timeInfo->currentTime) * 1000000.0);
+    }
+
     user_callback(framesPerBuffer, num_channels, (float*)outputBuffer);
     return 0;
 }
@@ -28,23 +58,34 @@ void audio_client_init() {
     }
 }
 
-void audio_client_open(int sample_rate, int buffer_size, int num_channels_, AudioCallback callback) {
+bool audio_client_open(int sample_rate_, int buffer_size, int num_channels_, AudioCallback callback) {
     PaError err;
 
     num_channels = num_channels_;
+    sample_rate = sample_rate_;
     user_callback = callback;
+    output_underflows = 0;
+    output_overflows = 0;
+    callback_jitter_us = 0;
+    output_latency_us = 0;
+    last_dac_time = 0;
 
     err = Pa_OpenDefaultStream(&pa_stream, 0, num_channels, paFloat32, sample_rate, buffer_size, pa_callback, NULL);
     if (err != paNoError) {
         fprintf(stderr, "PortAudio error: %s\n", Pa_GetErrorText(err));
-        exit(1);
+        pa_stream = NULL;
+        return false;
     }
 
     err = Pa_StartStream(pa_stream);
     if (err != paNoError) {
         fprintf(stderr, "PortAudio error: %s\n", Pa_GetErrorText(err));
-        exit(1);
+        Pa_CloseStream(pa_stream);
+        pa_stream = NULL;
+        return false;
     }
+
+    return true;
 }
 
 void audio_client_close() {
@@ -52,8 +93,21 @@ void audio_client_close() {
     err = Pa_StopStream(pa_stream);
     if (err != paNoError) {
         fprintf(stderr, "PortAudio error: %s\n", Pa_GetErrorText(err));
-        exit(1);
     }
+
+    // Releases the device, which is opened again for the next format
+    err = Pa_CloseStream(pa_stream);
+    if (err != paNoError) {
+        fprintf(stderr, "PortAudio error: %s\n", Pa_GetErrorText(err));
+    }
+    pa_stream = NULL;
+}
+
+void audio_client_get_stats(AudioClientStats* stats) {
+    stats->output_underflows = output_underflows;
+    stats->output_overflows = output_overflows;
+    stats->callback_jitter_ms = callback_jitter_us / 1000.0;
+    stats->output_latency_ms = output_latency_us / 1000.0;
 }
 
 void audio_client_destroy() {
@@ -1,7 +1,17 @@
 #pragma once
 
 typedef void (*AudioCallback)(int num_samples, int num_channels, float* outs);
+
+struct AudioClientStats {
+    int output_underflows;      // reported by the device through statusFlags
+    int output_overflows;
+    double callback_jitter_ms;  // decaying max of |DAC time step - buffer duration|
+    double output_latency_ms;   // DAC time of the buffer minus the callback time
+};
+
 void audio_client_init();
-void audio_client_open(int sample_rate, int buffer_size, int num_channels, AudioCallback callback);
+// Returns false if the device rejects the format
+bool audio_client_open(int sample_rate, int buffer_size, int num_channels, AudioCallback callback);
 void audio_client_close();
+void audio_client_get_stats(AudioClientStats* stats);
 void audio_client_destroy();
@@ -0,0 +1,71 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+struct BenchResult {
+    std::string name;
+    std::string media;
+    double value;
+    const char* unit;
+};
+
+static std::vector<BenchResult> results;
+int num_failures;
+
+void report(const char* name, const std::string& media, double value, const char* unit) {
+    printf("%-28s %-26s %14.3f %s\n", name, media.c_str(), value, unit);
+    results.push_back({ name, media, value, unit });
+}
+
+double elapsed_ms(int64_t start_ns) {
+    return (profiler_now_ns() - start_ns) / 1000000.0;
+}
+
+int64_t cpu_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool write_results(const char* filename) {
+    FILE* f = fopen(filename, "w");
+    if (!f) {
+        printf("Couldn't open %s for writing\n", filename);
+        return false;
+    }
+    fprintf(f, "{\n  \"ffmpeg\": \"%s\",\n  \"results\": [\n", av_version_info());
+    for (int i = 0; i < results.size(); ++i) {
+        auto& r = results[i];
+        fprintf(f, "    { \"name\": \"%s\", \"media\": \"%s\", \"value\": %.6f, \"unit\": \"%s\" }%s\n",
+                r.name.c_str(), r.media.c_str(), r.value, r.unit,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    printf("Wrote %s\n", filename);
+    return true;
+}
+
+bool bench_open(VideoReaderState* state, const char* filename, bool need_video, bool need_audio) {
+    if (!video_reader_open(state, filename)) {
+        return false;
+    }
+    if ((need_video && state->video_stream_index == -1) ||
+        (need_audio && state->audio_stream_index == -1)) {
+        video_reader_close(state);
+        return false;
+    }
+    return true;
+}
+
+bool bench_build_index(const char* filename, PacketIndex* index) {
+    VideoReaderState state;
+    if (!video_reader_open(&state, filename)) {
+        return false;
+    }
+    packet_index_build(index, &state);
+    video_reader_close(&state);
+    return true;
+}
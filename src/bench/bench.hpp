@@ -0,0 +1,53 @@
+#ifndef bench_hpp
+#define bench_hpp
+
+#include <string>
+#include <stdint.h>
+#include "../video_reader.hpp"
+#include "../packet_index.hpp"
+
+// Shared by the benchmarks of every module (bench_*.cpp). Each benchmark
+// prints its results through report and counts failed checks in
+// num_failures, which make the run exit with an error.
+
+extern int num_failures;
+
+void report(const char* name, const std::string& media, double value, const char* unit);
+bool write_results(const char* filename);
+double elapsed_ms(int64_t start_ns);
+int64_t cpu_now_ns();
+
+// Opens a fixture for decoding. Returns false, with nothing left open, if
+// it doesn't open or lacks a stream that is asked for.
+bool bench_open(VideoReaderState* state, const char* filename, bool need_video, bool need_audio);
+
+// Opens a fixture, indexes it and closes it again
+bool bench_build_index(const char* filename, PacketIndex* index);
+
+// Per fixture
+void bench_startup(const std::string& media, const char* filename);
+void bench_indexing(const std::string& media, const char* filename);
+void bench_seek(const std::string& media, const char* filename, bool by_index);
+void bench_seek_leading_pictures(const std::string& media, const char* filename);
+void bench_audio_conversion(const std::string& media, const char* filename);
+void bench_decoder_release(const std::string& media, const char* filename);
+void bench_frame_cache(const std::string& media, const char* filename);
+void bench_parallel_decode(const std::string& media, const char* filename);
+void bench_decode_cost(const std::string& media, const char* filename);
+void bench_frame_hash(const std::string& media, const char* filename);
+void bench_scene_analysis(const std::string& media, const char* filename);
+void bench_scene_detection(const std::string& media, const char* filename); // MEDIA_SCENES fixture only
+void bench_loudness(const std::string& media, const char* filename);
+void bench_side_data_export(const std::string& media, const char* filename);
+void bench_frame_export(const std::string& media, const char* filename);
+void bench_http_source(const std::string& media, const char* filename);
+
+// On generated data
+void bench_index_layout();
+void bench_hash64();
+void bench_luma_thumbnail();
+void bench_loudness_meter();
+void bench_ring_buffer();
+void bench_peak_image();
+
+#endif
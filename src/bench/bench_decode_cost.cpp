@@ -0,0 +1,47 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../decode_cost.hpp"
+#include "../thread_pool.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+// The opt-in decode cost pass, as a multiple of real time, and the share of
+// video packets it got a time for. Every time has to belong to a video
+// packet of the index, and nearly every packet needs one.
+void bench_decode_cost(const std::string& media, const char* filename) {
+    PacketIndex index;
+    if (!bench_build_index(filename, &index)) {
+        return;
+    }
+    if (index.video_packets.empty()) {
+        return;
+    }
+
+    std::vector<std::pair<int, float>> costs;
+    auto start = profiler_now_ns();
+    decode_cost_measure(filename, &index, thread_pool_shared(), NULL, NULL, &costs);
+    double ms = elapsed_ms(start);
+
+    report("decode_cost_pass", media, ms, "ms");
+    report("decode_cost_speed", media, index.duration * 1000.0 / ms, "x realtime");
+    report("decode_cost_coverage", media, costs.size() * 100.0 / index.video_packets.size(), "%");
+
+    std::vector<int> video_pts;
+    video_pts.reserve(index.video_packets.size());
+    for (auto& pkt : index.video_packets) {
+        video_pts.push_back(pkt.pts);
+    }
+    std::sort(video_pts.begin(), video_pts.end());
+    for (auto& cost : costs) {
+        if (cost.second < 0 || !std::binary_search(video_pts.begin(), video_pts.end(), cost.first)) {
+            printf("FAIL: %s decode cost %.3fms for pts %d, which isn't a video packet\n", media.c_str(), cost.second, cost.first);
+            ++num_failures;
+            break;
+        }
+    }
+    if (costs.size() * 100 < index.video_packets.size() * 95) {
+        printf("FAIL: %s got decode costs for %zu of %zu video packets\n", media.c_str(), costs.size(), index.video_packets.size());
+        ++num_failures;
+    }
+}
@@ -0,0 +1,66 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../data_types/frame_cache.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+// Frames cached per GB as decoded, against what RGB0 copies would take, and
+// the cost of converting a cached frame for display at preview size versus
+// converting it at full resolution. The cache has to find the frame just
+// added and stay within its budget.
+void bench_frame_cache(const std::string& media, const char* filename) {
+    constexpr long BUDGET = 256 * 1024 * 1024;
+    constexpr int NUM_CONVERSIONS = 50;
+
+    VideoReaderState state;
+    if (!bench_open(&state, filename, true, false)) {
+        return;
+    }
+    video_reader_select_streams(&state, true, false);
+
+    FrameCache cache;
+    FrameCache::init(&cache, BUDGET, 4096);
+    AVFrame* frame = av_frame_alloc();
+    bool have_frame = false;
+    int res, packet_pts, pts;
+    while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+        if (res == RECEIVED_VIDEO) {
+            bool inserted = cache.insert(0, pts, state.video_frame);
+            have_frame = cache.find(0, pts, frame);
+            if (inserted && !have_frame) {
+                printf("FAIL: %s frame at pts %d not found right after caching it\n", media.c_str(), pts);
+                ++num_failures;
+            }
+        }
+    }
+    if (cache.bytes > BUDGET) {
+        printf("FAIL: %s frame cache holds %ld bytes, over its %ld byte budget\n", media.c_str(), cache.bytes, BUDGET);
+        ++num_failures;
+    }
+
+    if (have_frame) {
+        std::vector<uint8_t> rgb((size_t)state.width * state.height * 4);
+        int display_width = std::max(1, state.width / 4);
+        int display_height = std::max(1, state.height / 4);
+
+        auto start = profiler_now_ns();
+        for (int i = 0; i < NUM_CONVERSIONS; ++i) {
+            video_reader_convert_frame(&state, frame, display_width, display_height, rgb.data());
+        }
+        report("convert_display_ms", media, elapsed_ms(start) / NUM_CONVERSIONS, "ms");
+
+        start = profiler_now_ns();
+        for (int i = 0; i < NUM_CONVERSIONS; ++i) {
+            video_reader_convert_frame(&state, frame, state.width, state.height, rgb.data());
+        }
+        report("convert_full_ms", media, elapsed_ms(start) / NUM_CONVERSIONS, "ms");
+    }
+
+    report("frames_per_gb_native", media, cache.frames_per_gb(), "frames");
+    report("frames_per_gb_rgb0", media, 1024.0 * 1024.0 * 1024.0 / ((double)state.width * state.height * 4), "frames");
+
+    av_frame_free(&frame);
+    FrameCache::destroy(&cache);
+    video_reader_close(&state);
+}
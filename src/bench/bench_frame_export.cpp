@@ -0,0 +1,50 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../frame_export.hpp"
+#include "../thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+
+// Exporting the first second or so of frames as PNG images, and stream
+// copying the same range. The copy has to hold at least the selected frames.
+void bench_frame_export(const std::string& media, const char* filename) {
+    constexpr int NUM_FRAMES = 30;
+
+    PacketIndex index;
+    if (!bench_build_index(filename, &index)) {
+        return;
+    }
+    if (index.video_packets.empty()) {
+        return;
+    }
+    int count = std::min(NUM_FRAMES, (int)index.video_packets.size());
+    PacketInfo first, last;
+    packet_index_get(&index, index.video_packets[0].index, &first);
+    packet_index_get(&index, index.video_packets[count - 1].index, &last);
+
+    std::atomic_int frames_done(0);
+    std::string path;
+    auto start = profiler_now_ns();
+    if (frame_export_run(filename, &index, first, last, EXPORT_PNG, thread_pool_shared(), NULL, &frames_done, &path)) {
+        report("export_png_fps", media, frames_done * 1000.0 / elapsed_ms(start), "fps");
+    }
+
+    frames_done = 0;
+    start = profiler_now_ns();
+    if (!frame_export_run(filename, &index, first, last, EXPORT_STREAM_COPY, thread_pool_shared(), NULL, &frames_done, &path)) {
+        return;
+    }
+    report("export_copy", media, elapsed_ms(start), "ms");
+
+    PacketIndex copy_index;
+    if (!bench_build_index(path.c_str(), &copy_index)) {
+        printf("FAIL: %s stream copy %s doesn't open\n", media.c_str(), path.c_str());
+        ++num_failures;
+        return;
+    }
+    if ((int)copy_index.video_packets.size() < count) {
+        printf("FAIL: %s stream copy has %zu video packets, %d selected\n", media.c_str(), copy_index.video_packets.size(), count);
+        ++num_failures;
+    }
+}
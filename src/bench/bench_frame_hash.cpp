@@ -0,0 +1,45 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../frame_hash.hpp"
+#include "../thread_pool.hpp"
+#include <stdio.h>
+#include <vector>
+
+// Hashing every decoded frame, as a multiple of real time. Hashing a file
+// twice has to give the same hashes.
+void bench_frame_hash(const std::string& media, const char* filename) {
+    PacketIndex index;
+    if (!bench_build_index(filename, &index)) {
+        return;
+    }
+
+    FileHashes hashes, hashes_again;
+    auto start = profiler_now_ns();
+    frame_hash_file(filename, &index, thread_pool_shared(), NULL, &hashes);
+    double ms = elapsed_ms(start);
+    frame_hash_file(filename, &index, thread_pool_shared(), NULL, &hashes_again);
+
+    report("frame_hash_speed", media, index.duration * 1000.0 / ms, "x realtime");
+    if (!frame_hash_diff(hashes, hashes_again).empty()) {
+        printf("FAIL: %s hashed differently on a second run\n", media.c_str());
+        ++num_failures;
+    }
+}
+
+// Raw hash throughput over a 1080p 4:2:0 frame
+void bench_hash64() {
+    std::vector<uint8_t> frame(1920 * 1080 * 3 / 2);
+    for (size_t i = 0; i < frame.size(); ++i) {
+        frame[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+
+    constexpr int NUM_ITERATIONS = 200;
+    volatile uint64_t hash = 0; // keeps the loop from being optimized out
+    auto start = profiler_now_ns();
+    for (int i = 0; i < NUM_ITERATIONS; ++i) {
+        hash = hash64(frame.data(), frame.size(), i);
+    }
+    double ms = elapsed_ms(start);
+
+    report("hash64_throughput", "1080p", frame.size() * (double)NUM_ITERATIONS / (ms / 1000.0) / 1e9, "GB/s");
+}
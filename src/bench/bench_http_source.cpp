@@ -0,0 +1,101 @@
+#include "bench.hpp"
+#include "http_server.hpp"
+#include "../profiler.hpp"
+#include "../http_source.hpp"
+#include "../media_source.hpp"
+#include <stdio.h>
+#include <string.h>
+
+constexpr int HTTP_LATENCY_MS = 20;
+
+// Indexing and seeking over HTTP, against a local server that delays every
+// request. The index has to match the one built from the file itself, so
+// this doubles as the integration test for the HTTP source.
+void bench_http_source(const std::string& media, const char* filename) {
+    PacketIndex file_index;
+    if (!bench_build_index(filename, &file_index)) {
+        return;
+    }
+
+    HttpServer server;
+    if (!http_server_start(&server, filename, HTTP_LATENCY_MS)) {
+        ++num_failures;
+        return;
+    }
+    auto slash = strrchr(filename, '/');
+    auto url = http_server_url(&server, slash ? slash + 1 : filename);
+
+    // One request at a time for exactly what is read, as a baseline for the
+    // prefetching and coalescing
+    HttpSourceOptions naive;
+    naive.num_connections = 1;
+    naive.readahead_blocks = 0;
+    naive.max_request_blocks = 1;
+
+    HttpSourceOptions cached;
+
+    struct { const char* suffix; HttpSourceOptions* options; } configs[] = {
+        { "naive",  &naive  },
+        { "cached", &cached },
+    };
+    for (auto& config : configs) {
+        int requests_before = server.num_requests;
+        VideoReaderState state;
+        auto source = media_source_open_http(url.c_str(), config.options);
+        if (!source || !video_reader_open_source(&state, source)) {
+            printf("FAIL: couldn't open %s over HTTP\n", media.c_str());
+            ++num_failures;
+            if (source) {
+                media_source_release(source);
+            }
+            continue;
+        }
+
+        PacketIndex index;
+        auto start = profiler_now_ns();
+        packet_index_build(&index, &state);
+        double index_ms = elapsed_ms(start);
+
+        bool same = index.all_packets.size() == file_index.all_packets.size();
+        for (int i = 0; same && i < index.all_packets.size(); ++i) {
+            auto& a = index.all_packets[i];
+            auto& b = file_index.all_packets[i];
+            same = a.type == b.type && a.pts == b.pts && a.dts == b.dts && a.pos == b.pos;
+        }
+        if (!same) {
+            printf("FAIL: %s indexed differently over HTTP (%s)\n", media.c_str(), config.suffix);
+            ++num_failures;
+        }
+
+        // Seek to a spread of frames, as in bench_seek
+        constexpr int NUM_SEEKS = 12;
+        double seek_ms = 0.0;
+        auto& packets = index.video_packets;
+        for (int i = 0; i < NUM_SEEKS && !packets.empty(); ++i) {
+            auto& pkt = packets[(long)packets.size() * (i * 7 % NUM_SEEKS) / NUM_SEEKS];
+            auto seek_start = profiler_now_ns();
+            packet_index_seek(&index, &state, pkt);
+            int res, packet_pts, pts;
+            while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+                if (res == RECEIVED_VIDEO && pts == pkt.pts) {
+                    break;
+                }
+            }
+            seek_ms += elapsed_ms(seek_start);
+        }
+
+        video_reader_close(&state);
+        media_source_release(source);
+
+        std::string name = std::string("http_index_ms_") + config.suffix;
+        report(name.c_str(), media, index_ms, "ms");
+        if (!packets.empty()) {
+            name = std::string("http_seek_mean_") + config.suffix;
+            report(name.c_str(), media, seek_ms / NUM_SEEKS, "ms");
+        }
+        name = std::string("http_requests_") + config.suffix;
+        report(name.c_str(), media, server.num_requests - requests_before, "requests");
+    }
+
+    http_server_stop(&server);
+}
@@ -0,0 +1,57 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../loudness.hpp"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+// Loudness over the whole audio stream, as a multiple of real time. The
+// fixtures are sines at half of full scale, so the true peak is -6dBTP
+// give or take what lossy codecs add.
+void bench_loudness(const std::string& media, const char* filename) {
+    LoudnessResult result;
+    auto start = profiler_now_ns();
+    if (!loudness_analyze(filename, NULL, NULL, &result)) {
+        return;
+    }
+    double ms = elapsed_ms(start);
+
+    report("loudness_speed", media, result.duration * 1000.0 / ms, "x realtime");
+
+    if (fabsf(result.true_peak + 6.02f) > 1.0f || !(result.integrated > -70.0f)) {
+        printf("FAIL: %s half scale sines measured %.2f LUFS, %.2f dBTP\n", media.c_str(), result.integrated, result.true_peak);
+        ++num_failures;
+    }
+}
+
+// The meter alone, on a stereo 997Hz sine at -20dBFS, which BS.1770 puts
+// at -20 LUFS
+void bench_loudness_meter() {
+    constexpr int SAMPLE_RATE = 48000;
+    constexpr int NUM_SECONDS = 60;
+    constexpr int CHUNK = 1024;
+    std::vector<float> samples(SAMPLE_RATE * NUM_SECONDS * 2);
+    for (size_t i = 0; i < samples.size() / 2; ++i) {
+        float value = (float)(0.1 * sin(2.0 * M_PI * 997.0 * i / SAMPLE_RATE));
+        samples[i * 2] = value;
+        samples[i * 2 + 1] = value;
+    }
+
+    LoudnessMeter meter;
+    LoudnessResult result;
+    LoudnessMeter::init(&meter, SAMPLE_RATE, 2, 0);
+    auto start = profiler_now_ns();
+    for (int i = 0; i < SAMPLE_RATE * NUM_SECONDS; i += CHUNK) {
+        loudness_meter_add(&meter, samples.data() + i * 2, std::min(CHUNK, SAMPLE_RATE * NUM_SECONDS - i));
+    }
+    loudness_meter_finish(&meter, &result);
+    double ms = elapsed_ms(start);
+    LoudnessMeter::destroy(&meter);
+
+    report("loudness_meter_speed", "48kHz stereo", NUM_SECONDS * 1000.0 / ms, "x realtime");
+    if (fabsf(result.integrated + 20.0f) > 0.1f || fabsf(result.true_peak + 20.0f) > 0.1f) {
+        printf("FAIL: -20dBFS sine measured %.2f LUFS, %.2f dBTP\n", result.integrated, result.true_peak);
+        ++num_failures;
+    }
+}
@@ -0,0 +1,162 @@
+#include <ddui/core>
+#include <ddui/app>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <sys/stat.h>
+#include "bench.hpp"
+#include "media_gen.hpp"
+#include "../packet_index.hpp"
+#include "../timeline.hpp"
+#include "../profiler.hpp"
+
+// Benchmarks over deterministic synthetic media. Every result is printed and
+// written to a JSON file so that runs of different builds can be compared.
+// The benchmarks of each module are in bench_<module>.cpp.
+//
+//   video_inspect_bench [--out results.json] [--media-dir dir] [--no-ui]
+
+static const char* out_filename = "bench_results.json";
+static std::string media_dir = "bench_media";
+static PacketIndex draw_index;
+
+static const MediaSpec MEDIA_SPECS[] = {
+    // name                      format      ext    dur    video codec              w     h   fps gop  b  audio codec                sample format         rate   ch
+    { "mpeg4_480p_gop12_s16",    "matroska", "mkv", 20.0,  AV_CODEC_ID_MPEG4,      640,  480, 25, 12, 2, AV_CODEC_ID_PCM_S16LE, AV_SAMPLE_FMT_S16,  48000, 2 },
+    { "mpeg4_1080p_gop250_s32",  "matroska", "mkv", 20.0,  AV_CODEC_ID_MPEG4,     1920, 1080, 25, 250, 0, AV_CODEC_ID_PCM_S32LE, AV_SAMPLE_FMT_S32, 48000, 6 },
+    { "mpeg2_720p_gop15_ts",     "mpegts",   "ts",  20.0,  AV_CODEC_ID_MPEG2VIDEO, 1280,  720, 25, 15, 2, AV_CODEC_ID_AAC,       AV_SAMPLE_FMT_FLTP, 48000, 2 },
+    { "h264_1080p_gop50_aac",    "mp4",      "mp4", 20.0,  AV_CODEC_ID_H264,      1920, 1080, 25, 50, 3, AV_CODEC_ID_AAC,       AV_SAMPLE_FMT_FLTP, 44100, 2 },
+    { "mjpeg_360p_flt",          "matroska", "mkv", 20.0,  AV_CODEC_ID_MJPEG,      480,  360, 25,  1, 0, AV_CODEC_ID_PCM_F32LE, AV_SAMPLE_FMT_FLT,  44100, 1 },
+    { "audio_only_s16_8ch",      "matroska", "mka", 60.0,  AV_CODEC_ID_NONE,         0,    0,  0,  0, 0, AV_CODEC_ID_PCM_S16LE, AV_SAMPLE_FMT_S16,  96000, 8 },
+};
+
+// Intra-only, so that the frozen frames decode identically
+static const MediaSpec SCENES_SPEC =
+    { "scenes_mjpeg_360p",       "matroska", "mkv", SCENES_NUM_FRAMES / 25.0, AV_CODEC_ID_MJPEG, 480, 360, 25, 1, 0, AV_CODEC_ID_NONE, AV_SAMPLE_FMT_NONE, 0, 0, MEDIA_SCENES };
+
+// Media is only generated once per directory
+static bool ensure_media(const MediaSpec& spec, std::string* filename) {
+    *filename = media_dir + "/" + spec.name + "." + spec.extension;
+
+    struct stat st;
+    if (stat(filename->c_str(), &st) == 0) {
+        return true;
+    }
+    auto start = profiler_now_ns();
+    if (!media_gen_write(&spec, filename->c_str())) {
+        printf("Skipping %s\n", spec.name);
+        remove(filename->c_str());
+        return false;
+    }
+    printf("Generated %s in %.0fms\n", filename->c_str(), elapsed_ms(start));
+    return true;
+}
+
+// draw_packets needs a live ddui context, so it is timed from inside the first
+// update of a window, after which the benchmark exits
+static void bench_draw_packets_update() {
+    constexpr int ITERATIONS = 50;
+
+    struct {
+        const char* name;
+        std::vector<PacketInfo>* packets;
+    } rows[] = {
+        { "draw_packets_video", &draw_index.video_packets },
+        { "draw_packets_audio", &draw_index.audio_packets },
+        { "draw_packets_all",   &draw_index.all_packets },
+    };
+
+    // One view-width of timeline at the app's default zoom, and the whole file
+    float windows[] = { ddui::view.width / 512.0f, draw_index.duration };
+    const char* window_names[] = { "view", "whole_file" };
+    for (auto& row : rows) {
+        for (int w = 0; w < 2; ++w) {
+            float second_width = ddui::view.width / windows[w];
+            int next_pkt_hovering = -1, pkt_clicked = -1;
+            auto start = profiler_now_ns();
+            for (int i = 0; i < ITERATIONS; ++i) {
+                draw_packets(row.packets, 0.0, windows[w], second_width, Y_SPACING, -1, &next_pkt_hovering, &pkt_clicked);
+            }
+            report(row.name, window_names[w], elapsed_ms(start) / ITERATIONS, "ms");
+        }
+    }
+
+    write_results(out_filename);
+    exit(num_failures > 0 ? 1 : 0);
+}
+
+int main(int argc, const char** argv) {
+
+    bool run_ui = true;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            out_filename = argv[++i];
+        } else if (strcmp(argv[i], "--media-dir") == 0 && i + 1 < argc) {
+            media_dir = argv[++i];
+        } else if (strcmp(argv[i], "--no-ui") == 0) {
+            run_ui = false;
+        } else {
+            printf("usage: %s [--out results.json] [--media-dir dir] [--no-ui]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    mkdir(media_dir.c_str(), 0755);
+
+    // The draw_packets benchmark runs over the last fixture with both streams
+    std::string draw_filename;
+    for (auto& spec : MEDIA_SPECS) {
+        std::string filename;
+        if (!ensure_media(spec, &filename)) {
+            continue;
+        }
+
+        bench_startup(spec.name, filename.c_str());
+        bench_indexing(spec.name, filename.c_str());
+        bench_seek(spec.name, filename.c_str(), true);
+        if (strcmp(spec.format_name, "mpegts") == 0) {
+            // Baseline for the byte position seek that TS files get
+            bench_seek(spec.name, filename.c_str(), false);
+        }
+        bench_seek_leading_pictures(spec.name, filename.c_str());
+        bench_audio_conversion(spec.name, filename.c_str());
+        bench_parallel_decode(spec.name, filename.c_str());
+        bench_decode_cost(spec.name, filename.c_str());
+        bench_frame_hash(spec.name, filename.c_str());
+        bench_scene_analysis(spec.name, filename.c_str());
+        bench_loudness(spec.name, filename.c_str());
+        bench_side_data_export(spec.name, filename.c_str());
+        bench_frame_export(spec.name, filename.c_str());
+        bench_frame_cache(spec.name, filename.c_str());
+        bench_decoder_release(spec.name, filename.c_str());
+        bench_http_source(spec.name, filename.c_str());
+
+        if (spec.video_codec != AV_CODEC_ID_NONE && spec.audio_codec != AV_CODEC_ID_NONE) {
+            draw_filename = filename;
+        }
+    }
+
+    std::string scenes_filename;
+    if (ensure_media(SCENES_SPEC, &scenes_filename)) {
+        bench_scene_detection(SCENES_SPEC.name, scenes_filename.c_str());
+    }
+
+    bench_ring_buffer();
+    bench_index_layout();
+    bench_hash64();
+    bench_luma_thumbnail();
+    bench_loudness_meter();
+    bench_peak_image();
+
+    if (!run_ui || draw_filename.empty() || !bench_build_index(draw_filename.c_str(), &draw_index)) {
+        return write_results(out_filename) && num_failures == 0 ? 0 : 1;
+    }
+
+    if (!ddui::app_init(1280, 400, "video_inspect_bench", bench_draw_packets_update)) {
+        printf("Failed to init ddui.\n");
+        return write_results(out_filename) && num_failures == 0 ? 0 : 1;
+    }
+    ddui::app_run();
+
+    return 0;
+}
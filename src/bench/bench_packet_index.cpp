@@ -0,0 +1,206 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../timestamp_anomalies.hpp"
+#include <algorithm>
+#include <stdio.h>
+
+void bench_indexing(const std::string& media, const char* filename) {
+    VideoReaderState state;
+    if (!video_reader_open(&state, filename)) {
+        return;
+    }
+
+    PacketIndex index;
+    auto start = profiler_now_ns();
+    auto cpu_start = cpu_now_ns();
+    packet_index_build(&index, &state);
+    double ms = elapsed_ms(start);
+    double cpu_ms = (cpu_now_ns() - cpu_start) / 1000000.0;
+
+    report("index_ms", media, ms, "ms");
+    report("index_throughput", media, index.all_packets.size() / (ms / 1000.0), "packets/s");
+    report("index_cpu_per_million_packets", media, cpu_ms * 1000000.0 / std::max((size_t)1, index.all_packets.size()), "ms");
+    video_reader_close(&state);
+
+    // What reading picture types from the bitstream adds to indexing
+    if (!video_reader_open(&state, filename)) {
+        return;
+    }
+    state.parse_picture_types = false;
+    PacketIndex index_without;
+    cpu_start = cpu_now_ns();
+    packet_index_build(&index_without, &state);
+    double cpu_without_ms = (cpu_now_ns() - cpu_start) / 1000000.0;
+    report("index_picture_type_overhead", media, (cpu_ms - cpu_without_ms) * 100.0 / std::max(cpu_without_ms, 0.001), "%");
+    video_reader_close(&state);
+}
+
+// Laying out packets in the index, without demuxing, for a long file of
+// interleaved audio and video
+void bench_index_layout() {
+    constexpr int NUM_PACKETS = 4 * 1000 * 1000;
+
+    PacketIndex index;
+    index.duration = 0.0;
+    index.last_keyframe_index = -1;
+    index.prev_keyframe_index = -1;
+    index.video_time_base = { 1, 90000 };
+    index.audio_time_base = { 1, 48000 };
+    index.num_streams = 2;
+    index.video_packets.reserve(NUM_PACKETS / 2);
+    index.audio_packets.reserve(NUM_PACKETS / 2);
+    index.all_packets.reserve(NUM_PACKETS);
+
+    PacketBatch* batch = new PacketBatch;
+    auto cpu_start = cpu_now_ns();
+    for (int i = 0; i < NUM_PACKETS;) {
+        batch->count = 0;
+        for (; batch->count < PacketBatch::CAPACITY && i < NUM_PACKETS; ++batch->count, ++i) {
+            int n = batch->count;
+            bool is_video = i % 2 == 0;
+            int frame = i / 2;
+            batch->is_video[n] = is_video;
+            batch->is_keyframe[n] = !is_video || frame % 60 == 0;
+            // A few video gaps, for the anomaly scan to find. Video timestamps
+            // run past 32 bits, as MPEG-TS ones do, and a few audio packets
+            // have none; neither may be taken for a step back or a duplicate.
+            int64_t pts = is_video ? (int64_t)(frame + frame / 250000 * 10) * 3000 : (int64_t)frame * 1024;
+            bool has_timestamps = is_video || frame % 1000 != 999;
+            batch->pts[n] = has_timestamps ? (int)pts : 0;
+            batch->dts[n] = batch->pts[n];
+            batch->has_pts[n] = has_timestamps;
+            batch->has_dts[n] = has_timestamps;
+            batch->duration[n] = is_video ? 3000 : 1024;
+            batch->pos[n] = (int64_t)i * 4096;
+            batch->picture_type[n] = !is_video ? PICTURE_UNKNOWN : frame % 60 == 0 ? PICTURE_I : frame % 3 == 0 ? PICTURE_P : PICTURE_B;
+            batch->is_reference[n] = batch->picture_type[n] != PICTURE_B;
+        }
+        packet_index_append(&index, *batch);
+    }
+    double cpu_ms = (cpu_now_ns() - cpu_start) / 1000000.0;
+    delete batch;
+
+    report("index_layout_cpu_per_million_packets", "synthetic", cpu_ms * 1000000.0 / NUM_PACKETS, "ms");
+
+    auto start = profiler_now_ns();
+    auto anomalies = timestamp_anomalies_scan(&index);
+    double ms = elapsed_ms(start);
+    report("anomaly_scan_per_million_packets", "synthetic", ms * 1000000.0 / NUM_PACKETS, "ms");
+    int num_gaps = 0;
+    for (auto& anomaly : anomalies) {
+        num_gaps += anomaly.kind == TimestampAnomaly::GAP;
+        if (anomaly.kind == TimestampAnomaly::DTS_NOT_MONOTONIC || anomaly.kind == TimestampAnomaly::DUPLICATE_PTS) {
+            char description[64];
+            timestamp_anomaly_describe(anomaly, description, sizeof(description));
+            printf("FAIL: synthetic packets flagged with %s at %.3fs\n", description, anomaly.time);
+            ++num_failures;
+            break;
+        }
+    }
+    if (num_gaps == 0) {
+        printf("FAIL: no timestamp gaps found in synthetic packets with gaps\n");
+        ++num_failures;
+    }
+}
+
+void bench_seek(const std::string& media, const char* filename, bool by_index) {
+    VideoReaderState state;
+    if (!bench_open(&state, filename, true, false)) {
+        return;
+    }
+
+    PacketIndex index;
+    packet_index_build(&index, &state);
+
+    // Seek to a spread of frames, the same way the video thread does
+    constexpr int NUM_SEEKS = 24;
+    double total_ms = 0.0;
+    double max_ms = 0.0;
+    int num_seeks = 0;
+    auto& packets = index.video_packets;
+    for (int i = 0; i < NUM_SEEKS && !packets.empty(); ++i) {
+        auto& pkt = packets[(long)packets.size() * (i * 7 % NUM_SEEKS) / NUM_SEEKS];
+
+        auto start = profiler_now_ns();
+        if (by_index) {
+            packet_index_seek(&index, &state, pkt);
+        } else {
+            video_reader_seek(&state, true, pkt.pts);
+        }
+        int res, packet_pts, pts;
+        while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+            if (res == RECEIVED_VIDEO && pts == pkt.pts) {
+                break;
+            }
+        }
+        double ms = elapsed_ms(start);
+
+        total_ms += ms;
+        max_ms = std::max(max_ms, ms);
+        ++num_seeks;
+    }
+
+    if (num_seeks > 0) {
+        report(by_index ? "seek_to_frame_mean" : "seek_by_pts_mean", media, total_ms / num_seeks, "ms");
+        report(by_index ? "seek_to_frame_max"  : "seek_by_pts_max",  media, max_ms, "ms");
+    }
+    video_reader_close(&state);
+}
+
+// Seeking to the leading pictures of an open GOP, e.g. the B-frames that
+// follow an MPEG-2 I-frame in decode order but show before it. They have to
+// decode from the keyframe before, or they never come out at all.
+void bench_seek_leading_pictures(const std::string& media, const char* filename) {
+    VideoReaderState state;
+    if (!bench_open(&state, filename, true, false)) {
+        return;
+    }
+
+    PacketIndex index;
+    packet_index_build(&index, &state);
+
+    // In decode order, after the first GOP
+    constexpr int NUM_SEEKS = 12;
+    std::vector<PacketInfo> leading;
+    int keyframe_pts = 0;
+    int num_keyframes = 0;
+    for (auto& pkt : index.all_packets) {
+        if (pkt.type == PacketInfo::VIDEO_KEY) {
+            keyframe_pts = pkt.pts;
+            ++num_keyframes;
+        } else if (pkt.type == PacketInfo::VIDEO_DELTA && num_keyframes > 1 && pkt.pts < keyframe_pts) {
+            leading.push_back(pkt);
+        }
+    }
+    if (leading.empty()) {
+        video_reader_close(&state);
+        return;
+    }
+
+    double total_ms = 0.0;
+    int num_seeks = 0;
+    for (int i = 0; i < NUM_SEEKS; ++i) {
+        auto& pkt = leading[leading.size() * i / NUM_SEEKS];
+
+        auto start = profiler_now_ns();
+        packet_index_seek(&index, &state, pkt);
+        bool found = false;
+        int res, packet_pts, pts;
+        while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+            if (res == RECEIVED_VIDEO && pts >= pkt.pts) {
+                found = pts == pkt.pts;
+                break;
+            }
+        }
+        total_ms += elapsed_ms(start);
+        ++num_seeks;
+
+        if (!found) {
+            printf("FAIL: %s leading picture at pts %d not decoded after seeking to it\n", media.c_str(), pkt.pts);
+            ++num_failures;
+        }
+    }
+
+    report("seek_leading_picture_mean", media, total_ms / num_seeks, "ms");
+    video_reader_close(&state);
+}
@@ -0,0 +1,48 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../parallel_decode.hpp"
+#include "../thread_pool.hpp"
+#include <atomic>
+#include <stdio.h>
+
+// Full-file decode throughput through the GOP-partitioned engine, for a
+// growing number of threads, to check how close scaling is to linear. Every
+// thread count has to decode the same number of frames.
+void bench_parallel_decode(const std::string& media, const char* filename) {
+    PacketIndex index;
+    if (!bench_build_index(filename, &index)) {
+        return;
+    }
+    if (index.video_packets.empty()) {
+        return;
+    }
+
+    int max_threads = thread_pool_shared()->num_threads();
+    long single_thread_frames = 0;
+    for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        ThreadPool pool;
+        ThreadPool::init(&pool, num_threads);
+
+        // A few ranges per thread evens out ranges of different cost
+        auto ranges = parallel_decode_split(&index, num_threads * 4);
+        std::atomic_long num_frames(0);
+        auto start = profiler_now_ns();
+        parallel_decode_video(filename, ranges, &pool, NULL, [&](int range, VideoReaderState* state, int pts) {
+            ++num_frames;
+        }, nullptr);
+        double ms = elapsed_ms(start);
+        ThreadPool::destroy(&pool);
+
+        char name[48];
+        snprintf(name, sizeof(name), "parallel_decode_%dt", num_threads);
+        report(name, media, num_frames / (ms / 1000.0), "frames/s");
+
+        if (num_threads == 1) {
+            single_thread_frames = num_frames;
+        }
+        if (num_frames == 0 || num_frames != single_thread_frames) {
+            printf("FAIL: %s decoded %ld frames on %d threads, %ld on one\n", media.c_str(), (long)num_frames, num_threads, single_thread_frames);
+            ++num_failures;
+        }
+    }
+}
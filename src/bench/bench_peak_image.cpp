@@ -0,0 +1,40 @@
+#include <ddui/core>
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../peak_image.hpp"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+void bench_peak_image() {
+    constexpr int NUM_SAMPLES = 48000 * 60;
+    constexpr int NUM_CHANNELS = 2;
+    constexpr int ITERATIONS = 20;
+
+    std::vector<float> samples(NUM_SAMPLES * NUM_CHANNELS);
+    for (int i = 0; i < samples.size(); ++i) {
+        samples[i] = sin(i * 0.001) * 0.8;
+    }
+
+    // Render into plain memory, no texture is needed to time the rendering
+    int sizes[][2] = { { 512, 64 }, { 2048, 128 } };
+    for (auto& size : sizes) {
+        Image img;
+        img.image_id = -1;
+        img.width = size[0];
+        img.height = size[1];
+        img.data = (unsigned char*)malloc(4 * img.width * img.height);
+
+        auto start = profiler_now_ns();
+        for (int i = 0; i < ITERATIONS; ++i) {
+            render_peak_image(img, &samples[0], NUM_SAMPLES, NUM_CHANNELS, ddui::rgb(0x33ff33));
+        }
+        double ms = elapsed_ms(start) / ITERATIONS;
+
+        char media[32];
+        snprintf(media, sizeof(media), "%dx%d", img.width, img.height);
+        report("render_peak_image", media, ms, "ms");
+        free(img.data);
+    }
+}
@@ -0,0 +1,33 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../data_types/ring_buffer.hpp"
+#include <string.h>
+#include <vector>
+
+void bench_ring_buffer() {
+    constexpr int BLOCK_SIZE = 512 * 2;
+    constexpr long TOTAL_SAMPLES = 200000000;
+
+    RingBuffer rb;
+    RingBuffer::init(&rb, 8192);
+
+    std::vector<float> block(BLOCK_SIZE, 0.25f);
+    auto start = profiler_now_ns();
+    for (long i = 0; i < TOTAL_SAMPLES; i += BLOCK_SIZE) {
+        int size_1, size_2;
+        float *buffer_1, *buffer_2;
+        rb.write_start(BLOCK_SIZE, &size_1, &buffer_1, &size_2, &buffer_2);
+        memcpy(buffer_1, &block[0], size_1 * sizeof(float));
+        memcpy(buffer_2, &block[size_1], size_2 * sizeof(float));
+        rb.write_end(BLOCK_SIZE);
+
+        rb.read_start(BLOCK_SIZE, &size_1, &buffer_1, &size_2, &buffer_2);
+        memcpy(&block[0], buffer_1, size_1 * sizeof(float));
+        memcpy(&block[size_1], buffer_2, size_2 * sizeof(float));
+        rb.read_end(BLOCK_SIZE);
+    }
+    double ms = elapsed_ms(start);
+
+    report("ring_buffer_throughput", "-", TOTAL_SAMPLES / (ms / 1000.0), "samples/s");
+    RingBuffer::destroy(&rb);
+}
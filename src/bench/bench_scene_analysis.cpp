@@ -0,0 +1,114 @@
+#include "bench.hpp"
+#include "media_gen.hpp"
+#include "../profiler.hpp"
+#include "../scene_analysis.hpp"
+#include "../thread_pool.hpp"
+#include <stdio.h>
+#include <vector>
+
+// Scene analysis over the whole file, as a multiple of real time. The
+// fixtures are moving gradients, so every frame has to be analysed and none
+// is black.
+void bench_scene_analysis(const std::string& media, const char* filename) {
+    PacketIndex index;
+    if (!bench_build_index(filename, &index)) {
+        return;
+    }
+    if (index.video_packets.empty()) {
+        return;
+    }
+
+    std::vector<SceneFrame> frames;
+    auto start = profiler_now_ns();
+    scene_analysis_run(filename, &index, thread_pool_shared(), NULL, NULL, &frames);
+    double ms = elapsed_ms(start);
+
+    report("scene_analysis_speed", media, index.duration * 1000.0 / ms, "x realtime");
+
+    if (frames.size() != index.video_packets.size()) {
+        printf("FAIL: %s scene analysis returned %zu frames for %zu video packets\n", media.c_str(), frames.size(), index.video_packets.size());
+        ++num_failures;
+    }
+    for (auto& frame : frames) {
+        if (frame.flags & SCENE_BLACK) {
+            printf("FAIL: %s frame at pts %d taken for black, mean luma %.1f\n", media.c_str(), frame.pts, frame.mean_luma);
+            ++num_failures;
+            break;
+        }
+    }
+}
+
+// Scene analysis has to find the edit of the MEDIA_SCENES fixture: both
+// cuts, the first of which comes before the cut history has filled, no
+// other cuts within those scenes, all of the black and the frozen run
+void bench_scene_detection(const std::string& media, const char* filename) {
+    PacketIndex index;
+    if (!bench_build_index(filename, &index)) {
+        return;
+    }
+
+    std::vector<SceneFrame> frames;
+    scene_analysis_run(filename, &index, thread_pool_shared(), NULL, NULL, &frames);
+    if (frames.size() != SCENES_NUM_FRAMES) {
+        printf("FAIL: %s scene analysis returned %zu frames, the edit has %d\n", media.c_str(), frames.size(), SCENES_NUM_FRAMES);
+        ++num_failures;
+        return;
+    }
+
+    int num_wrong = 0;
+    for (int i = 0; i < SCENES_NUM_FRAMES; ++i) {
+        auto flags = frames[i].flags;
+        bool cut = i == SCENES_FIRST_CUT || i == SCENES_SECOND_CUT;
+        bool within_scene = i > 0 && i < SCENES_BLACK_BEGIN;
+        bool black = i >= SCENES_BLACK_BEGIN && i < SCENES_FROZEN_BEGIN;
+        bool frozen = i > SCENES_FROZEN_BEGIN && i < SCENES_FROZEN_END;
+        bool moving = i < SCENES_BLACK_BEGIN || i > SCENES_FROZEN_END;
+
+        const char* wrong = NULL;
+        if (within_scene && cut != !!(flags & SCENE_CUT)) {
+            wrong = cut ? "missed cut" : "cut";
+        } else if (black != !!(flags & SCENE_BLACK)) {
+            wrong = black ? "missed black" : "black";
+        } else if (frozen && !(flags & SCENE_FROZEN)) {
+            wrong = "missed freeze";
+        } else if (moving && (flags & SCENE_FROZEN)) {
+            wrong = "frozen";
+        }
+        if (wrong && num_wrong++ == 0) {
+            printf("FAIL: %s frame %d: %s (diff %.2f, mean luma %.1f)\n", media.c_str(), i, wrong, frames[i].diff, frames[i].mean_luma);
+            ++num_failures;
+        }
+    }
+    report("scene_detection_wrong_frames", media, num_wrong, "frames");
+}
+
+// The luma kernels alone, on a 1080p 4:2:0 frame
+void bench_luma_thumbnail() {
+    AVFrame* frame = av_frame_alloc();
+    frame->format = AV_PIX_FMT_YUV420P;
+    frame->width = 1920;
+    frame->height = 1080;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return;
+    }
+    for (int y = 0; y < frame->height; ++y) {
+        for (int x = 0; x < frame->width; ++x) {
+            frame->data[0][y * frame->linesize[0] + x] = (uint8_t)(x + y);
+        }
+    }
+
+    constexpr int NUM_ITERATIONS = 200;
+    LumaThumbnail a, b;
+    luma_thumbnail_compute(frame, &b);
+    volatile float diff = 0; // keeps the loop from being optimized out
+    auto start = profiler_now_ns();
+    for (int i = 0; i < NUM_ITERATIONS; ++i) {
+        luma_thumbnail_compute(frame, &a);
+        diff = luma_thumbnail_diff(a, b);
+    }
+    double ms = elapsed_ms(start);
+    av_frame_free(&frame);
+
+    report("luma_thumbnail_per_frame", "1080p", ms * 1000.0 / NUM_ITERATIONS, "us");
+}
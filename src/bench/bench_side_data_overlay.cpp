@@ -0,0 +1,54 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include "../side_data_overlay.hpp"
+#include <algorithm>
+#include <stdio.h>
+
+// Decoding every video frame with the motion vector and QP export on,
+// including storing them for the overlay, compared to decoding without.
+// The fixtures move, so predicted frames have to come with motion vectors,
+// and the overlay has to stay within its budget.
+void bench_side_data_export(const std::string& media, const char* filename) {
+    double ms[2];
+    long bytes = 0;
+    int num_predicted = 0;
+    bool have_vectors = false;
+    for (int pass = 0; pass < 2; ++pass) {
+        VideoReaderState state;
+        if (!bench_open(&state, filename, true, false)) {
+            return;
+        }
+        video_reader_select_streams(&state, true, false);
+        video_reader_set_export_side_data(&state, pass == 1);
+
+        SideDataOverlay overlay;
+        SideDataOverlay::init(&overlay);
+        auto start = profiler_now_ns();
+        int res, packet_pts, pts;
+        while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+            if (res == RECEIVED_VIDEO && pass == 1) {
+                side_data_overlay_add(&overlay, pts, state.video_frame);
+                num_predicted += state.video_frame->pict_type != AV_PICTURE_TYPE_I;
+            }
+        }
+        ms[pass] = elapsed_ms(start);
+        for (auto& entry : overlay.entries) {
+            have_vectors = have_vectors || !entry.vectors.empty();
+        }
+        if (overlay.bytes > SideDataOverlay::BUDGET) {
+            printf("FAIL: %s side data overlay holds %ld bytes, over its budget\n", media.c_str(), overlay.bytes);
+            ++num_failures;
+        }
+        bytes = overlay.bytes / std::max(1, (int)overlay.entries.size());
+        SideDataOverlay::destroy(&overlay);
+        video_reader_close(&state);
+    }
+
+    report("side_data_export_overhead", media, (ms[1] / ms[0] - 1.0) * 100.0, "%");
+    report("side_data_bytes_per_frame", media, bytes, "bytes");
+
+    if (num_predicted > 0 && !have_vectors) {
+        printf("FAIL: %s has %d predicted frames but no motion vectors\n", media.c_str(), num_predicted);
+        ++num_failures;
+    }
+}
@@ -0,0 +1,129 @@
+#include "bench.hpp"
+#include "../profiler.hpp"
+#include <algorithm>
+#include <vector>
+
+// Time to first paint without the UI: opening the file, then decoding and
+// converting the first frame, with FFmpeg's default probing limits and ours
+void bench_startup(const std::string& media, const char* filename) {
+    struct { const char* suffix; VideoReaderProbeLimits limits; } configs[] = {
+        { "ffmpeg_default", PROBE_LIMITS_FFMPEG_DEFAULT },
+        { "fast",           PROBE_LIMITS_FAST           },
+    };
+    for (auto& config : configs) {
+        video_reader_set_probe_limits(config.limits);
+
+        VideoReaderState state;
+        auto start = profiler_now_ns();
+        if (!video_reader_open(&state, filename)) {
+            continue;
+        }
+        double open_ms = elapsed_ms(start);
+        int64_t open_bytes = state.avio_ctx->bytes_read;
+
+        std::vector<uint8_t> frame;
+        int res, packet_pts, pts;
+        while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+            if (res == RECEIVED_VIDEO) {
+                frame.resize((size_t)state.width * state.height * 4);
+                video_reader_transfer_video_frame(&state, frame.data());
+                break;
+            }
+            if (res > 0 && state.video_stream_index == -1) {
+                break;
+            }
+        }
+        double first_frame_ms = elapsed_ms(start);
+        video_reader_close(&state);
+
+        std::string name = std::string("open_ms_") + config.suffix;
+        report(name.c_str(), media, open_ms, "ms");
+        name = std::string("open_bytes_") + config.suffix;
+        report(name.c_str(), media, open_bytes, "bytes");
+        name = std::string("first_frame_ms_") + config.suffix;
+        report(name.c_str(), media, first_frame_ms, "ms");
+    }
+    video_reader_set_probe_limits(PROBE_LIMITS_FAST);
+}
+
+void bench_audio_conversion(const std::string& media, const char* filename) {
+    VideoReaderState state;
+    if (!bench_open(&state, filename, false, true)) {
+        return;
+    }
+
+    std::vector<float> buffer;
+    int64_t convert_ns = 0;
+    long num_samples = 0;
+    int res, packet_pts, pts;
+    while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+        if (res == RECEIVED_VIDEO) {
+            continue;
+        }
+        buffer.resize(res * state.num_channels);
+
+        // Split the frame the way a wrapping ring buffer would
+        int size_1 = res / 2;
+        int size_2 = res - size_1;
+        auto start = profiler_now_ns();
+        video_reader_transfer_audio_frame(&state, size_1, &buffer[0], size_2, &buffer[size_1 * state.num_channels]);
+        convert_ns += profiler_now_ns() - start;
+        num_samples += res;
+    }
+
+    if (convert_ns > 0) {
+        report("audio_conversion", media, num_samples / (convert_ns / 1000000000.0), "frames/s");
+    }
+    video_reader_close(&state);
+}
+
+// What an idle file pays to decode again once its decoders were released:
+// seeking back to the start and decoding the first frame, with the decoder
+// open and after video_reader_release_decoders
+void bench_decoder_release(const std::string& media, const char* filename) {
+    constexpr int NUM_ROUNDS = 10;
+
+    VideoReaderState state;
+    if (!bench_open(&state, filename, true, false)) {
+        return;
+    }
+    video_reader_select_streams(&state, true, false);
+
+    auto first_frame = [&]() {
+        int res, packet_pts, pts;
+        while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+            if (res == RECEIVED_VIDEO) {
+                return true;
+            }
+        }
+        return false;
+    };
+    if (!first_frame()) {
+        printf("FAIL: no video frame in %s\n", media.c_str());
+        ++num_failures;
+        video_reader_close(&state);
+        return;
+    }
+
+    double ms[2] = { 0, 0 };
+    for (int round = 0; round < NUM_ROUNDS; ++round) {
+        for (int released = 0; released < 2; ++released) {
+            if (released) {
+                video_reader_release_decoders(&state);
+            }
+            auto start = profiler_now_ns();
+            video_reader_seek(&state, true, 0);
+            if (!first_frame()) {
+                printf("FAIL: no video frame after %s decoders in %s\n", released ? "releasing" : "keeping", media.c_str());
+                ++num_failures;
+                video_reader_close(&state);
+                return;
+            }
+            ms[released] += elapsed_ms(start);
+        }
+    }
+
+    report("first_frame_warm_ms", media, ms[0] / NUM_ROUNDS, "ms");
+    report("first_frame_released_ms", media, ms[1] / NUM_ROUNDS, "ms");
+    video_reader_close(&state);
+}
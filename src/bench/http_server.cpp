@@ -0,0 +1,216 @@
+#include "http_server.hpp"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+struct Connection {
+    HttpServer* server;
+    int fd;
+};
+
+static bool send_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, SEND_FLAGS);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool respond(HttpServer* server, int fd, const std::string& request) {
+    ++server->num_requests;
+    if (server->latency_ms > 0) {
+        poll(NULL, 0, server->latency_ms);
+    }
+
+    int64_t first = 0;
+    int64_t last = server->file_size - 1;
+    bool ranged = false;
+    auto range = request.find("\r\nRange: bytes=");
+    if (range != std::string::npos) {
+        ranged = true;
+        const char* spec = request.c_str() + range + strlen("\r\nRange: bytes=");
+        char* end;
+        first = strtoll(spec, &end, 10);
+        if (*end == '-' && end[1] >= '0' && end[1] <= '9') {
+            last = std::min(last, (int64_t)strtoll(end + 1, NULL, 10));
+        }
+    }
+
+    char headers[256];
+    if (ranged && first >= server->file_size) {
+        int size = snprintf(headers, sizeof(headers),
+                            "HTTP/1.1 416 Range Not Satisfiable\r\n"
+                            "Content-Range: bytes */%lld\r\n"
+                            "Content-Length: 0\r\n\r\n",
+                            (long long)server->file_size);
+        return send_all(fd, headers, size);
+    }
+
+    int size = ranged ? snprintf(headers, sizeof(headers),
+                                 "HTTP/1.1 206 Partial Content\r\n"
+                                 "Content-Range: bytes %lld-%lld/%lld\r\n"
+                                 "Content-Length: %lld\r\n\r\n",
+                                 (long long)first, (long long)last, (long long)server->file_size,
+                                 (long long)(last - first + 1))
+                      : snprintf(headers, sizeof(headers),
+                                 "HTTP/1.1 200 OK\r\n"
+                                 "Content-Length: %lld\r\n\r\n",
+                                 (long long)server->file_size);
+    if (!send_all(fd, headers, size)) {
+        return false;
+    }
+
+    char buffer[65536];
+    for (int64_t offset = first; offset <= last; ) {
+        ssize_t bytes = pread(server->file_fd, buffer, std::min<int64_t>(sizeof(buffer), last - offset + 1), offset);
+        if (bytes <= 0 || !send_all(fd, buffer, bytes)) {
+            return false;
+        }
+        offset += bytes;
+    }
+    return true;
+}
+
+// Serves requests on one keep-alive connection until the client closes it
+static void* connection_func(void* ptr) {
+    auto connection = (Connection*)ptr;
+    auto server = connection->server;
+    int fd = connection->fd;
+    delete connection;
+
+    std::string pending;
+    char chunk[4096];
+    while (!server->stopping) {
+        size_t end;
+        while ((end = pending.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                return 0;
+            }
+            pending.append(chunk, bytes);
+        }
+        std::string request = pending.substr(0, end + 2);
+        pending.erase(0, end + 4);
+        if (!respond(server, fd, request)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+static void* accept_func(void* ptr) {
+    auto server = (HttpServer*)ptr;
+    while (!server->stopping) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(server->connections_mutex);
+        if (server->stopping) {
+            close(fd);
+            break;
+        }
+        pthread_t thread;
+        pthread_create(&thread, NULL, connection_func, new Connection { server, fd });
+        server->connection_fds.push_back(fd);
+        server->connection_threads.push_back(thread);
+    }
+    return 0;
+}
+
+bool http_server_start(HttpServer* server, const char* filename, int latency_ms) {
+    server->file_fd = open(filename, O_RDONLY);
+    if (server->file_fd < 0) {
+        printf("Couldn't open %s\n", filename);
+        return false;
+    }
+    struct stat st;
+    fstat(server->file_fd, &st);
+    server->file_size = st.st_size;
+    server->latency_ms = latency_ms;
+    server->stopping = false;
+    server->num_requests = 0;
+
+    // Any free port on the loopback interface
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t address_size = sizeof(address);
+    if (server->listen_fd < 0 ||
+        bind(server->listen_fd, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(server->listen_fd, 64) != 0 ||
+        getsockname(server->listen_fd, (sockaddr*)&address, &address_size) != 0) {
+        printf("Couldn't start the HTTP server\n");
+        if (server->listen_fd >= 0) {
+            close(server->listen_fd);
+        }
+        close(server->file_fd);
+        return false;
+    }
+    server->port = ntohs(address.sin_port);
+
+    pthread_create(&server->accept_thread, NULL, accept_func, server);
+    return true;
+}
+
+void http_server_stop(HttpServer* server) {
+    {
+        std::lock_guard<std::mutex> lock(server->connections_mutex);
+        server->stopping = true;
+        for (int fd : server->connection_fds) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    // Wakes up accept()
+    shutdown(server->listen_fd, SHUT_RDWR);
+    pthread_join(server->accept_thread, NULL);
+    close(server->listen_fd);
+
+    for (auto thread : server->connection_threads) {
+        pthread_join(thread, NULL);
+    }
+    for (int fd : server->connection_fds) {
+        close(fd);
+    }
+    server->connection_fds.clear();
+    server->connection_threads.clear();
+    close(server->file_fd);
+}
+
+std::string http_server_url(HttpServer* server, const char* path) {
+    char url[512];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d/%s", server->port, path);
+    return url;
+}
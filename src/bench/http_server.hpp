@@ -0,0 +1,35 @@
+#ifndef http_server_hpp
+#define http_server_hpp
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Minimal local HTTP/1.1 server for one file, with range and keep-alive
+// support, standing in for a remote object store. Every request is delayed
+// by latency_ms to make the network round trips visible.
+struct HttpServer {
+    int listen_fd;
+    int port;
+    int file_fd;
+    int64_t file_size;
+    int latency_ms;
+    std::atomic_bool stopping;
+    std::atomic_int num_requests;
+    pthread_t accept_thread;
+
+    std::mutex connections_mutex;
+    std::vector<int> connection_fds;
+    std::vector<pthread_t> connection_threads;
+};
+
+bool http_server_start(HttpServer* server, const char* filename, int latency_ms);
+void http_server_stop(HttpServer* server);
+
+// URL the file is served at
+std::string http_server_url(HttpServer* server, const char* path);
+
+#endif
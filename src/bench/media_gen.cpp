@@ -0,0 +1,293 @@
+#include "media_gen.hpp"
+#include <math.h>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+#include <libavutil/channel_layout.h>
+}
+
+struct OutputStream {
+    AVStream* stream;
+    AVCodecContext* ctx;
+    AVFrame* frame;
+    int64_t next_pts;
+    int frame_index;
+};
+
+static bool open_stream(AVFormatContext* fmt, OutputStream* os, const MediaSpec* spec, bool video) {
+    AVCodecID codec_id = video ? spec->video_codec : spec->audio_codec;
+    AVCodec* codec = avcodec_find_encoder(codec_id);
+    if (!codec) {
+        printf("Couldn't find encoder for %s\n", avcodec_get_name(codec_id));
+        return false;
+    }
+
+    os->stream = avformat_new_stream(fmt, NULL);
+    if (!os->stream) {
+        printf("Couldn't create AVStream\n");
+        return false;
+    }
+
+    AVCodecContext* ctx = os->ctx = avcodec_alloc_context3(codec);
+    if (!ctx) {
+        printf("Couldn't create AVCodecContext\n");
+        return false;
+    }
+
+    if (video) {
+        ctx->width = spec->width;
+        ctx->height = spec->height;
+        ctx->time_base = { 1, spec->frame_rate };
+        ctx->framerate = { spec->frame_rate, 1 };
+        ctx->gop_size = spec->gop_size;
+        ctx->max_b_frames = spec->max_b_frames;
+        ctx->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+        ctx->bit_rate = (int64_t)spec->width * spec->height * spec->frame_rate / 8;
+    } else {
+        ctx->sample_fmt = spec->sample_format;
+        if (codec->sample_fmts) {
+            ctx->sample_fmt = codec->sample_fmts[0];
+            for (auto f = codec->sample_fmts; *f != AV_SAMPLE_FMT_NONE; ++f) {
+                if (*f == spec->sample_format) {
+                    ctx->sample_fmt = *f;
+                }
+            }
+        }
+        ctx->sample_rate = spec->sample_rate;
+        ctx->channels = spec->num_channels;
+        ctx->channel_layout = av_get_default_channel_layout(spec->num_channels);
+        ctx->time_base = { 1, spec->sample_rate };
+        ctx->bit_rate = 64000 * spec->num_channels;
+        ctx->strict_std_compliance = FF_COMPLIANCE_EXPERIMENTAL;
+    }
+    ctx->flags |= AV_CODEC_FLAG_BITEXACT;
+    if (fmt->oformat->flags & AVFMT_GLOBALHEADER) {
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        printf("Couldn't open encoder %s\n", codec->name);
+        return false;
+    }
+    if (avcodec_parameters_from_context(os->stream->codecpar, ctx) < 0) {
+        printf("Couldn't copy codec parameters\n");
+        return false;
+    }
+    os->stream->time_base = ctx->time_base;
+
+    AVFrame* frame = os->frame = av_frame_alloc();
+    if (!frame) {
+        printf("Couldn't allocate AVFrame\n");
+        return false;
+    }
+    if (video) {
+        frame->format = ctx->pix_fmt;
+        frame->width = ctx->width;
+        frame->height = ctx->height;
+    } else {
+        frame->format = ctx->sample_fmt;
+        frame->channels = ctx->channels;
+        frame->channel_layout = ctx->channel_layout;
+        frame->sample_rate = ctx->sample_rate;
+        frame->nb_samples = ctx->frame_size > 0 ? ctx->frame_size : 1024;
+    }
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        printf("Couldn't allocate frame buffers\n");
+        return false;
+    }
+
+    os->next_pts = 0;
+    os->frame_index = 0;
+    return true;
+}
+
+static void close_stream(OutputStream* os) {
+    if (os->ctx) {
+        avcodec_free_context(&os->ctx);
+    }
+    if (os->frame) {
+        av_frame_free(&os->frame);
+    }
+}
+
+enum Pattern {
+    PATTERN_DIAGONAL,
+    PATTERN_REVERSED,
+    PATTERN_VERTICAL,
+    PATTERN_BLACK,
+};
+
+// Moving gradients, different for each plane, so that every frame differs
+// and motion search has something to find. Each pattern is far enough from
+// the others that changing pattern is a cut.
+static void fill_pattern(AVFrame* frame, Pattern pattern, int i) {
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    for (int plane = 0; plane < 4 && frame->data[plane]; ++plane) {
+        bool chroma = plane == 1 || plane == 2;
+        int w = chroma ? AV_CEIL_RSHIFT(frame->width,  desc->log2_chroma_w) : frame->width;
+        int h = chroma ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+        for (int y = 0; y < h; ++y) {
+            uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+            for (int x = 0; x < w; ++x) {
+                switch (pattern) {
+                    case PATTERN_DIAGONAL: row[x] = plane == 0 ? x + y + i * 3 : plane == 1 ? 128 + y + i * 2 : 64 + x + i * 5; break;
+                    case PATTERN_REVERSED: row[x] = plane == 0 ? 255 - x - y + i * 3 : plane == 1 ? 64 + x + i * 2 : 128 + y + i * 5; break;
+                    case PATTERN_VERTICAL: row[x] = plane == 0 ? y * 2 + i * 3 : plane == 1 ? 192 - x + i : 32 + y + i; break;
+                    case PATTERN_BLACK:    row[x] = plane == 0 ? 16 : 128; break;
+                }
+            }
+        }
+    }
+}
+
+static void fill_video_frame(AVFrame* frame, MediaContent content, int i) {
+    if (content != MEDIA_SCENES) {
+        fill_pattern(frame, PATTERN_DIAGONAL, i);
+    } else if (i < SCENES_FIRST_CUT) {
+        fill_pattern(frame, PATTERN_DIAGONAL, i);
+    } else if (i < SCENES_SECOND_CUT) {
+        fill_pattern(frame, PATTERN_REVERSED, i);
+    } else if (i < SCENES_BLACK_BEGIN) {
+        fill_pattern(frame, PATTERN_VERTICAL, i);
+    } else if (i < SCENES_FROZEN_BEGIN) {
+        fill_pattern(frame, PATTERN_BLACK, i);
+    } else if (i < SCENES_FROZEN_END) {
+        fill_pattern(frame, PATTERN_DIAGONAL, SCENES_FROZEN_BEGIN);
+    } else {
+        fill_pattern(frame, PATTERN_DIAGONAL, i);
+    }
+}
+
+// One sine per channel, at a different pitch for each channel
+static void fill_audio_frame(AVFrame* frame, int64_t first_sample) {
+    auto format = (AVSampleFormat)frame->format;
+    bool planar = av_sample_fmt_is_planar(format);
+    auto packed = av_get_packed_sample_fmt(format);
+    int channels = frame->channels;
+
+    for (int c = 0; c < channels; ++c) {
+        double step = 2.0 * M_PI * 220.0 * (c + 1) / frame->sample_rate;
+        for (int s = 0; s < frame->nb_samples; ++s) {
+            double value = 0.5 * sin(step * (first_sample + s));
+            int i = planar ? s : s * channels + c;
+            uint8_t* data = frame->data[planar ? c : 0];
+            switch (packed) {
+                case AV_SAMPLE_FMT_S16: ((int16_t*)data)[i] = (int16_t)(value * INT16_MAX); break;
+                case AV_SAMPLE_FMT_S32: ((int32_t*)data)[i] = (int32_t)(value * INT32_MAX); break;
+                case AV_SAMPLE_FMT_FLT: ((float*)data)[i] = (float)value; break;
+                case AV_SAMPLE_FMT_DBL: ((double*)data)[i] = value; break;
+                default: break;
+            }
+        }
+    }
+}
+
+static bool write_frame(AVFormatContext* fmt, OutputStream* os, AVFrame* frame, AVPacket* packet) {
+    int response = avcodec_send_frame(os->ctx, frame);
+    if (response < 0) {
+        printf("Failed to encode frame\n");
+        return false;
+    }
+
+    while (true) {
+        response = avcodec_receive_packet(os->ctx, packet);
+        if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
+            return true;
+        } else if (response < 0) {
+            printf("Failed to encode frame\n");
+            return false;
+        }
+
+        av_packet_rescale_ts(packet, os->ctx->time_base, os->stream->time_base);
+        packet->stream_index = os->stream->index;
+        response = av_interleaved_write_frame(fmt, packet);
+        if (response < 0) {
+            printf("Failed to write packet\n");
+            return false;
+        }
+    }
+}
+
+bool media_gen_write(const MediaSpec* spec, const char* filename) {
+
+    AVFormatContext* fmt = NULL;
+    if (avformat_alloc_output_context2(&fmt, NULL, spec->format_name, filename) < 0 || !fmt) {
+        printf("Couldn't create output format %s\n", spec->format_name);
+        return false;
+    }
+    fmt->flags |= AVFMT_FLAG_BITEXACT;
+
+    OutputStream video = { 0 };
+    OutputStream audio = { 0 };
+    bool has_video = spec->video_codec != AV_CODEC_ID_NONE;
+    bool has_audio = spec->audio_codec != AV_CODEC_ID_NONE;
+    AVPacket* packet = av_packet_alloc();
+
+    bool success = false;
+    do {
+        if (has_video && !open_stream(fmt, &video, spec, true)) {
+            break;
+        }
+        if (has_audio && !open_stream(fmt, &audio, spec, false)) {
+            break;
+        }
+        if (avio_open(&fmt->pb, filename, AVIO_FLAG_WRITE) < 0) {
+            printf("Couldn't open %s for writing\n", filename);
+            break;
+        }
+        if (avformat_write_header(fmt, NULL) < 0) {
+            printf("Couldn't write header\n");
+            break;
+        }
+
+        int64_t num_frames  = has_video ? (int64_t)(spec->duration * spec->frame_rate) : 0;
+        int64_t num_samples = has_audio ? (int64_t)(spec->duration * spec->sample_rate) : 0;
+        bool video_done = !has_video;
+        bool audio_done = !has_audio;
+        bool failed = false;
+
+        // Interleave by presentation time
+        while (!failed && (!video_done || !audio_done)) {
+            bool write_video = !video_done &&
+                (audio_done || av_compare_ts(video.next_pts, video.ctx->time_base,
+                                             audio.next_pts, audio.ctx->time_base) <= 0);
+            if (write_video) {
+                if (video.next_pts >= num_frames) {
+                    failed = !write_frame(fmt, &video, NULL, packet);
+                    video_done = true;
+                    continue;
+                }
+                av_frame_make_writable(video.frame);
+                fill_video_frame(video.frame, spec->content, video.frame_index++);
+                video.frame->pts = video.next_pts++;
+                failed = !write_frame(fmt, &video, video.frame, packet);
+            } else {
+                if (audio.next_pts >= num_samples) {
+                    failed = !write_frame(fmt, &audio, NULL, packet);
+                    audio_done = true;
+                    continue;
+                }
+                av_frame_make_writable(audio.frame);
+                fill_audio_frame(audio.frame, audio.next_pts);
+                audio.frame->pts = audio.next_pts;
+                audio.next_pts += audio.frame->nb_samples;
+                failed = !write_frame(fmt, &audio, audio.frame, packet);
+            }
+        }
+        if (failed) {
+            break;
+        }
+
+        av_write_trailer(fmt);
+        success = true;
+    } while (false);
+
+    close_stream(&video);
+    close_stream(&audio);
+    av_packet_free(&packet);
+    if (fmt->pb) {
+        avio_closep(&fmt->pb);
+    }
+    avformat_free_context(fmt);
+    return success;
+}
@@ -0,0 +1,52 @@
+#ifndef media_gen_hpp
+#define media_gen_hpp
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// What the video shows
+enum MediaContent {
+    MEDIA_GRADIENTS, // moving gradients, different in every frame
+    MEDIA_SCENES,    // the edit below, for checking scene analysis
+};
+
+// The edit of MEDIA_SCENES, in frames: moving gradients that cut to other
+// moving gradients, a run of black, then a still frame until the gradients
+// move again. It needs SCENES_NUM_FRAMES frames.
+constexpr int SCENES_FIRST_CUT = 5;
+constexpr int SCENES_SECOND_CUT = 100;
+constexpr int SCENES_BLACK_BEGIN = 150;
+constexpr int SCENES_FROZEN_BEGIN = 175; // where the black ends
+constexpr int SCENES_FROZEN_END = 225;
+constexpr int SCENES_NUM_FRAMES = 300;
+
+// Description of a deterministic synthetic media file. Either stream can be
+// left out by setting its codec to AV_CODEC_ID_NONE.
+struct MediaSpec {
+    const char* name;
+    const char* format_name; // muxer name, e.g. "matroska", "mp4", "mpegts"
+    const char* extension;
+    double duration;         // seconds
+
+    AVCodecID video_codec;
+    int width;
+    int height;
+    int frame_rate;
+    int gop_size;
+    int max_b_frames;
+
+    AVCodecID audio_codec;
+    AVSampleFormat sample_format;
+    int sample_rate;
+    int num_channels;
+
+    MediaContent content; // MEDIA_GRADIENTS when left out
+};
+
+// Encodes the described file with libavcodec. The same spec always
+// produces the same bytes for a given FFmpeg build.
+bool media_gen_write(const MediaSpec* spec, const char* filename);
+
+#endif
@@ -0,0 +1,120 @@
+#include "block_cache.hpp"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+
+// Constructor, destructor
+void BlockCache::init(BlockCache* cache, int block_size, int capacity, const char* spill_dir) {
+    cache->block_size = block_size;
+    cache->capacity = capacity;
+    cache->clock = 0;
+    cache->entries = new Entry[capacity];
+    for (int i = 0; i < capacity; ++i) {
+        auto& entry = cache->entries[i];
+        entry.used = false;
+        entry.block = 0;
+        entry.size = 0;
+        entry.last_used = 0;
+        posix_memalign((void**)&entry.data, 128, block_size);
+    }
+
+    // The spill file is unlinked straight away so that it goes away with us
+    cache->spill_fd = -1;
+    if (spill_dir) {
+        std::string path = std::string(spill_dir) + "/video_inspect_spill_XXXXXX";
+        cache->spill_fd = mkstemp(&path[0]);
+        if (cache->spill_fd < 0) {
+            printf("Couldn't create a spill file in %s\n", spill_dir);
+        } else {
+            unlink(path.c_str());
+        }
+    }
+}
+
+void BlockCache::destroy(BlockCache* cache) {
+    for (int i = 0; i < cache->capacity; ++i) {
+        free(cache->entries[i].data);
+    }
+    delete[] cache->entries;
+    cache->entries = NULL;
+    cache->capacity = 0;
+    cache->lookup.clear();
+    cache->spilled.clear();
+    if (cache->spill_fd >= 0) {
+        close(cache->spill_fd);
+        cache->spill_fd = -1;
+    }
+}
+
+const uint8_t* BlockCache::find(int64_t block, int* size) {
+    auto it = this->lookup.find(block);
+    if (it != this->lookup.end()) {
+        auto& entry = this->entries[it->second];
+        entry.last_used = ++this->clock;
+        *size = entry.size;
+        return entry.data;
+    }
+
+    // Bring spilled blocks back into memory
+    auto spilled_it = this->spilled.find(block);
+    if (spilled_it == this->spilled.end()) {
+        return NULL;
+    }
+    int spilled_size = spilled_it->second;
+    auto data = this->insert(block, spilled_size);
+    ssize_t bytes;
+    do {
+        bytes = pread(this->spill_fd, data, spilled_size, block * this->block_size);
+    } while (bytes < 0 && errno == EINTR);
+    if (bytes != spilled_size) {
+        this->entries[this->lookup[block]].used = false;
+        this->lookup.erase(block);
+        this->spilled.erase(block);
+        return NULL;
+    }
+    *size = spilled_size;
+    return data;
+}
+
+uint8_t* BlockCache::insert(int64_t block, int size) {
+    // Pick a free entry, or the least recently used one
+    int victim = -1;
+    for (int i = 0; i < this->capacity; ++i) {
+        auto& entry = this->entries[i];
+        if (!entry.used) {
+            victim = i;
+            break;
+        }
+        if (victim == -1 || entry.last_used < this->entries[victim].last_used) {
+            victim = i;
+        }
+    }
+    if (victim == -1) {
+        return NULL;
+    }
+
+    auto& entry = this->entries[victim];
+    if (entry.used) {
+        this->lookup.erase(entry.block);
+
+        // Blocks sit at their own offset in the (sparse) spill file
+        if (this->spill_fd >= 0 && !this->spilled.count(entry.block)) {
+            if (pwrite(this->spill_fd, entry.data, entry.size, entry.block * this->block_size) == entry.size) {
+                this->spilled[entry.block] = entry.size;
+            }
+        }
+    }
+
+    entry.used = true;
+    entry.block = block;
+    entry.size = size;
+    entry.last_used = ++this->clock;
+    this->lookup[block] = victim;
+    return entry.data;
+}
+
+bool BlockCache::contains(int64_t block) {
+    return this->lookup.count(block) || this->spilled.count(block);
+}
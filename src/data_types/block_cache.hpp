@@ -0,0 +1,41 @@
+#ifndef block_cache_hpp
+#define block_cache_hpp
+
+#include <stdint.h>
+#include <unordered_map>
+
+// Fixed size blocks of a remote file, kept in memory with LRU eviction.
+// With a spill file, evicted blocks are written to disk instead of being
+// dropped, and read back from there when they are needed again.
+struct BlockCache {
+    struct Entry {
+        bool used;
+        int64_t block;
+        int size;
+        unsigned long last_used;
+        uint8_t* data;
+    };
+
+    int block_size;
+    int capacity;
+    unsigned long clock;
+    Entry* entries;
+    std::unordered_map<int64_t, int> lookup;  // block -> entry
+    int spill_fd;                             // -1 without a spill file
+    std::unordered_map<int64_t, int> spilled; // block -> size in the spill file
+
+    // Constructor, destructor
+    static void init(BlockCache* cache, int block_size, int capacity, const char* spill_dir);
+    static void destroy(BlockCache* cache);
+
+    // Returns the block's data and size, or NULL if it isn't cached
+    const uint8_t* find(int64_t block, int* size);
+
+    // Returns a buffer to write the block into, evicting the least recently
+    // used entry if the cache is full
+    uint8_t* insert(int64_t block, int size);
+
+    bool contains(int64_t block);
+};
+
+#endif
@@ -0,0 +1,156 @@
+#include "frame_cache.hpp"
+
+static void init_entry(FrameCache::Entry* entry) {
+    entry->used = false;
+    entry->owner = 0;
+    entry->pts = 0;
+    entry->last_used = 0;
+    entry->bytes = 0;
+    entry->frame = av_frame_alloc();
+}
+
+// Constructor, destructor
+void FrameCache::init(FrameCache* cache, long budget, int capacity) {
+    cache->budget = budget;
+    cache->bytes = 0;
+    cache->capacity = capacity;
+    cache->clock = 0;
+    cache->entries = new Entry[capacity];
+    for (int i = 0; i < capacity; ++i) {
+        init_entry(&cache->entries[i]);
+    }
+}
+
+void FrameCache::destroy(FrameCache* cache) {
+    for (int i = 0; i < cache->capacity; ++i) {
+        av_frame_free(&cache->entries[i].frame);
+    }
+    delete[] cache->entries;
+    cache->entries = NULL;
+    cache->capacity = 0;
+    cache->bytes = 0;
+}
+
+void FrameCache::reserve(int capacity) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (capacity <= this->capacity) {
+        return;
+    }
+
+    // The AVFrames move along, so the references they hold stay put
+    auto entries = new Entry[capacity];
+    for (int i = 0; i < this->capacity; ++i) {
+        entries[i] = this->entries[i];
+    }
+    for (int i = this->capacity; i < capacity; ++i) {
+        init_entry(&entries[i]);
+    }
+    delete[] this->entries;
+    this->entries = entries;
+    this->capacity = capacity;
+}
+
+static FrameCache::Entry* find_entry(FrameCache* cache, int owner, int pts) {
+    for (int i = 0; i < cache->capacity; ++i) {
+        auto& entry = cache->entries[i];
+        if (entry.used && entry.pts == pts && entry.owner == owner) {
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+bool FrameCache::contains(int owner, int pts) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return find_entry(this, owner, pts) != NULL;
+}
+
+bool FrameCache::find(int owner, int pts, AVFrame* frame) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    auto entry = find_entry(this, owner, pts);
+    if (!entry) {
+        return false;
+    }
+    entry->last_used = ++this->clock;
+    av_frame_unref(frame);
+    return av_frame_ref(frame, entry->frame) == 0;
+}
+
+static void evict(FrameCache* cache, FrameCache::Entry* entry) {
+    av_frame_unref(entry->frame);
+    cache->bytes -= entry->bytes;
+    entry->used = false;
+}
+
+bool FrameCache::insert(int owner, int pts, const AVFrame* frame) {
+    long frame_bytes = FrameCache::frame_bytes(frame);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (find_entry(this, owner, pts)) {
+        return true;
+    }
+
+    // Make room, least recently used first
+    while (true) {
+        Entry* free_entry = NULL;
+        Entry* oldest = NULL;
+        for (int i = 0; i < this->capacity; ++i) {
+            auto& entry = this->entries[i];
+            if (!entry.used) {
+                free_entry = free_entry ? free_entry : &entry;
+            } else if (!oldest || entry.last_used < oldest->last_used) {
+                oldest = &entry;
+            }
+        }
+        if (free_entry && this->bytes + frame_bytes <= this->budget) {
+            if (av_frame_ref(free_entry->frame, frame) < 0) {
+                return false;
+            }
+            // Exported motion vectors and QP are kept compactly by the
+            // overlay (see side_data_overlay.hpp), not with every frame
+            av_frame_remove_side_data(free_entry->frame, AV_FRAME_DATA_MOTION_VECTORS);
+            av_frame_remove_side_data(free_entry->frame, AV_FRAME_DATA_VIDEO_ENC_PARAMS);
+            free_entry->used = true;
+            free_entry->owner = owner;
+            free_entry->pts = pts;
+            free_entry->last_used = ++this->clock;
+            free_entry->bytes = frame_bytes;
+            this->bytes += frame_bytes;
+            return true;
+        }
+        if (!oldest) {
+            return false;
+        }
+        evict(this, oldest);
+    }
+}
+
+void FrameCache::clear(int owner) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    for (int i = 0; i < this->capacity; ++i) {
+        auto& entry = this->entries[i];
+        if (entry.used && entry.owner == owner) {
+            evict(this, &entry);
+        }
+    }
+}
+
+double FrameCache::frames_per_gb() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    int count = 0;
+    for (int i = 0; i < this->capacity; ++i) {
+        count += this->entries[i].used;
+    }
+    if (count == 0 || this->bytes == 0) {
+        return 0.0;
+    }
+    return (1024.0 * 1024.0 * 1024.0) * count / this->bytes;
+}
+
+long FrameCache::frame_bytes(const AVFrame* frame) {
+    long bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; ++i) {
+        bytes += frame->buf[i]->size;
+    }
+    return bytes;
+}
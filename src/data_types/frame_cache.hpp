@@ -0,0 +1,60 @@
+#ifndef frame_cache_hpp
+#define frame_cache_hpp
+
+#include <mutex>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Decoded frames by owner and pts, in their native pixel format. Entries
+// reference the decoder's buffers rather than copying them; evicting an
+// entry drops the reference, which returns the buffers to the decoder's
+// buffer pool. The AVFrames of the entries are allocated once and reused.
+// One cache is shared by every open file, so the budget is a total; the
+// owner tells their frames apart. Safe to use from any thread.
+struct FrameCache {
+    struct Entry {
+        bool used;
+        int owner;
+        int pts;
+        unsigned long last_used;
+        long bytes;
+        AVFrame* frame;
+    };
+
+    std::mutex mutex;
+    long budget; // bytes
+    long bytes;
+    int capacity;
+    unsigned long clock;
+    Entry* entries;
+
+    // Constructor, destructor
+    static void init(FrameCache* cache, long budget, int capacity);
+    static void destroy(FrameCache* cache);
+
+    // Grows the number of entries, e.g. for a file with smaller frames
+    void reserve(int capacity);
+
+    bool contains(int owner, int pts);
+
+    // References the cached frame for the pts into frame, returns false if
+    // it isn't cached. The reference stays valid after the entry is evicted.
+    bool find(int owner, int pts, AVFrame* frame);
+
+    // Adds a reference to the frame, evicting least recently used entries
+    // of any owner until it fits in the budget
+    bool insert(int owner, int pts, const AVFrame* frame);
+
+    // Drops the frames of one owner
+    void clear(int owner);
+
+    // Number of frames the size of the ones cached that would fit in 1GB
+    double frames_per_gb();
+
+    // Memory held by a frame's buffers
+    static long frame_bytes(const AVFrame* frame);
+};
+
+#endif
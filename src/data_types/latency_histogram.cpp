@@ -0,0 +1,41 @@
+#include "latency_histogram.hpp"
+#include <cmath>
+
+void LatencyHistogram::clear() {
+    for (int i = 0; i < NUM_BUCKETS; ++i) {
+        this->counts[i] = 0;
+    }
+    this->total = 0;
+    this->max_ms = 0.0;
+}
+
+void LatencyHistogram::add(double ms) {
+    int bucket = 0;
+    while (bucket < NUM_BUCKETS - 1 && ms >= bucket_upper_bound(bucket)) {
+        ++bucket;
+    }
+    ++this->counts[bucket];
+    ++this->total;
+    if (this->max_ms < ms) {
+        this->max_ms = ms;
+    }
+}
+
+double LatencyHistogram::percentile(double p) {
+    if (this->total == 0) {
+        return 0.0;
+    }
+    int threshold = (int)ceil(this->total * p / 100.0);
+    int count = 0;
+    for (int i = 0; i < NUM_BUCKETS - 1; ++i) {
+        count += this->counts[i];
+        if (count >= threshold) {
+            return bucket_upper_bound(i);
+        }
+    }
+    return this->max_ms;
+}
+
+double LatencyHistogram::bucket_upper_bound(int bucket) {
+    return exp2(bucket);
+}
@@ -0,0 +1,21 @@
+#ifndef latency_histogram_hpp
+#define latency_histogram_hpp
+
+struct LatencyHistogram {
+    // Bucket i counts latencies below 2^i ms, the last bucket everything above
+    static constexpr int NUM_BUCKETS = 12;
+
+    int counts[NUM_BUCKETS];
+    int total;
+    double max_ms;
+
+    void clear();
+    void add(double ms);
+
+    // Upper bound of the bucket containing the given percentile (0..100)
+    double percentile(double p);
+
+    static double bucket_upper_bound(int bucket);
+};
+
+#endif
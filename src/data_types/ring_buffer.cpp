@@ -1,5 +1,6 @@
 #include "ring_buffer.hpp"
 #include <cmath>
+#include <algorithm>
 #include <assert.h>
 #include <time.h>
 
@@ -9,6 +10,7 @@ constexpr double SAMPLE_RATE_GUESS = 44100.0;
 void RingBuffer::init(RingBuffer* rb, int buffer_size) {
     rb->buffer_size = (int)exp2(ceil(log2(buffer_size)));
     rb->buffer = new float[rb->buffer_size];
+    rb->limit = rb->buffer_size;
     rb->write_point = 0;
     rb->read_point = 0;
 }
@@ -17,13 +19,25 @@ void RingBuffer::destroy(RingBuffer* rb) {
     delete[] rb->buffer;
 }
 
+void RingBuffer::set_limit(int num_samples) {
+    if (num_samples > this->buffer_size) {
+        num_samples = this->buffer_size;
+    }
+    this->limit = num_samples;
+}
+
+void RingBuffer::clear() {
+    this->read_point = this->write_point.load();
+}
+
 // Write functions
 bool RingBuffer::can_write(int num_samples) {
     assert(num_samples <= this->buffer_size);
 
     int write_point = this->write_point.load();
     int read_point  = this->read_point.load();
-    return (read_point + this->buffer_size - write_point >= num_samples);
+    int limit = std::max(this->limit.load(), num_samples);
+    return (read_point + limit - write_point >= num_samples);
 }
 
 void RingBuffer::write_start(int num_samples, int* size_1, float** buffer_1, int* size_2, float** buffer_2) {
@@ -35,7 +49,8 @@ void RingBuffer::write_start(int num_samples, int* size_1, float** buffer_1, int
     int read_point;
     while (true) {
         read_point = this->read_point.load();
-        auto available = (read_point + this->buffer_size) - write_point;
+        int limit = std::max(this->limit.load(), num_samples);
+        auto available = (read_point + limit) - write_point;
         if (available >= num_samples) {
             break;
         }
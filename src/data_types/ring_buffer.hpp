@@ -6,6 +6,7 @@
 struct RingBuffer {
     float* buffer;
     int buffer_size;
+    std::atomic_int limit; // how far the writer may run ahead, at most buffer_size
     std::atomic_int write_point;
     std::atomic_int read_point;
 
@@ -13,6 +14,12 @@ struct RingBuffer {
     static void init(RingBuffer* rb, int buffer_size);
     static void destroy(RingBuffer* rb);
 
+    // Bounds the fill level (and so the latency) without reallocating
+    void set_limit(int num_samples);
+
+    // Drops whatever was written but not read yet; only while nothing reads
+    void clear();
+
     // Write functions
     bool can_write(int num_samples);
     void write_start(int num_samples, int* size_1, float** buffer_1, int* size_2, float** buffer_2);
@@ -0,0 +1,29 @@
+#include "decode_cost.hpp"
+#include "parallel_decode.hpp"
+
+bool decode_cost_measure(const char* filename,
+                         PacketIndex* index,
+                         ThreadPool* pool,
+                         const std::atomic_bool* cancel,
+                         std::atomic_int* packets_done,
+                         std::vector<std::pair<int, float>>* costs) {
+    // A few ranges per thread evens out ranges of different cost
+    std::vector<DecodeRange> ranges;
+    {
+        std::lock_guard<std::mutex> lock(index->mutex);
+        ranges = parallel_decode_split(index, pool->num_threads() * 4);
+    }
+
+    // Decoders are single threaded here (the default), so that each time
+    // is the cost of that packet alone
+    RangeResults<std::pair<int, float>> results(ranges.size());
+    bool success = parallel_decode_video(filename, ranges, pool, cancel, nullptr, [&](int range, int packet_pts, int64_t decode_ns) {
+        results.ranges[range].push_back({ packet_pts, decode_ns / 1000000.0f });
+        if (packets_done) {
+            ++*packets_done;
+        }
+    });
+
+    *costs = results.merge();
+    return success;
+}
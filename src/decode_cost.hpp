@@ -0,0 +1,21 @@
+#ifndef decode_cost_hpp
+#define decode_cost_hpp
+
+#include <atomic>
+#include <utility>
+#include <vector>
+#include "packet_index.hpp"
+#include "thread_pool.hpp"
+
+// Opt-in analysis that times the decoding of every video packet, to find
+// the ones that are expensive to decode. Runs one reader per GOP range on
+// the pool. Returns (pts, milliseconds) per packet in presentation order;
+// packets_done counts up as it goes, for progress.
+bool decode_cost_measure(const char* filename,
+                         PacketIndex* index,
+                         ThreadPool* pool,
+                         const std::atomic_bool* cancel,
+                         std::atomic_int* packets_done,
+                         std::vector<std::pair<int, float>>* costs);
+
+#endif
@@ -0,0 +1,372 @@
+#include "frame_export.hpp"
+#include "profiler.hpp"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+static bool cancelled(void* opaque) {
+    return ((const std::atomic_bool*)opaque)->load();
+}
+
+// The file's path without its extension, plus the pts range. Files read
+// over HTTP are exported to the working directory.
+static std::string output_base(const char* filename, const PacketInfo& first, const PacketInfo& last, std::string* extension) {
+    std::string base = filename;
+    if (base.find("://") != std::string::npos) {
+        base = base.substr(base.find_last_of('/') + 1);
+    }
+    auto dot = base.find_last_of('.');
+    auto slash = base.find_last_of('/');
+    *extension = "";
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+        *extension = base.substr(dot);
+        base = base.substr(0, dot);
+    }
+    char range[64];
+    snprintf(range, sizeof(range), "_%d-%d", first.pts, last.pts);
+    return base + range;
+}
+
+static bool write_png(const AVFrame* frame, const std::string& path) {
+    PROFILE_SCOPE("export_png");
+
+    auto codec = avcodec_find_encoder(AV_CODEC_ID_PNG);
+    if (!codec) {
+        return false;
+    }
+
+    AVFrame* rgb = av_frame_alloc();
+    rgb->format = AV_PIX_FMT_RGB24;
+    rgb->width = frame->width;
+    rgb->height = frame->height;
+    if (av_frame_get_buffer(rgb, 0) < 0) {
+        av_frame_free(&rgb);
+        return false;
+    }
+    auto sws_ctx = sws_getContext(frame->width, frame->height, (AVPixelFormat)frame->format,
+                                  rgb->width, rgb->height, AV_PIX_FMT_RGB24,
+                                  SWS_BILINEAR, NULL, NULL, NULL);
+    if (!sws_ctx) {
+        av_frame_free(&rgb);
+        return false;
+    }
+    sws_scale(sws_ctx, frame->data, frame->linesize, 0, frame->height, rgb->data, rgb->linesize);
+    sws_freeContext(sws_ctx);
+
+    bool success = false;
+    AVCodecContext* ctx = avcodec_alloc_context3(codec);
+    AVPacket* packet = av_packet_alloc();
+    ctx->width = rgb->width;
+    ctx->height = rgb->height;
+    ctx->pix_fmt = AV_PIX_FMT_RGB24;
+    ctx->time_base = { 1, 25 };
+    if (avcodec_open2(ctx, codec, NULL) == 0 &&
+        avcodec_send_frame(ctx, rgb) == 0 &&
+        avcodec_receive_packet(ctx, packet) == 0) {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file) {
+            success = fwrite(packet->data, 1, packet->size, file) == (size_t)packet->size;
+            fclose(file);
+        }
+    }
+    av_packet_free(&packet);
+    avcodec_free_context(&ctx);
+    av_frame_free(&rgb);
+    return success;
+}
+
+// Frames are written to their own offset, so workers can finish in any order
+static bool write_raw(const AVFrame* frame, int fd, int frame_number, int frame_size) {
+    PROFILE_SCOPE("export_raw");
+
+    std::vector<uint8_t> buffer(frame_size);
+    if (av_image_copy_to_buffer(buffer.data(), frame_size, frame->data, frame->linesize,
+                                (AVPixelFormat)frame->format, frame->width, frame->height, 1) < 0) {
+        return false;
+    }
+    return pwrite(fd, buffer.data(), frame_size, (off_t)frame_number * frame_size) == frame_size;
+}
+
+static bool export_frames(const char* filename,
+                          PacketIndex* index,
+                          const PacketInfo& first,
+                          const PacketInfo& last,
+                          ExportFormat format,
+                          ThreadPool* pool,
+                          const std::atomic_bool* cancel,
+                          std::atomic_int* frames_done,
+                          std::string* output_path) {
+    VideoReaderState state;
+    if (!video_reader_open(&state, filename)) {
+        return false;
+    }
+    video_reader_select_streams(&state, true, false);
+    if (cancel) {
+        state.should_cancel = cancelled;
+        state.should_cancel_opaque = (void*)cancel;
+    }
+    packet_index_seek(index, &state, first);
+
+    std::string extension;
+    std::string base = output_base(filename, first, last, &extension);
+    if (format == EXPORT_PNG) {
+        *output_path = base + "_png";
+        mkdir(output_path->c_str(), 0755);
+    }
+
+    // Raw output takes its size and format from the first frame
+    int fd = -1;
+    int frame_size = 0;
+    int raw_width = 0, raw_height = 0, raw_format = -1;
+
+    // Enough frames in flight to keep the pool busy, few enough to bound the
+    // decoder buffers they hold on to
+    int max_in_flight = pool->num_threads() * 2;
+    TaskGroup group;
+    std::atomic_bool failed(false);
+    int frame_number = 0;
+    bool success = true;
+
+    int res, packet_pts, pts;
+    while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+        if (res == RECEIVED_CANCELLED || failed) {
+            success = false;
+            break;
+        }
+        if (res != RECEIVED_VIDEO || pts < first.pts) {
+            continue;
+        }
+        if (pts > last.pts) {
+            break;
+        }
+
+        auto frame = state.video_frame;
+        if (format == EXPORT_RAW_YUV) {
+            if (fd == -1) {
+                raw_width = frame->width;
+                raw_height = frame->height;
+                raw_format = frame->format;
+                frame_size = av_image_get_buffer_size((AVPixelFormat)raw_format, raw_width, raw_height, 1);
+                auto format_name = av_get_pix_fmt_name((AVPixelFormat)raw_format);
+                char suffix[64];
+                snprintf(suffix, sizeof(suffix), "_%dx%d_%s.yuv", raw_width, raw_height, format_name ? format_name : "raw");
+                *output_path = base + suffix;
+                fd = open(output_path->c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd == -1 || frame_size <= 0) {
+                    printf("Couldn't create %s\n", output_path->c_str());
+                    success = false;
+                    break;
+                }
+            }
+            if (frame->width != raw_width || frame->height != raw_height || frame->format != raw_format) {
+                printf("Frame size or format changes at pts %d, raw export stops there\n", pts);
+                success = false;
+                break;
+            }
+        }
+
+        // The clone references the decoder's buffers, no pixels are copied
+        AVFrame* clone = av_frame_clone(frame);
+        if (!clone) {
+            success = false;
+            break;
+        }
+        group.wait_below(max_in_flight - 1);
+        int number = frame_number++;
+        if (format == EXPORT_PNG) {
+            char name[32];
+            snprintf(name, sizeof(name), "/%06d.png", number);
+            std::string path = *output_path + name;
+            group.submit(pool, [clone, path, frames_done, &failed]() mutable {
+                if (!write_png(clone, path)) {
+                    failed = true;
+                }
+                av_frame_free(&clone);
+                if (frames_done) {
+                    ++*frames_done;
+                }
+            });
+        } else {
+            group.submit(pool, [clone, fd, number, frame_size, frames_done, &failed]() mutable {
+                if (!write_raw(clone, fd, number, frame_size)) {
+                    failed = true;
+                }
+                av_frame_free(&clone);
+                if (frames_done) {
+                    ++*frames_done;
+                }
+            });
+        }
+    }
+
+    group.wait();
+    if (fd != -1) {
+        close(fd);
+    }
+    video_reader_close(&state);
+    if (failed) {
+        printf("Failed to write frames to %s\n", output_path->c_str());
+    }
+    return success && !failed;
+}
+
+// Copies the packets from the keyframe before first through last, with the
+// audio over the same time, starting the copy's timestamps at 0
+static bool copy_packets(const char* filename,
+                         PacketIndex* index,
+                         const PacketInfo& first,
+                         const PacketInfo& last,
+                         const std::atomic_bool* cancel,
+                         std::atomic_int* frames_done,
+                         std::string* output_path) {
+    PROFILE_SCOPE("export_copy");
+
+    VideoReaderState state;
+    if (!video_reader_open(&state, filename)) {
+        return false;
+    }
+    video_reader_select_streams(&state, true, true);
+    if (cancel) {
+        state.should_cancel = cancelled;
+        state.should_cancel_opaque = (void*)cancel;
+    }
+
+    std::string extension;
+    *output_path = output_base(filename, first, last, &extension) + extension;
+
+    AVFormatContext* out_ctx = NULL;
+    if (avformat_alloc_output_context2(&out_ctx, NULL, NULL, output_path->c_str()) < 0) {
+        printf("Couldn't create an output for %s\n", output_path->c_str());
+        video_reader_close(&state);
+        return false;
+    }
+
+    // Output stream for each input stream we read, by input stream index
+    int input_indices[2] = { state.video_stream_index, state.audio_stream_index };
+    std::vector<AVStream*> out_streams(state.av_format_ctx->nb_streams, NULL);
+    bool success = true;
+    for (int input_index : input_indices) {
+        if (input_index == -1) {
+            continue;
+        }
+        auto in_stream = state.av_format_ctx->streams[input_index];
+        auto out_stream = avformat_new_stream(out_ctx, NULL);
+        if (!out_stream || avcodec_parameters_copy(out_stream->codecpar, in_stream->codecpar) < 0) {
+            success = false;
+            break;
+        }
+        out_stream->codecpar->codec_tag = 0;
+        out_stream->time_base = in_stream->time_base;
+        out_streams[input_index] = out_stream;
+    }
+    if (success && !(out_ctx->oformat->flags & AVFMT_NOFILE)) {
+        success = avio_open(&out_ctx->pb, output_path->c_str(), AVIO_FLAG_WRITE) >= 0;
+    }
+    if (success) {
+        success = avformat_write_header(out_ctx, NULL) >= 0;
+    }
+    if (!success) {
+        printf("Couldn't write %s\n", output_path->c_str());
+        if (out_ctx->pb) {
+            avio_closep(&out_ctx->pb);
+        }
+        avformat_free_context(out_ctx);
+        video_reader_close(&state);
+        return false;
+    }
+
+    packet_index_seek(index, &state, first);
+
+    // Everything is shifted by the keyframe's time, the audio from before it
+    // is left out and the copy ends with the last frame
+    const AVRational seconds = { 1, AV_TIME_BASE };
+    int64_t start_time = AV_NOPTS_VALUE;
+    int64_t end_time = av_rescale_q(last.pts, state.video_time_base, seconds) + (int64_t)(last.duration * AV_TIME_BASE);
+    bool video_done = false;
+    bool audio_done = state.audio_stream_index == -1;
+
+    AVPacket* packet = av_packet_alloc();
+    while (!(video_done && audio_done) && video_reader_next_packet(&state, packet)) {
+        bool is_video = packet->stream_index == state.video_stream_index;
+        auto in_tb = state.av_format_ctx->streams[packet->stream_index]->time_base;
+        int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+        int64_t time = ts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : av_rescale_q(ts, in_tb, seconds);
+
+        bool keep = false;
+        if (is_video && !video_done) {
+            if (start_time == AV_NOPTS_VALUE && (packet->flags & AV_PKT_FLAG_KEY)) {
+                start_time = time;
+            }
+            // Nothing decoding after last has a pts at or before it
+            if (packet->dts != AV_NOPTS_VALUE && packet->dts > last.pts) {
+                video_done = true;
+            } else {
+                keep = start_time != AV_NOPTS_VALUE;
+            }
+        } else if (!is_video && !audio_done && start_time != AV_NOPTS_VALUE && time != AV_NOPTS_VALUE) {
+            if (time >= end_time) {
+                audio_done = true;
+            } else {
+                keep = time >= start_time;
+            }
+        }
+
+        if (keep) {
+            auto out_stream = out_streams[packet->stream_index];
+            int64_t offset = av_rescale_q(start_time, seconds, in_tb);
+            if (packet->pts != AV_NOPTS_VALUE) {
+                packet->pts -= offset;
+            }
+            if (packet->dts != AV_NOPTS_VALUE) {
+                packet->dts -= offset;
+            }
+            packet->pos = -1;
+            packet->stream_index = out_stream->index;
+            av_packet_rescale_ts(packet, in_tb, out_stream->time_base);
+            if (av_interleaved_write_frame(out_ctx, packet) < 0) {
+                success = false;
+                break;
+            }
+            if (is_video && frames_done) {
+                ++*frames_done;
+            }
+        }
+        av_packet_unref(packet);
+    }
+    av_packet_free(&packet);
+
+    if (cancel && *cancel) {
+        success = false;
+    }
+    av_write_trailer(out_ctx);
+    if (!(out_ctx->oformat->flags & AVFMT_NOFILE)) {
+        avio_closep(&out_ctx->pb);
+    }
+    avformat_free_context(out_ctx);
+    video_reader_close(&state);
+    return success;
+}
+
+bool frame_export_run(const char* filename,
+                      PacketIndex* index,
+                      const PacketInfo& first,
+                      const PacketInfo& last,
+                      ExportFormat format,
+                      ThreadPool* pool,
+                      const std::atomic_bool* cancel,
+                      std::atomic_int* frames_done,
+                      std::string* output_path) {
+    if (format == EXPORT_STREAM_COPY) {
+        return copy_packets(filename, index, first, last, cancel, frames_done, output_path);
+    }
+    return export_frames(filename, index, first, last, format, pool, cancel, frames_done, output_path);
+}
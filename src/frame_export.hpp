@@ -0,0 +1,30 @@
+#ifndef frame_export_hpp
+#define frame_export_hpp
+
+#include <atomic>
+#include <string>
+#include "packet_index.hpp"
+#include "thread_pool.hpp"
+
+enum ExportFormat {
+    EXPORT_PNG,         // one RGB image per frame, in a directory
+    EXPORT_RAW_YUV,     // every frame in its decoded pixel format, back to back
+    EXPORT_STREAM_COPY, // the packets as they are, in a new file of the same container
+};
+
+// Exports the video frames with pts from first.pts to last.pts, with the
+// audio alongside when stream copying. Frames are decoded in order on the
+// calling thread while conversion, encoding and writing are spread over the
+// pool. Output goes next to the file; its path is returned through
+// output_path. frames_done counts up as it goes, for progress.
+bool frame_export_run(const char* filename,
+                      PacketIndex* index,
+                      const PacketInfo& first,
+                      const PacketInfo& last,
+                      ExportFormat format,
+                      ThreadPool* pool,
+                      const std::atomic_bool* cancel,
+                      std::atomic_int* frames_done,
+                      std::string* output_path);
+
+#endif
@@ -0,0 +1,311 @@
+#include "frame_hash.hpp"
+#include "parallel_decode.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+}
+
+constexpr uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little endian reads, which is every platform we build for
+static inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t value) {
+    acc ^= hash_round(0, value);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+void Hash64::init(Hash64* hash, uint64_t seed) {
+    hash->acc[0] = seed + PRIME64_1 + PRIME64_2;
+    hash->acc[1] = seed + PRIME64_2;
+    hash->acc[2] = seed;
+    hash->acc[3] = seed - PRIME64_1;
+    hash->buffered = 0;
+    hash->total_size = 0;
+    hash->seed = seed;
+}
+
+void Hash64::update(const void* data, size_t size) {
+    auto p = (const uint8_t*)data;
+    auto end = p + size;
+    total_size += size;
+
+    // Top up a partial stripe first
+    if (buffered > 0) {
+        size_t fill = std::min(size, (size_t)(32 - buffered));
+        memcpy(buffer + buffered, p, fill);
+        buffered += fill;
+        p += fill;
+        if (buffered < 32) {
+            return;
+        }
+        acc[0] = hash_round(acc[0], read64(buffer));
+        acc[1] = hash_round(acc[1], read64(buffer + 8));
+        acc[2] = hash_round(acc[2], read64(buffer + 16));
+        acc[3] = hash_round(acc[3], read64(buffer + 24));
+        buffered = 0;
+    }
+
+    // The four lanes are independent, so they run side by side in the pipeline
+    uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+    while (end - p >= 32) {
+        v1 = hash_round(v1, read64(p));
+        v2 = hash_round(v2, read64(p + 8));
+        v3 = hash_round(v3, read64(p + 16));
+        v4 = hash_round(v4, read64(p + 24));
+        p += 32;
+    }
+    acc[0] = v1; acc[1] = v2; acc[2] = v3; acc[3] = v4;
+
+    if (p < end) {
+        memcpy(buffer, p, end - p);
+        buffered = end - p;
+    }
+}
+
+uint64_t Hash64::digest() const {
+    uint64_t h;
+    if (total_size >= 32) {
+        h = rotl(acc[0], 1) + rotl(acc[1], 7) + rotl(acc[2], 12) + rotl(acc[3], 18);
+        h = merge_round(h, acc[0]);
+        h = merge_round(h, acc[1]);
+        h = merge_round(h, acc[2]);
+        h = merge_round(h, acc[3]);
+    } else {
+        h = seed + PRIME64_5;
+    }
+    h += total_size;
+
+    auto p = buffer;
+    auto end = buffer + buffered;
+    for (; end - p >= 8; p += 8) {
+        h ^= hash_round(0, read64(p));
+        h = rotl(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= *p * PRIME64_5;
+        h = rotl(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed) {
+    Hash64 hash;
+    Hash64::init(&hash, seed);
+    hash.update(data, size);
+    return hash.digest();
+}
+
+uint64_t FrameHash::combined() const {
+    return hash64(planes, num_planes * sizeof(uint64_t), 0);
+}
+
+FrameHash frame_hash_video(const AVFrame* frame) {
+    PROFILE_SCOPE("frame_hash_video");
+
+    FrameHash hash;
+    memset(&hash, 0, sizeof(hash));
+    hash.pts = frame->pts;
+
+    auto format = (AVPixelFormat)frame->format;
+    auto desc = av_pix_fmt_desc_get(format);
+    if (!desc) {
+        return hash;
+    }
+    hash.num_planes = std::min(av_pix_fmt_count_planes(format), 4);
+
+    for (int p = 0; p < hash.num_planes; ++p) {
+        // Only the visible bytes of each row, not the padding up to linesize
+        int row_size = av_image_get_linesize(format, frame->width, p);
+        int rows = (p == 1 || p == 2) ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+
+        Hash64 plane;
+        Hash64::init(&plane, 0);
+        if (frame->linesize[p] == row_size) {
+            plane.update(frame->data[p], (size_t)row_size * rows);
+        } else {
+            for (int y = 0; y < rows; ++y) {
+                plane.update(frame->data[p] + (ptrdiff_t)y * frame->linesize[p], row_size);
+            }
+        }
+        hash.planes[p] = plane.digest();
+    }
+
+    return hash;
+}
+
+FrameHash frame_hash_audio(const AVFrame* frame) {
+    PROFILE_SCOPE("frame_hash_audio");
+
+    FrameHash hash;
+    memset(&hash, 0, sizeof(hash));
+    hash.pts = frame->pts;
+    hash.num_planes = 1;
+
+    auto format = (AVSampleFormat)frame->format;
+    bool planar = av_sample_fmt_is_planar(format);
+    int num_planes = planar ? frame->channels : 1;
+    size_t plane_size = (size_t)frame->nb_samples * av_get_bytes_per_sample(format) * (planar ? 1 : frame->channels);
+
+    Hash64 samples;
+    Hash64::init(&samples, 0);
+    for (int p = 0; p < num_planes; ++p) {
+        samples.update(frame->extended_data[p], plane_size);
+    }
+    hash.planes[0] = samples.digest();
+
+    return hash;
+}
+
+static bool cancelled(void* opaque) {
+    return ((const std::atomic_bool*)opaque)->load();
+}
+
+// Audio frames are cheap to decode and the decoders carry state from one
+// frame to the next, so audio is hashed by one reader from the start
+static bool hash_audio(const char* filename, const std::atomic_bool* cancel, std::vector<FrameHash>* hashes) {
+    VideoReaderState state;
+    if (!video_reader_open(&state, filename)) {
+        return false;
+    }
+    video_reader_select_streams(&state, false, true);
+    if (cancel) {
+        state.should_cancel = cancelled;
+        state.should_cancel_opaque = (void*)cancel;
+    }
+
+    bool success = true;
+    int res, packet_pts, pts;
+    while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+        if (res == RECEIVED_CANCELLED) {
+            success = false;
+            break;
+        }
+        if (res > 0) {
+            hashes->push_back(frame_hash_audio(state.audio_frame));
+            hashes->back().pts = pts;
+        }
+    }
+
+    video_reader_close(&state);
+    return success;
+}
+
+bool frame_hash_file(const char* filename,
+                     PacketIndex* index,
+                     ThreadPool* pool,
+                     const std::atomic_bool* cancel,
+                     FileHashes* hashes) {
+    std::vector<DecodeRange> ranges;
+    bool has_video, has_audio;
+    {
+        std::lock_guard<std::mutex> lock(index->mutex);
+        ranges = parallel_decode_split(index, pool->num_threads() * 4);
+        has_video = !index->video_packets.empty();
+        has_audio = !index->audio_packets.empty();
+    }
+
+    std::vector<FrameHash> audio;
+    bool audio_success = true;
+    TaskGroup group;
+    if (has_audio) {
+        group.submit(pool, [&]() {
+            audio_success = hash_audio(filename, cancel, &audio);
+        });
+    }
+
+    RangeResults<FrameHash> video(ranges.size());
+    bool video_success = true;
+    if (has_video) {
+        video_success = parallel_decode_video(filename, ranges, pool, cancel, [&](int range, VideoReaderState* state, int pts) {
+            video.ranges[range].push_back(frame_hash_video(state->video_frame));
+            video.ranges[range].back().pts = pts;
+        }, nullptr);
+    }
+    group.wait();
+
+    hashes->video = video.merge();
+    hashes->audio = std::move(audio);
+    return video_success && audio_success;
+}
+
+static void diff_frames(bool is_video,
+                        const std::vector<FrameHash>& a,
+                        const std::vector<FrameHash>& b,
+                        std::vector<FrameHashMismatch>* mismatches) {
+    size_t num_frames = std::max(a.size(), b.size());
+    for (size_t i = 0; i < num_frames; ++i) {
+        auto frame_a = i < a.size() ? &a[i] : NULL;
+        auto frame_b = i < b.size() ? &b[i] : NULL;
+
+        int planes = 0;
+        if (frame_a && frame_b && frame_a->num_planes == frame_b->num_planes) {
+            for (int p = 0; p < frame_a->num_planes; ++p) {
+                if (frame_a->planes[p] != frame_b->planes[p]) {
+                    planes |= 1 << p;
+                }
+            }
+        } else {
+            int num_planes = std::max(frame_a ? frame_a->num_planes : 0, frame_b ? frame_b->num_planes : 0);
+            planes = (1 << num_planes) - 1;
+        }
+
+        if (planes) {
+            mismatches->push_back({
+                is_video,
+                (int)i,
+                frame_a ? frame_a->pts : INT_MIN,
+                frame_b ? frame_b->pts : INT_MIN,
+                planes
+            });
+        }
+    }
+}
+
+std::vector<FrameHashMismatch> frame_hash_diff(const FileHashes& a, const FileHashes& b) {
+    std::vector<FrameHashMismatch> mismatches;
+    diff_frames(true,  a.video, b.video, &mismatches);
+    diff_frames(false, a.audio, b.audio, &mismatches);
+    return mismatches;
+}
@@ -0,0 +1,70 @@
+#ifndef frame_hash_hpp
+#define frame_hash_hpp
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "packet_index.hpp"
+#include "thread_pool.hpp"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// XXH64, streamed so that the rows of a plane can be hashed without the
+// padding at the end of each row
+struct Hash64 {
+    uint64_t acc[4];
+    uint8_t buffer[32];
+    int buffered;
+    uint64_t total_size;
+    uint64_t seed;
+
+    static void init(Hash64* hash, uint64_t seed);
+    void update(const void* data, size_t size);
+    uint64_t digest() const;
+};
+
+uint64_t hash64(const void* data, size_t size, uint64_t seed);
+
+// Content of one decoded frame: a hash per video plane, or one hash over
+// the samples of every audio channel
+struct FrameHash {
+    int pts;
+    int num_planes;
+    uint64_t planes[4];
+
+    uint64_t combined() const;
+};
+
+FrameHash frame_hash_video(const AVFrame* frame);
+FrameHash frame_hash_audio(const AVFrame* frame);
+
+struct FileHashes {
+    std::vector<FrameHash> video; // presentation order
+    std::vector<FrameHash> audio;
+};
+
+// Hashes every decoded frame of the file: video over GOP ranges in
+// parallel, audio alongside as one more task on the pool
+bool frame_hash_file(const char* filename,
+                     PacketIndex* index,
+                     ThreadPool* pool,
+                     const std::atomic_bool* cancel,
+                     FileHashes* hashes);
+
+// Frame that differs between two files, compared by position in
+// presentation order so that a shifted timebase doesn't matter. A frame
+// missing from one file has a pts of INT_MIN there.
+struct FrameHashMismatch {
+    bool is_video;
+    int frame;
+    int pts_a;
+    int pts_b;
+    int planes; // bit per plane that differs
+};
+
+std::vector<FrameHashMismatch> frame_hash_diff(const FileHashes& a, const FileHashes& b);
+
+#endif
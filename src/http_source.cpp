@@ -0,0 +1,533 @@
+#include "http_source.hpp"
+#include "data_types/block_cache.hpp"
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+constexpr int HTTP_TIMEOUT_SECONDS = 30;
+
+struct HttpSource {
+    std::string host;
+    std::string port;
+    std::string path;
+    HttpSourceOptions options;
+    std::atomic<int64_t> size;
+
+    // Blocks are either cached, being fetched (in_flight) or missing.
+    // Readers that need a block in flight wait on cv for it to arrive.
+    std::mutex mutex;
+    std::condition_variable cv;
+    BlockCache cache;
+    std::unordered_set<int64_t> in_flight;
+
+    // Keep-alive connections not used by a request right now
+    std::mutex connections_mutex;
+    std::vector<int> idle_connections;
+
+    ThreadPool prefetch_pool;
+    TaskGroup prefetches;
+
+    std::atomic<int64_t> requests;
+    std::atomic<int64_t> bytes_received;
+    std::atomic<int64_t> block_hits;
+    std::atomic<int64_t> block_misses;
+};
+
+static bool parse_url(const char* url, HttpSource* http) {
+    const char* prefix = "http://";
+    if (strncmp(url, prefix, strlen(prefix)) != 0) {
+        printf("Only http:// URLs are supported: %s\n", url);
+        return false;
+    }
+    std::string rest = url + strlen(prefix);
+    auto slash = rest.find('/');
+    std::string authority = rest.substr(0, slash);
+    http->path = slash == std::string::npos ? "/" : rest.substr(slash);
+
+    auto colon = authority.rfind(':');
+    if (colon != std::string::npos && authority.find(']', colon) == std::string::npos) {
+        http->host = authority.substr(0, colon);
+        http->port = authority.substr(colon + 1);
+    } else {
+        http->host = authority;
+        http->port = "80";
+    }
+    if (http->host.size() > 2 && http->host.front() == '[' && http->host.back() == ']') {
+        http->host = http->host.substr(1, http->host.size() - 2);
+    }
+    return !http->host.empty();
+}
+
+static int http_connect(HttpSource* http) {
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* addresses;
+    if (getaddrinfo(http->host.c_str(), http->port.c_str(), &hints, &addresses) != 0) {
+        printf("Couldn't resolve %s\n", http->host.c_str());
+        return -1;
+    }
+
+    int fd = -1;
+    for (auto address = addresses; address; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addresses);
+
+    if (fd < 0) {
+        printf("Couldn't connect to %s:%s\n", http->host.c_str(), http->port.c_str());
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    timeval timeout = { HTTP_TIMEOUT_SECONDS, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+    return fd;
+}
+
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+static bool send_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, SEND_FLAGS);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool recv_all(int fd, uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= received;
+    }
+    return true;
+}
+
+static int64_t header_int(const std::string& headers, const char* name, int64_t fallback) {
+    // Header names are case-insensitive
+    std::string lower = headers;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    auto at = lower.find(std::string("\r\n") + name + ":");
+    if (at == std::string::npos) {
+        return fallback;
+    }
+    return strtoll(headers.c_str() + at + strlen(name) + 3, NULL, 10);
+}
+
+static bool header_contains(const std::string& headers, const char* text) {
+    std::string lower = headers;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return lower.find(text) != std::string::npos;
+}
+
+// Total size from "Content-Range: bytes 0-99/1234" or "bytes */1234"
+static int64_t content_range_total(const std::string& headers) {
+    std::string lower = headers;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    auto at = lower.find("\r\ncontent-range:");
+    if (at == std::string::npos) {
+        return -1;
+    }
+    auto slash = lower.find('/', at);
+    auto line_end = lower.find("\r\n", at + 2);
+    if (slash == std::string::npos || slash > line_end || lower[slash + 1] == '*') {
+        return -1;
+    }
+    return strtoll(lower.c_str() + slash + 1, NULL, 10);
+}
+
+enum RangeResult {
+    RANGE_OK,
+    RANGE_NOT_SATISFIABLE, // the offset is past the end
+    RANGE_FAILED,
+};
+
+// Issues one "Range: bytes=offset-(offset+length-1)" request on the
+// connection and reads the body into buffer. *received is set to the number
+// of bytes received (less than length at the end of the file), and *total to
+// the file size the server reported, or -1.
+static RangeResult request_range(HttpSource* http, int fd, int64_t offset, int64_t length,
+                                 uint8_t* buffer, int64_t* received, int64_t* total, bool* keep_alive) {
+    char request[1024];
+    int request_size = snprintf(request, sizeof(request),
+                                "GET %s HTTP/1.1\r\n"
+                                "Host: %s\r\n"
+                                "Range: bytes=%lld-%lld\r\n"
+                                "Connection: keep-alive\r\n"
+                                "\r\n",
+                                http->path.c_str(), http->host.c_str(),
+                                (long long)offset, (long long)(offset + length - 1));
+    if (request_size >= (int)sizeof(request) || !send_all(fd, request, request_size)) {
+        return RANGE_FAILED;
+    }
+    ++http->requests;
+
+    // Read up to the end of the headers, keeping whatever body came with them
+    std::string headers = "\r\n";
+    size_t headers_end;
+    char chunk[4096];
+    while ((headers_end = headers.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t bytes = recv(fd, chunk, sizeof(chunk), 0);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0 || headers.size() > 65536) {
+            return RANGE_FAILED;
+        }
+        headers.append(chunk, bytes);
+    }
+    std::string leftover = headers.substr(headers_end + 4);
+    headers.resize(headers_end + 2);
+
+    int status = 0;
+    sscanf(headers.c_str() + 2, "HTTP/%*d.%*d %d", &status);
+    *total = content_range_total(headers);
+    *keep_alive = !header_contains(headers, "\r\nconnection: close");
+    int64_t content_length = header_int(headers, "content-length", -1);
+
+    if (status == 416) {
+        // Some servers send a body with it, which we don't need
+        *keep_alive = *keep_alive && content_length >= 0 && content_length <= (int64_t)leftover.size();
+        return RANGE_NOT_SATISFIABLE;
+    }
+
+    // A server that ignores ranges sends the whole file, which is only of
+    // use to us from the start
+    bool whole_file = (status == 200);
+    if (whole_file) {
+        *total = content_length;
+        *keep_alive = false;
+        if (offset != 0) {
+            printf("Server doesn't support range requests: %s\n", http->host.c_str());
+            return RANGE_FAILED;
+        }
+    } else if (status != 206) {
+        printf("HTTP request failed with status %d\n", status);
+        return RANGE_FAILED;
+    }
+    if (content_length < 0) {
+        return RANGE_FAILED;
+    }
+
+    int64_t body_size = std::min(content_length, length);
+    int64_t from_leftover = std::min<int64_t>(body_size, leftover.size());
+    memcpy(buffer, leftover.data(), from_leftover);
+    if (!recv_all(fd, buffer + from_leftover, body_size - from_leftover)) {
+        return RANGE_FAILED;
+    }
+    if (body_size < content_length) {
+        *keep_alive = false;
+    }
+    http->bytes_received += body_size;
+    *received = body_size;
+    return RANGE_OK;
+}
+
+// Fetches a byte range on an idle keep-alive connection, or a new one if
+// there is none. Idle connections may have been closed by the server in the
+// meantime, so a failure on one is retried once on a fresh connection.
+static RangeResult get_range(HttpSource* http, int64_t offset, int64_t length,
+                             uint8_t* buffer, int64_t* received, int64_t* total) {
+    PROFILE_SCOPE("http_get_range");
+
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int fd = -1;
+        if (attempt == 0) {
+            std::lock_guard<std::mutex> lock(http->connections_mutex);
+            if (!http->idle_connections.empty()) {
+                fd = http->idle_connections.back();
+                http->idle_connections.pop_back();
+            }
+        }
+        bool reused = (fd != -1);
+        if (!reused) {
+            fd = http_connect(http);
+            if (fd < 0) {
+                return RANGE_FAILED;
+            }
+        }
+
+        bool keep_alive = false;
+        auto result = request_range(http, fd, offset, length, buffer, received, total, &keep_alive);
+        if (result != RANGE_FAILED && keep_alive) {
+            std::lock_guard<std::mutex> lock(http->connections_mutex);
+            http->idle_connections.push_back(fd);
+        } else {
+            close(fd);
+        }
+        if (result != RANGE_FAILED || !reused) {
+            return result;
+        }
+    }
+    return RANGE_FAILED;
+}
+
+// Fetches the blocks [first, first + count) in one request. The caller has
+// marked them in flight; they are cached and unmarked whether or not the
+// request succeeds, waking up any reader waiting for them.
+static bool fetch_blocks(HttpSource* http, int64_t first, int count) {
+    int block_size = http->options.block_size;
+    int64_t offset = first * block_size;
+    int64_t length = std::min<int64_t>((int64_t)count * block_size, http->size - offset);
+
+    std::vector<uint8_t> buffer(std::max<int64_t>(length, 0));
+    int64_t received = 0, total;
+    bool success = length > 0 &&
+                   get_range(http, offset, length, buffer.data(), &received, &total) == RANGE_OK;
+
+    std::lock_guard<std::mutex> lock(http->mutex);
+    for (int i = 0; i < count; ++i) {
+        int64_t block = first + i;
+        int64_t block_offset = (int64_t)i * block_size;
+        if (success && block_offset < received) {
+            int size = (int)std::min<int64_t>(block_size, received - block_offset);
+            memcpy(http->cache.insert(block, size), buffer.data() + block_offset, size);
+        }
+        http->in_flight.erase(block);
+    }
+    http->cv.notify_all();
+    return success;
+}
+
+// Starts fetching the blocks after a read in the background, in runs of
+// adjacent missing blocks so that each run takes one request
+static void prefetch_after(HttpSource* http, int64_t block) {
+    int readahead = http->options.readahead_blocks;
+    int max_request_blocks = http->options.max_request_blocks;
+    int64_t num_blocks = (http->size + http->options.block_size - 1) / http->options.block_size;
+    int64_t end = std::min(block + readahead, num_blocks);
+
+    std::vector<std::pair<int64_t, int>> runs;
+    {
+        std::lock_guard<std::mutex> lock(http->mutex);
+        for (int64_t b = block; b < end; ++b) {
+            if (http->cache.contains(b) || http->in_flight.count(b)) {
+                continue;
+            }
+            http->in_flight.insert(b);
+            if (!runs.empty() && runs.back().first + runs.back().second == b && runs.back().second < max_request_blocks) {
+                ++runs.back().second;
+            } else {
+                runs.push_back({ b, 1 });
+            }
+        }
+    }
+
+    for (auto& run : runs) {
+        http->prefetches.submit(&http->prefetch_pool, [http, run]() {
+            fetch_blocks(http, run.first, run.second);
+        });
+    }
+}
+
+static int http_read_at(MediaSource* source, int64_t offset, uint8_t* buffer, int size) {
+    auto http = (HttpSource*)source->opaque;
+    int block_size = http->options.block_size;
+
+    int64_t file_size = http->size;
+    if (offset >= file_size) {
+        return 0;
+    }
+    size = (int)std::min<int64_t>(size, file_size - offset);
+
+    int64_t first = offset / block_size;
+    int64_t last = (offset + size - 1) / block_size;
+    if (http->options.readahead_blocks > 0) {
+        prefetch_after(http, last + 1);
+    }
+
+    int copied = 0;
+    std::unique_lock<std::mutex> lock(http->mutex);
+    for (int64_t block = first; block <= last; ++block) {
+        int block_bytes;
+        const uint8_t* data;
+        bool counted = false;
+        while (!(data = http->cache.find(block, &block_bytes))) {
+            if (!counted) {
+                ++http->block_misses;
+                counted = true;
+            }
+
+            // Somebody else is fetching it already
+            if (http->in_flight.count(block)) {
+                http->cv.wait(lock);
+                continue;
+            }
+
+            // Fetch it along with the missing blocks after it that this read needs
+            int count = 1;
+            while (block + count <= last && count < http->options.max_request_blocks &&
+                   !http->cache.contains(block + count) && !http->in_flight.count(block + count)) {
+                ++count;
+            }
+            for (int i = 0; i < count; ++i) {
+                http->in_flight.insert(block + i);
+            }
+            lock.unlock();
+            bool success = fetch_blocks(http, block, count);
+            lock.lock();
+            if (!success) {
+                return copied > 0 ? copied : -1;
+            }
+        }
+        if (!counted) {
+            ++http->block_hits;
+        }
+
+        int64_t block_start = block * block_size;
+        int from = (int)std::max<int64_t>(0, offset - block_start);
+        int to = (int)std::min<int64_t>(block_bytes, offset + size - block_start);
+        if (to <= from) {
+            break;
+        }
+        memcpy(buffer + copied, data + from, to - from);
+        copied += to - from;
+    }
+    return copied;
+}
+
+static int64_t http_get_size(MediaSource* source) {
+    auto http = (HttpSource*)source->opaque;
+    return http->size;
+}
+
+// Asks the server for the byte just past the size we know, which tells us
+// the new size if the file has grown
+static bool http_wait_for_data(MediaSource* source, int64_t size, int timeout_ms) {
+    auto http = (HttpSource*)source->opaque;
+    if (http->size > size) {
+        return true;
+    }
+
+    poll(NULL, 0, timeout_ms);
+
+    uint8_t byte;
+    int64_t received, total;
+    if (get_range(http, size, 1, &byte, &received, &total) != RANGE_FAILED && total > http->size) {
+        http->size = total;
+    }
+    return http->size > size;
+}
+
+static void http_destroy(MediaSource* source) {
+    auto http = (HttpSource*)source->opaque;
+    http->prefetches.wait();
+    ThreadPool::destroy(&http->prefetch_pool);
+    BlockCache::destroy(&http->cache);
+    for (int fd : http->idle_connections) {
+        close(fd);
+    }
+    delete http;
+}
+
+MediaSource* media_source_open_http(const char* url, const HttpSourceOptions* options) {
+    auto http = new HttpSource;
+    http->options = options ? *options : HttpSourceOptions();
+    http->size = 0;
+    http->requests = 0;
+    http->bytes_received = 0;
+    http->block_hits = 0;
+    http->block_misses = 0;
+    if (!parse_url(url, http)) {
+        delete http;
+        return NULL;
+    }
+
+    auto& opts = http->options;
+    opts.block_size = std::max(opts.block_size, 4096);
+    opts.num_connections = std::max(opts.num_connections, 1);
+    opts.max_request_blocks = std::max(opts.max_request_blocks, 1);
+
+    // Keep room for the readahead on top of what readers are working on,
+    // so that prefetched blocks aren't evicted before they are read
+    int capacity = (int)std::max<long>(opts.cache_budget / opts.block_size, 8);
+    opts.readahead_blocks = std::max(0, std::min(opts.readahead_blocks, capacity / 2));
+    BlockCache::init(&http->cache, opts.block_size, capacity, opts.spill_dir);
+
+    // The first block tells us the size of the file
+    std::vector<uint8_t> first_block(opts.block_size);
+    int64_t received, total;
+    if (get_range(http, 0, opts.block_size, first_block.data(), &received, &total) != RANGE_OK || total < 0) {
+        printf("Couldn't open %s\n", url);
+        BlockCache::destroy(&http->cache);
+        for (int fd : http->idle_connections) {
+            close(fd);
+        }
+        delete http;
+        return NULL;
+    }
+    http->size = total;
+    memcpy(http->cache.insert(0, (int)received), first_block.data(), received);
+
+    ThreadPool::init(&http->prefetch_pool, opts.num_connections);
+
+    auto source = new MediaSource;
+    source->filename = url;
+    source->ref_count = 1;
+    source->read_at = http_read_at;
+    source->get_size = http_get_size;
+    source->wait_for_data = http_wait_for_data;
+    source->destroy = http_destroy;
+    source->opaque = http;
+    return source;
+}
+
+bool http_source_get_stats(MediaSource* source, HttpSourceStats* stats) {
+    if (source->read_at != http_read_at) {
+        return false;
+    }
+    auto http = (HttpSource*)source->opaque;
+    stats->requests = http->requests;
+    stats->bytes_received = http->bytes_received;
+    stats->block_hits = http->block_hits;
+    stats->block_misses = http->block_misses;
+    return true;
+}
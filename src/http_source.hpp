@@ -0,0 +1,31 @@
+#ifndef http_source_hpp
+#define http_source_hpp
+
+#include <stdint.h>
+#include "media_source.hpp"
+
+struct HttpSourceOptions {
+    int block_size = 256 * 1024;
+    long cache_budget = 64 * 1024 * 1024;
+    const char* spill_dir = NULL; // spill evicted blocks to a temporary file here
+    int num_connections = 4;      // parallel range requests
+    int readahead_blocks = 16;    // prefetched past every read
+    int max_request_blocks = 4;   // adjacent missing blocks share one request
+};
+
+struct HttpSourceStats {
+    int64_t requests;
+    int64_t bytes_received;
+    int64_t block_hits;
+    int64_t block_misses;
+};
+
+// Opens an http:// URL on a server that supports range requests. Reads go
+// through a block cache, so seeking back is free and reading forward is
+// prefetched over several connections.
+MediaSource* media_source_open_http(const char* url, const HttpSourceOptions* options);
+
+// Returns false if the source isn't an HTTP source
+bool http_source_get_stats(MediaSource* source, HttpSourceStats* stats);
+
+#endif
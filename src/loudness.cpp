@@ -0,0 +1,417 @@
+#include "loudness.hpp"
+#include "video_reader.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+constexpr int   BLOCKS_PER_SECOND = 10;
+constexpr int   MOMENTARY_BLOCKS = 4;   // 400ms
+constexpr int   SHORT_TERM_BLOCKS = 30; // 3s
+constexpr double ABSOLUTE_GATE = -70.0; // LUFS
+constexpr double RELATIVE_GATE = -10.0; // LU below the absolute-gated loudness
+constexpr double RANGE_RELATIVE_GATE = -20.0;
+constexpr double SURROUND_WEIGHT = 1.41;
+
+static double power_to_lufs(double power) {
+    return power > 0 ? -0.691 + 10.0 * log10(power) : -INFINITY;
+}
+
+static double lufs_to_power(double lufs) {
+    return pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+// BS.1770 pre-filter and RLB high pass, derived for any sample rate
+// (the standard only tabulates 48kHz)
+static void k_weighting_coefficients(int sample_rate, double* shelf, double* highpass) {
+    double f0 = 1681.974450955533;
+    double gain_db = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = tan(M_PI * f0 / sample_rate);
+    double vh = pow(10.0, gain_db / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf[0] = (vh + vb * k / q + k * k) / a0;
+    shelf[1] = 2.0 * (k * k - vh) / a0;
+    shelf[2] = (vh - vb * k / q + k * k) / a0;
+    shelf[3] = 2.0 * (k * k - 1.0) / a0;
+    shelf[4] = (1.0 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(M_PI * f0 / sample_rate);
+    a0 = 1.0 + k / q + k * k;
+    highpass[0] = 1.0;
+    highpass[1] = -2.0;
+    highpass[2] = 1.0;
+    highpass[3] = 2.0 * (k * k - 1.0) / a0;
+    highpass[4] = (1.0 - k / q + k * k) / a0;
+}
+
+// 4x oversampling filter: a Blackman windowed sinc cut off at the input's
+// Nyquist frequency, split into one set of taps per output phase
+static void true_peak_coefficients(float phases[4][LoudnessMeter::TRUE_PEAK_TAPS]) {
+    constexpr int T = LoudnessMeter::TRUE_PEAK_TAPS;
+    constexpr int N = 4 * T;
+    double taps[N];
+    double sum = 0;
+    for (int n = 0; n < N; ++n) {
+        double t = (n - (N - 1) / 2.0) / 4.0;
+        double sinc = t == 0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+        double window = 0.42 - 0.5 * cos(2.0 * M_PI * n / (N - 1)) + 0.08 * cos(4.0 * M_PI * n / (N - 1));
+        taps[n] = sinc * window;
+        sum += taps[n];
+    }
+    // Unity gain for each phase
+    for (int n = 0; n < N; ++n) {
+        phases[n % 4][n / 4] = (float)(taps[n] * 4.0 / sum);
+    }
+}
+
+void LoudnessMeter::init(LoudnessMeter* meter, int sample_rate, int num_channels, double time_offset) {
+    meter->sample_rate = sample_rate;
+    meter->num_channels = num_channels;
+    meter->num_measured = std::min(num_channels, MAX_CHANNELS);
+    meter->time_offset = time_offset;
+
+    k_weighting_coefficients(sample_rate, meter->shelf, meter->highpass);
+    memset(meter->shelf_z1, 0, sizeof(meter->shelf_z1));
+    memset(meter->shelf_z2, 0, sizeof(meter->shelf_z2));
+    memset(meter->highpass_z1, 0, sizeof(meter->highpass_z1));
+    memset(meter->highpass_z2, 0, sizeof(meter->highpass_z2));
+
+    // Channels in FFmpeg's default order: L R C LFE, then surrounds, which
+    // count for more. The LFE isn't measured.
+    for (int c = 0; c < MAX_CHANNELS; ++c) {
+        meter->weights[c] = 1.0;
+        if (num_channels >= 6) {
+            if (c == 3) {
+                meter->weights[c] = 0.0;
+            } else if (c >= 4) {
+                meter->weights[c] = SURROUND_WEIGHT;
+            }
+        }
+    }
+
+    meter->block_size = std::max(1, sample_rate / BLOCKS_PER_SECOND);
+    meter->block_filled = 0;
+    memset(meter->block_energy, 0, sizeof(meter->block_energy));
+    meter->block_powers.clear();
+
+    true_peak_coefficients(meter->phases);
+    memset(meter->history, 0, sizeof(meter->history));
+    meter->planar.clear();
+    meter->true_peak = 0;
+    meter->sample_peak = 0;
+}
+
+void LoudnessMeter::destroy(LoudnessMeter* meter) {
+    meter->block_powers = std::vector<double>();
+    meter->planar = std::vector<float>();
+}
+
+// Runs both K-weighting filters over num_samples frames and adds the squared
+// output to each channel's block energy. The filters are recursive, so they
+// are vectorized across channels rather than samples.
+static void k_weight(LoudnessMeter* meter, const float* samples, int num_samples) {
+    const double* s = meter->shelf;
+    const double* h = meter->highpass;
+    int stride = meter->num_channels;
+    int c = 0;
+
+#if defined(__SSE2__)
+    const __m128d s0 = _mm_set1_pd(s[0]), s1 = _mm_set1_pd(s[1]), s2 = _mm_set1_pd(s[2]);
+    const __m128d s3 = _mm_set1_pd(s[3]), s4 = _mm_set1_pd(s[4]);
+    const __m128d h0 = _mm_set1_pd(h[0]), h1 = _mm_set1_pd(h[1]), h2 = _mm_set1_pd(h[2]);
+    const __m128d h3 = _mm_set1_pd(h[3]), h4 = _mm_set1_pd(h[4]);
+    for (; c + 2 <= meter->num_measured; c += 2) {
+        __m128d shelf_z1 = _mm_loadu_pd(meter->shelf_z1 + c);
+        __m128d shelf_z2 = _mm_loadu_pd(meter->shelf_z2 + c);
+        __m128d highpass_z1 = _mm_loadu_pd(meter->highpass_z1 + c);
+        __m128d highpass_z2 = _mm_loadu_pd(meter->highpass_z2 + c);
+        __m128d energy = _mm_loadu_pd(meter->block_energy + c);
+        const float* ptr = samples + c;
+        for (int i = 0; i < num_samples; ++i, ptr += stride) {
+            __m128d x = _mm_set_pd(ptr[1], ptr[0]);
+            __m128d y = _mm_add_pd(_mm_mul_pd(s0, x), shelf_z1);
+            shelf_z1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(s1, x), _mm_mul_pd(s3, y)), shelf_z2);
+            shelf_z2 = _mm_sub_pd(_mm_mul_pd(s2, x), _mm_mul_pd(s4, y));
+            x = y;
+            y = _mm_add_pd(_mm_mul_pd(h0, x), highpass_z1);
+            highpass_z1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(h1, x), _mm_mul_pd(h3, y)), highpass_z2);
+            highpass_z2 = _mm_sub_pd(_mm_mul_pd(h2, x), _mm_mul_pd(h4, y));
+            energy = _mm_add_pd(energy, _mm_mul_pd(y, y));
+        }
+        _mm_storeu_pd(meter->shelf_z1 + c, shelf_z1);
+        _mm_storeu_pd(meter->shelf_z2 + c, shelf_z2);
+        _mm_storeu_pd(meter->highpass_z1 + c, highpass_z1);
+        _mm_storeu_pd(meter->highpass_z2 + c, highpass_z2);
+        _mm_storeu_pd(meter->block_energy + c, energy);
+    }
+#endif
+    for (; c < meter->num_measured; ++c) {
+        double shelf_z1 = meter->shelf_z1[c], shelf_z2 = meter->shelf_z2[c];
+        double highpass_z1 = meter->highpass_z1[c], highpass_z2 = meter->highpass_z2[c];
+        double energy = meter->block_energy[c];
+        const float* ptr = samples + c;
+        for (int i = 0; i < num_samples; ++i, ptr += stride) {
+            double x = *ptr;
+            double y = s[0] * x + shelf_z1;
+            shelf_z1 = s[1] * x - s[3] * y + shelf_z2;
+            shelf_z2 = s[2] * x - s[4] * y;
+            x = y;
+            y = h[0] * x + highpass_z1;
+            highpass_z1 = h[1] * x - h[3] * y + highpass_z2;
+            highpass_z2 = h[2] * x - h[4] * y;
+            energy += y * y;
+        }
+        meter->shelf_z1[c] = shelf_z1;
+        meter->shelf_z2[c] = shelf_z2;
+        meter->highpass_z1[c] = highpass_z1;
+        meter->highpass_z2[c] = highpass_z2;
+        meter->block_energy[c] = energy;
+    }
+}
+
+// Largest absolute value of the 4x oversampled signal. x holds the
+// TRUE_PEAK_TAPS - 1 samples before the num_samples to measure.
+static float oversampled_peak(const float phases[4][LoudnessMeter::TRUE_PEAK_TAPS], const float* x, int num_samples) {
+    constexpr int T = LoudnessMeter::TRUE_PEAK_TAPS;
+    float peak = 0;
+    int i = 0;
+
+#if defined(__SSE2__)
+    // Four outputs of every phase at a time, sharing the loads
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 peaks = _mm_setzero_ps();
+    for (; i + 4 <= num_samples; i += 4) {
+        __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+        __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+        for (int k = 0; k < T; ++k) {
+            __m128 v = _mm_loadu_ps(x + i + T - 1 - k);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_set1_ps(phases[0][k]), v));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_set1_ps(phases[1][k]), v));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_set1_ps(phases[2][k]), v));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_set1_ps(phases[3][k]), v));
+        }
+        peaks = _mm_max_ps(peaks, _mm_andnot_ps(sign, acc0));
+        peaks = _mm_max_ps(peaks, _mm_andnot_ps(sign, acc1));
+        peaks = _mm_max_ps(peaks, _mm_andnot_ps(sign, acc2));
+        peaks = _mm_max_ps(peaks, _mm_andnot_ps(sign, acc3));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, peaks);
+    peak = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+    for (; i < num_samples; ++i) {
+        for (int p = 0; p < 4; ++p) {
+            float acc = 0;
+            for (int k = 0; k < T; ++k) {
+                acc += phases[p][k] * x[i + T - 1 - k];
+            }
+            peak = std::max(peak, fabsf(acc));
+        }
+    }
+    return peak;
+}
+
+static void measure_peaks(LoudnessMeter* meter, const float* samples, int num_samples) {
+    constexpr int T = LoudnessMeter::TRUE_PEAK_TAPS;
+    meter->planar.resize(T - 1 + num_samples);
+    float* x = meter->planar.data();
+    int stride = meter->num_channels;
+
+    for (int c = 0; c < meter->num_measured; ++c) {
+        memcpy(x, meter->history[c], sizeof(meter->history[c]));
+        float sample_peak = meter->sample_peak;
+        const float* ptr = samples + c;
+        for (int i = 0; i < num_samples; ++i, ptr += stride) {
+            x[T - 1 + i] = *ptr;
+            sample_peak = std::max(sample_peak, fabsf(*ptr));
+        }
+        meter->sample_peak = sample_peak;
+        meter->true_peak = std::max(meter->true_peak, oversampled_peak(meter->phases, x, num_samples));
+        memcpy(meter->history[c], x + num_samples, sizeof(meter->history[c]));
+    }
+}
+
+void loudness_meter_add(LoudnessMeter* meter, const float* samples, int num_samples) {
+    PROFILE_SCOPE("loudness_meter_add");
+
+    measure_peaks(meter, samples, num_samples);
+
+    // Filter up to each 100ms boundary, then close the block
+    while (num_samples > 0) {
+        int count = std::min(num_samples, meter->block_size - meter->block_filled);
+        k_weight(meter, samples, count);
+        samples += count * meter->num_channels;
+        num_samples -= count;
+        meter->block_filled += count;
+
+        if (meter->block_filled == meter->block_size) {
+            double power = 0;
+            for (int c = 0; c < meter->num_measured; ++c) {
+                power += meter->weights[c] * meter->block_energy[c];
+                meter->block_energy[c] = 0;
+            }
+            meter->block_powers.push_back(power / meter->block_size);
+            meter->block_filled = 0;
+        }
+    }
+}
+
+// Keeps the blocks over the absolute gate and over the given relative gate,
+// which is relative to the mean power of the blocks over the absolute gate
+static void gate_blocks(const std::vector<double>& powers, double relative_gate, std::vector<double>* gated) {
+    double absolute_threshold = lufs_to_power(ABSOLUTE_GATE);
+    double sum = 0;
+    int count = 0;
+    for (double power : powers) {
+        if (power > absolute_threshold) {
+            sum += power;
+            ++count;
+        }
+    }
+    gated->clear();
+    if (count == 0) {
+        return;
+    }
+    double relative_threshold = sum / count * pow(10.0, relative_gate / 10.0);
+    for (double power : powers) {
+        if (power > absolute_threshold && power > relative_threshold) {
+            gated->push_back(power);
+        }
+    }
+}
+
+void loudness_meter_finish(LoudnessMeter* meter, LoudnessResult* result) {
+    PROFILE_SCOPE("loudness_meter_finish");
+
+    auto& powers = meter->block_powers;
+    int num_blocks = (int)powers.size();
+
+    // Sliding windows from running sums of the 100ms blocks
+    std::vector<double> sums(num_blocks + 1, 0.0);
+    for (int i = 0; i < num_blocks; ++i) {
+        sums[i + 1] = sums[i] + powers[i];
+    }
+
+    std::vector<double> momentary_powers;
+    std::vector<double> short_term_powers;
+    momentary_powers.reserve(num_blocks);
+    short_term_powers.reserve(num_blocks);
+
+    result->blocks.resize(num_blocks);
+    result->max_momentary = -INFINITY;
+    result->max_short_term = -INFINITY;
+    for (int i = 0; i < num_blocks; ++i) {
+        auto& block = result->blocks[i];
+        block.time_start = (float)(meter->time_offset + (double)i / BLOCKS_PER_SECOND);
+        block.time_end   = (float)(meter->time_offset + (double)(i + 1) / BLOCKS_PER_SECOND);
+        block.momentary = -INFINITY;
+        block.short_term = -INFINITY;
+        if (i + 1 >= MOMENTARY_BLOCKS) {
+            double power = (sums[i + 1] - sums[i + 1 - MOMENTARY_BLOCKS]) / MOMENTARY_BLOCKS;
+            momentary_powers.push_back(power);
+            block.momentary = (float)power_to_lufs(power);
+            result->max_momentary = std::max(result->max_momentary, block.momentary);
+        }
+        if (i + 1 >= SHORT_TERM_BLOCKS) {
+            double power = (sums[i + 1] - sums[i + 1 - SHORT_TERM_BLOCKS]) / SHORT_TERM_BLOCKS;
+            short_term_powers.push_back(power);
+            block.short_term = (float)power_to_lufs(power);
+            result->max_short_term = std::max(result->max_short_term, block.short_term);
+        }
+    }
+
+    // Integrated loudness over the 400ms gating blocks
+    std::vector<double> gated;
+    gate_blocks(momentary_powers, RELATIVE_GATE, &gated);
+    double sum = 0;
+    for (double power : gated) {
+        sum += power;
+    }
+    result->integrated = gated.empty() ? -INFINITY : (float)power_to_lufs(sum / gated.size());
+
+    // Loudness range: the 10th to 95th percentile of the gated short-term
+    // loudness (EBU Tech 3342)
+    gate_blocks(short_term_powers, RANGE_RELATIVE_GATE, &gated);
+    result->range = 0;
+    if (!gated.empty()) {
+        std::sort(gated.begin(), gated.end());
+        size_t low  = (size_t)lround((gated.size() - 1) * 0.10);
+        size_t high = (size_t)lround((gated.size() - 1) * 0.95);
+        result->range = (float)(power_to_lufs(gated[high]) - power_to_lufs(gated[low]));
+    }
+
+    result->duration = ((double)num_blocks * meter->block_size + meter->block_filled) / meter->sample_rate;
+
+    float true_peak = std::max(meter->true_peak, meter->sample_peak);
+    result->true_peak = true_peak > 0 ? 20.0f * log10f(true_peak) : -INFINITY;
+    result->sample_peak = meter->sample_peak > 0 ? 20.0f * log10f(meter->sample_peak) : -INFINITY;
+}
+
+static bool cancelled(void* opaque) {
+    return ((const std::atomic_bool*)opaque)->load();
+}
+
+bool loudness_analyze(const char* filename,
+                      const std::atomic_bool* cancel,
+                      std::atomic_int* frames_done,
+                      LoudnessResult* result) {
+    VideoReaderState state;
+    if (!video_reader_open(&state, filename)) {
+        return false;
+    }
+    if (state.audio_stream_index == -1) {
+        video_reader_close(&state);
+        return false;
+    }
+    video_reader_select_streams(&state, false, true);
+    if (cancel) {
+        state.should_cancel = cancelled;
+        state.should_cancel_opaque = (void*)cancel;
+    }
+
+    // Each frame is converted into the staging buffer and metered right
+    // away, no ring buffer in between
+    LoudnessMeter meter;
+    bool meter_ready = false;
+    std::vector<float> staging;
+    bool success = true;
+
+    int res, packet_pts, pts;
+    while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+        if (res == RECEIVED_CANCELLED) {
+            success = false;
+            break;
+        }
+        if (res <= 0) {
+            continue;
+        }
+        if (!meter_ready) {
+            LoudnessMeter::init(&meter, state.sample_rate, state.num_channels, pts * av_q2d(state.audio_time_base));
+            meter_ready = true;
+        }
+        staging.resize((size_t)res * state.num_channels);
+        video_reader_transfer_audio_frame(&state, res, staging.data(), 0, NULL);
+        loudness_meter_add(&meter, staging.data(), res);
+        if (frames_done) {
+            ++*frames_done;
+        }
+    }
+    video_reader_close(&state);
+
+    if (!meter_ready) {
+        return false;
+    }
+    if (success) {
+        loudness_meter_finish(&meter, result);
+    }
+    LoudnessMeter::destroy(&meter);
+    return success;
+}
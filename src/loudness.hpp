@@ -0,0 +1,77 @@
+#ifndef loudness_hpp
+#define loudness_hpp
+
+#include <atomic>
+#include <vector>
+
+// Loudness of one 100ms step of the audio stream (EBU R128 / ITU-R BS.1770)
+struct LoudnessBlock {
+    float time_start; // on the audio row
+    float time_end;
+    float momentary;  // LUFS over the 400ms up to time_end, -inf if silent
+    float short_term; // LUFS over the 3s up to time_end, -inf if silent
+};
+
+struct LoudnessResult {
+    std::vector<LoudnessBlock> blocks;
+    double duration;   // seconds measured
+    float integrated;  // LUFS, gated
+    float range;       // LU (LRA)
+    float true_peak;   // dBTP, from 4x oversampling
+    float sample_peak; // dBFS
+    float max_momentary;
+    float max_short_term;
+};
+
+// Measures interleaved float audio as it is decoded. Blocks are laid out
+// from time_offset, the time of the first sample on the audio row.
+struct LoudnessMeter {
+    static constexpr int MAX_CHANNELS = 8; // 7.1, any further channels are left out
+    static constexpr int TRUE_PEAK_TAPS = 12; // per phase of the 48 tap oversampling filter
+
+    int sample_rate;
+    int num_channels; // in the input
+    int num_measured;
+    double time_offset;
+
+    // K-weighting: a high shelf then a high pass, as b0 b1 b2 a1 a2 in
+    // transposed direct form II, with one state per channel
+    double shelf[5];
+    double highpass[5];
+    double shelf_z1[MAX_CHANNELS];
+    double shelf_z2[MAX_CHANNELS];
+    double highpass_z1[MAX_CHANNELS];
+    double highpass_z2[MAX_CHANNELS];
+    double weights[MAX_CHANNELS];
+
+    // Weighted mean square of every 100ms step
+    int block_size;
+    int block_filled;
+    double block_energy[MAX_CHANNELS];
+    std::vector<double> block_powers;
+
+    // True peak, over each channel de-interleaved after the last samples of
+    // the previous call
+    float phases[4][TRUE_PEAK_TAPS];
+    float history[MAX_CHANNELS][TRUE_PEAK_TAPS - 1];
+    std::vector<float> planar;
+    float true_peak;
+    float sample_peak;
+
+    // Constructor, destructor
+    static void init(LoudnessMeter* meter, int sample_rate, int num_channels, double time_offset);
+    static void destroy(LoudnessMeter* meter);
+};
+
+void loudness_meter_add(LoudnessMeter* meter, const float* samples, int num_samples);
+void loudness_meter_finish(LoudnessMeter* meter, LoudnessResult* result);
+
+// Decodes the audio stream from start to end and measures it. Frames are
+// metered as soon as they are decoded, so this runs as fast as the decoder;
+// frames_done counts up as it goes, for progress.
+bool loudness_analyze(const char* filename,
+                      const std::atomic_bool* cancel,
+                      std::atomic_int* frames_done,
+                      LoudnessResult* result);
+
+#endif
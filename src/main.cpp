@@ -7,85 +7,259 @@
 #include <algorithm>
 #include <pthread.h>
 #include "data_types/ring_buffer.hpp"
+#include "data_types/frame_cache.hpp"
+#include "data_types/latency_histogram.hpp"
 #include "video_reader.hpp"
+#include "media_source.hpp"
 #include "peak_image.hpp"
+#include "packet_index.hpp"
+#include "timeline.hpp"
 #include "audio_client.hpp"
+#include "profiler.hpp"
+#include "pixel_inspector.hpp"
+#include "decode_cost.hpp"
+#include "frame_hash.hpp"
+#include "timestamp_anomalies.hpp"
+#include "scene_analysis.hpp"
+#include "loudness.hpp"
+#include "side_data_overlay.hpp"
+#include "frame_export.hpp"
+#include "thread_pool.hpp"
 #include <time.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 constexpr int BUFFER_SIZE = 512;
-constexpr int RING_BUFFER_SIZE = 8192;
-
-static ScrollArea::ScrollAreaState scroll_area_state;
-static VideoReaderState vr_state;
-static float duration;
-static RingBuffer rb;
-int pkt_hovering;
-static std::atomic_int pkt_requested;
-static std::atomic_int pkt_playing;
-static bool should_close;
-static uint8_t* frame_buffer;
-static std::atomic_bool frame_buffer_filled;
-static pthread_t decode_thread;
-static int image_id;
-
-struct PacketInfo {
-    enum PacketType : unsigned char {
-        AUDIO,
-        VIDEO_KEY,
-        VIDEO_DELTA
-    };
-
-    PacketType type;
-    int index;
-    int pts;
-    int dts;
-    float duration;
-    float time_start;
-    float time_end;
+constexpr int RING_BUFFER_SIZE = 131072;
+constexpr int RING_BUFFER_MIN_LIMIT = 2048;
+constexpr long FRAME_CACHE_BUDGET = 256 * 1024 * 1024; // for all open files together
+constexpr int DECODE_POOL_THREADS = 4;
+constexpr int64_t IDLE_RELEASE_NS = 30000000000; // left alone this long, a file gives back its decoders
+
+// Runs the jobs of one reader on the decode pool one at a time, since a
+// reader decodes from one place at a time. Scheduling it while a job runs
+// makes the job look for more work before it gives the thread back.
+struct ReaderJobs {
+    std::mutex mutex;
+    bool scheduled;
+    bool dirty;
+    TaskGroup tasks;
 };
 
-static std::vector<PacketInfo> all_packets;
-static std::vector<PacketInfo> video_packets;
-static std::vector<PacketInfo> audio_packets;
-
-static bool cmp_pkt_start(const PacketInfo& a, const PacketInfo& b) {
-    return a.time_start < b.time_start;
-}
-static bool cmp_pkt_end(const PacketInfo& a, const PacketInfo& b) {
-    return a.time_end < b.time_end;
-}
+// Everything about one open file. Files are stacked in the timeline and
+// share the decode pool, the frame cache and the audio output.
+struct OpenFile {
+    int id; // owner of its frames in the frame cache
+    std::string filename;
+    MediaSource* media_source;
+    VideoReaderState video_state; // indexing, frame inspection and prefetch
+    VideoReaderState audio_state; // audio playback
+    VideoReaderState follow_state; // indexing a file that is still being written
+    PacketIndex packet_index;
+    bool has_video;
+    bool has_audio;
+    bool follow;
+    pthread_t follow_thread;
+    std::mutex follow_mutex;
+    std::vector<std::unique_ptr<PacketBatch>> follow_pending;
+    std::atomic_bool should_close;
+
+    // Packets being looked at, and the jobs looking at them
+    std::atomic_int pkt_hovering;
+    std::atomic_int pkt_requested;
+    std::atomic_int video_pkt_requested;
+    std::atomic_int audio_pkt_requested;
+    std::atomic_int pkt_playing;
+    std::atomic_int pkt_decoding;
+    int pkt_prefetched;
+    std::atomic_int pkt_prefetching;
+    std::atomic_int video_generation;
+    std::atomic_int audio_generation;
+    std::atomic<int64_t> request_time;
+    int video_job_generation;
+    int audio_job_generation;
+    int video_handled_generation;
+    int audio_handled_generation;
+    ReaderJobs video_jobs;
+    ReaderJobs audio_jobs;
+
+    // Decoders are given back while the file is left alone (see release_idle_files)
+    int64_t last_used_ns;
+    bool decoders_released;
+    std::atomic_bool release_video_decoders;
+    std::atomic_bool release_audio_decoders;
+
+    // Preview of the shown frame
+    uint8_t* frame_buffer; // RGB0 at display size
+    int display_width;
+    int display_height;
+    std::atomic_bool frame_buffer_filled;
+    std::atomic<int64_t> frame_buffer_request_time;
+    int image_id;
+    AVFrame* cached_frame; // taken from the frame cache by the video jobs
+    SideDataOverlay side_data_overlay;
+    std::atomic_int frame_shown_pts;
+
+    // Background analysis
+    pthread_t decode_cost_thread;
+    bool decode_cost_running;
+    bool show_decode_costs;
+    std::atomic_bool decode_cost_cancel;
+    std::atomic_bool decode_cost_done;
+    std::atomic_int decode_cost_packets;
+    std::vector<std::pair<int, float>> decode_costs; // handed over once done
+    float decode_cost_scale_ms;
+    pthread_t scene_thread;
+    bool scene_running;
+    std::atomic_bool scene_cancel;
+    std::atomic_bool scene_done;
+    std::atomic_int scene_frames_done;
+    std::vector<SceneFrame> scene_frames_pending; // handed over once done
+    std::vector<SceneFrame> scene_frames;
+    pthread_t loudness_thread;
+    bool loudness_running;
+    std::atomic_bool loudness_cancel;
+    std::atomic_bool loudness_done;
+    std::atomic_int loudness_frames_done;
+    LoudnessResult loudness_pending; // handed over once done
+    LoudnessResult loudness;
+    int export_from; // video packets at the ends of the selection, set with 'b' and 'e'
+    int export_to;
+    pthread_t export_thread;
+    bool export_running;
+    std::atomic_bool export_cancel;
+    std::atomic_bool export_done;
+    std::atomic_bool export_success;
+    std::atomic_int export_frames_done;
+    int export_frames_total;
+    std::string export_path; // written by the export thread until done
+    std::vector<TimestampAnomaly> anomalies;
+    int anomaly_selected;
+    int64_t anomalies_scanned_ns;
+};
 
-static float draw_packets(std::vector<PacketInfo>* packets, float time_from, float time_to, float second_width, float y, int* next_pkt_hovering);
+static ScrollArea::ScrollAreaState scroll_area_state;
+static std::vector<std::unique_ptr<OpenFile>> files; // top to bottom in the timeline
+static OpenFile* active_file; // the one keys act on
+static int next_file_id;
+static ThreadPool decode_pool; // video and audio jobs of every file
+static RingBuffer rb;
+static std::mutex audio_mutex; // one file plays at a time, the ring buffer has one writer
+static std::atomic<OpenFile*> audio_file; // the file last clicked to play
+static bool audio_client_opened;
+static int audio_client_sample_rate;
+static int audio_client_num_channels;
+static std::atomic_bool audio_streaming;
+static std::atomic_int audio_underruns;
+static std::atomic_bool audio_buffer_filled; // underruns only count once the ring buffer first filled
+static int ring_buffer_floor; // raised by underruns, decays slowly; audio_mutex
+static std::atomic_int decode_jitter_us;
+static ProfileThread* audio_profile_thread; // the audio callback records into it
+static FrameCache frame_cache;
+static std::atomic_int frame_cache_frames_per_gb; // published for the profile overlay
+static std::atomic_long frame_cache_bytes;
+static LatencyHistogram click_latency;
+static bool show_click_latency;
+static bool show_profile_overlay;
+static bool show_audio_stats;
+static bool show_pixel_inspector;
+static PixelInspector pixel_inspector;
+static std::atomic_bool show_side_data; // the video jobs export side data while set
+static std::atomic<int64_t> first_paint_start_ns;
 
-constexpr float FRAME_HEIGHT = 20;
-constexpr float Y_SPACING = 10;
 constexpr float PREVIEW_SCALE = 0.25;
-
-static void open_file(const char* fname);
-static void close_file();
+constexpr float LATENCY_WIDTH = 260;
+constexpr float LATENCY_HEIGHT = 140;
+constexpr float PROFILE_WIDTH = 420;
+constexpr double PROFILE_WINDOW_MS = 2000.0;
+constexpr float AUDIO_STATS_WIDTH = 300;
+
+static void draw_click_latency(float x, float y);
+static void draw_profile_overlay(float x, float y);
+static void draw_audio_stats(float x, float bottom);
+static float draw_file(OpenFile* file, float time_from, float time_to, float second_width, float view_width, float y);
+
+static OpenFile* open_file(const char* fname, bool follow);
+static OpenFile* reopen_file(OpenFile* file, bool follow);
+static void close_file(OpenFile* file);
+static void touch_file(OpenFile* file);
+static void release_idle_files();
+static float update_files(float second_width, float view_width);
+static void schedule_jobs(ReaderJobs* jobs, OpenFile* file, bool (*work)(OpenFile* file));
+static bool video_work(OpenFile* file);
+static bool audio_work(OpenFile* file);
+void audio_callback(int num_samples, int num_channels, float* buffer);
+static void append_followed_packets(OpenFile* file, float second_width, float view_width);
+static void start_decode_cost_pass(OpenFile* file);
+static void scan_anomalies(OpenFile* file);
+static void jump_to_anomaly(OpenFile* file, int direction, float second_width, float view_width);
+static void finish_decode_cost_pass(OpenFile* file);
+static void start_scene_analysis(OpenFile* file);
+static void finish_scene_analysis(OpenFile* file);
+static void start_loudness_analysis(OpenFile* file);
+static void finish_loudness_analysis(OpenFile* file);
+static void start_export(OpenFile* file, ExportFormat format);
+static void finish_export(OpenFile* file);
 
 void update() {
     auto ANIMATION_ID = (void*)0xF0;
-    if (pkt_playing != -1 && !ddui::animation::is_animating(ANIMATION_ID)) {
+    bool animating = show_profile_overlay || show_audio_stats;
+    for (auto& file : files) {
+        animating = animating || file->pkt_playing != -1 || file->pkt_decoding != -1 || file->follow ||
+                    file->decode_cost_running || file->scene_running || file->loudness_running || file->export_running;
+    }
+    if (animating && !ddui::animation::is_animating(ANIMATION_ID)) {
         ddui::animation::start(ANIMATION_ID);
     }
 
-    if (pkt_requested != -1 && !ddui::mouse_state.pressed) {
-        pkt_requested = -1;
-    }
+    for (auto& file : files) {
+        if (file->pkt_requested != -1 && !ddui::mouse_state.pressed) {
+            file->pkt_requested = -1;
+        }
 
-    if (frame_buffer_filled) {
-        ddui::update_image(image_id, frame_buffer);
-        frame_buffer_filled = false;
+        if (file->frame_buffer_filled) {
+            {
+                PROFILE_SCOPE("update_image");
+                if (file->image_id == -1) {
+                    file->image_id = ddui::create_image_from_rgba(file->display_width, file->display_height, 0, file->frame_buffer);
+                } else {
+                    ddui::update_image(file->image_id, file->frame_buffer);
+                }
+            }
+            file->frame_buffer_filled = false;
+            click_latency.add((profiler_now_ns() - file->frame_buffer_request_time) / 1000000.0);
+        }
     }
-    
+
+    // Dropped files open alongside the ones already open, e.g. to compare
+    // encodes of the same source
     if (ddui::has_dropped_files()) {
-        close_file();
-        open_file(ddui::file_drop_state.paths[0]);
+        first_paint_start_ns = profiler_now_ns();
+        auto file = open_file(ddui::file_drop_state.paths[0], false);
+        if (file) {
+            active_file = file;
+        }
         ddui::consume_dropped_files();
     }
 
+    // Full resolution view of the shown frame, toggled with 'i'
+    if (ddui::has_key_event() && ddui::key_state.character && ddui::key_state.character[0] == 'i') {
+        ddui::consume_key_event();
+        show_pixel_inspector = !show_pixel_inspector;
+    }
     static float second_width = 512.0;
+    if (show_pixel_inspector) {
+        // The files carry on underneath, e.g. following and finishing analyses
+        update_files(second_width, ddui::view.width);
+        pixel_inspector_update(&pixel_inspector, 0, 0, ddui::view.width, ddui::view.height);
+        return;
+    }
+
     if (ddui::has_key_event()) {
         if (ddui::key_state.character && ddui::key_state.character[0] == '-') {
             ddui::consume_key_event();
@@ -98,14 +272,108 @@ void update() {
             ddui::consume_key_event();
             second_width *= 2.0;
         }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'l') {
+            ddui::consume_key_event();
+            show_click_latency = !show_click_latency;
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'p') {
+            ddui::consume_key_event();
+            show_profile_overlay = !show_profile_overlay;
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'a') {
+            ddui::consume_key_event();
+            show_audio_stats = !show_audio_stats;
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'f') {
+            ddui::consume_key_event();
+            if (active_file) {
+                active_file = reopen_file(active_file, !active_file->follow);
+            }
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'w') {
+            ddui::consume_key_event();
+            if (active_file) {
+                close_file(active_file);
+                ddui::repaint(NULL);
+            }
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'c') {
+            ddui::consume_key_event();
+            start_decode_cost_pass(active_file);
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 's') {
+            ddui::consume_key_event();
+            start_scene_analysis(active_file);
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'm') {
+            ddui::consume_key_event();
+            show_side_data = !show_side_data;
+            // Decode the shown frames again, this time with their side data
+            for (auto& file : files) {
+                if (show_side_data && file->has_video && file->video_pkt_requested != -1) {
+                    file->request_time = profiler_now_ns();
+                    ++file->video_generation;
+                    schedule_jobs(&file->video_jobs, file.get(), video_work);
+                }
+            }
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'b') {
+            ddui::consume_key_event();
+            if (active_file) {
+                active_file->export_from = active_file->video_pkt_requested;
+                ddui::repaint(NULL);
+            }
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'e') {
+            ddui::consume_key_event();
+            if (active_file) {
+                active_file->export_to = active_file->video_pkt_requested;
+                ddui::repaint(NULL);
+            }
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'x') {
+            ddui::consume_key_event();
+            start_export(active_file, EXPORT_PNG);
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'y') {
+            ddui::consume_key_event();
+            start_export(active_file, EXPORT_RAW_YUV);
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'k') {
+            ddui::consume_key_event();
+            start_export(active_file, EXPORT_STREAM_COPY);
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 'r') {
+            ddui::consume_key_event();
+            start_loudness_analysis(active_file);
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == '[') {
+            ddui::consume_key_event();
+            jump_to_anomaly(active_file, -1, second_width, ddui::view.width);
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == ']') {
+            ddui::consume_key_event();
+            jump_to_anomaly(active_file, 1, second_width, ddui::view.width);
+        }
+        if (ddui::key_state.character && ddui::key_state.character[0] == 't') {
+            ddui::consume_key_event();
+            if (profiler_write_chrome_trace("video_inspect_trace.json")) {
+                printf("Wrote video_inspect_trace.json\n");
+            }
+        }
     }
-    float area_width = duration * second_width;
     float view_width = ddui::view.width;
-    ScrollArea::update(&scroll_area_state, area_width, ddui::view.height, [&]() {
+    float area_width = update_files(second_width, view_width);
+
+    // Files are stacked in one scroll area, so they scroll and zoom together
+    // on the same time axis
+    static float area_height = 0;
+    float content_height = std::max(ddui::view.height, area_height);
+    ScrollArea::update(&scroll_area_state, area_width, content_height, [&]() {
 
         ddui::begin_path();
         ddui::fill_color(ddui::rgb(0x333333));
-        ddui::rect(0, 0, ddui::view.width, ddui::view.height);
+        ddui::rect(0, 0, ddui::view.width, content_height);
         ddui::fill();
 
         float time_from = scroll_area_state.scroll_x / second_width;
@@ -120,7 +388,7 @@ void update() {
         for (int s = second_from; s < second_to; ++s) {
             float second_x = s * second_width;
             ddui::move_to(second_x, 0);
-            ddui::line_to(second_x, ddui::view.width);
+            ddui::line_to(second_x, content_height);
         }
         ddui::stroke();
 
@@ -139,186 +407,720 @@ void update() {
         }
         y += lineh + Y_SPACING;
 
-        int next_pkt_hovering = -1;
-
-        // Draw video packets
-        y = draw_packets(&video_packets, time_from, time_to, second_width, y, &next_pkt_hovering);
-
-        // Draw audio packets
-        y = draw_packets(&audio_packets, time_from, time_to, second_width, y, &next_pkt_hovering);
-
-        // Draw mixed in-order packets
-        y = draw_packets(&all_packets, time_from, time_to, second_width, y, &next_pkt_hovering);
+        for (auto& file : files) {
+            y = draw_file(file.get(), time_from, time_to, second_width, view_width, y);
+        }
 
-        if (pkt_hovering != next_pkt_hovering) {
-            pkt_hovering = next_pkt_hovering;
-            ddui::repaint(NULL);
+        // Leave room to scroll the last file out from under the previews
+        int preview_height = 0;
+        for (auto& file : files) {
+            preview_height = std::max(preview_height, file->image_id != -1 ? file->display_height : 0);
         }
+        area_height = y + preview_height + 40;
 
     });
 
-    if (image_id != -1) {
+    // Previews side by side, in the order of the files
+    float preview_x = 20;
+    for (auto& file_ptr : files) {
+        auto file = file_ptr.get();
+        if (file->image_id == -1) {
+            continue;
+        }
+        float preview_y = ddui::view.height - 20 - file->display_height;
+
         ddui::save();
-        ddui::translate(20, ddui::view.height - 20 - vr_state.height * PREVIEW_SCALE);
+        ddui::translate(preview_x, preview_y);
         auto paint = ddui::image_pattern(0,
                                          0,
-                                         vr_state.width * PREVIEW_SCALE,
-                                         vr_state.height * PREVIEW_SCALE,
+                                         file->display_width,
+                                         file->display_height,
                                          0,
-                                         image_id,
+                                         file->image_id,
                                          1.0f);
         ddui::fill_paint(paint);
         ddui::begin_path();
-        ddui::rect(0, 0, vr_state.width * PREVIEW_SCALE, vr_state.height * PREVIEW_SCALE);
+        ddui::rect(0, 0, file->display_width, file->display_height);
         ddui::fill();
+        if (file == active_file && files.size() > 1) {
+            ddui::begin_path();
+            ddui::stroke_width(2.0);
+            ddui::stroke_color(ddui::rgb(0xffffff));
+            ddui::rect(-1, -1, file->display_width + 2, file->display_height + 2);
+            ddui::stroke();
+        }
         ddui::restore();
+
+        // Motion vectors and QP of the shown frame, toggled with 'm'
+        if (show_side_data) {
+            side_data_overlay_draw(&file->side_data_overlay, file->frame_shown_pts, preview_x, preview_y, file->display_width, file->display_height);
+        }
+        preview_x += file->display_width + 20;
+    }
+
+    if (show_click_latency) {
+        draw_click_latency(ddui::view.width - 20 - LATENCY_WIDTH, 20);
+    }
+
+    if (show_profile_overlay) {
+        draw_profile_overlay(20, 20);
+    }
+
+    if (show_audio_stats && audio_client_opened) {
+        draw_audio_stats(ddui::view.width - 20 - AUDIO_STATS_WIDTH, ddui::view.height - 20);
+    }
+
+    // From launch (or dropping a file) to the first timeline on screen
+    if (first_paint_start_ns) {
+        int64_t now = profiler_now_ns();
+        profiler_record("time_to_first_paint", first_paint_start_ns, now);
+        printf("First paint after %.1fms\n", (now - first_paint_start_ns) / 1000000.0);
+        first_paint_start_ns = 0;
     }
 }
 
-float draw_packets(std::vector<PacketInfo>* packets, float time_from, float time_to, float second_width, float y, int* next_pkt_hovering) {
+// Draws the rows of one file at y under a header with its name, and hands
+// clicks on its packets to its jobs. Returns the y of the next file.
+float draw_file(OpenFile* file, float time_from, float time_to, float second_width, float view_width, float y) {
+
+    // Header, kept in view while scrolling. Clicking it, or any of the
+    // file's packets, makes it the file that keys act on.
+    float header_x = scroll_area_state.scroll_x;
+    if (file == active_file) {
+        auto color = ddui::rgb(0xffffff);
+        color.a = 0.15;
+        ddui::begin_path();
+        ddui::rect(header_x, y, view_width, FRAME_HEIGHT);
+        ddui::fill_color(color);
+        ddui::fill();
+    }
+    ddui::fill_color(ddui::rgb(file == active_file ? 0xffffff : 0xaaaaaa));
+    ddui::font_face("mono");
+    ddui::font_size(12.0);
+    ddui::text(header_x + 4, y + 14, file->filename.c_str(), NULL);
+    if (ddui::mouse_hit(header_x, y, view_width, FRAME_HEIGHT)) {
+        ddui::mouse_hit_accept();
+        active_file = file;
+        ddui::repaint(NULL);
+    }
+    y += FRAME_HEIGHT + Y_SPACING;
+
+    int next_pkt_hovering = -1;
+    int pkt_clicked = -1;
+    int pkt_highlighted = file->pkt_playing  != -1 ? (int)file->pkt_playing  :
+                          file->pkt_decoding != -1 ? (int)file->pkt_decoding : (int)file->pkt_hovering;
+    auto& packet_index = file->packet_index;
+
+    // Draw video packets, with the selection to export over them
+    float video_row_y = y;
+    y = draw_packets(&packet_index.video_packets, time_from, time_to, second_width, y, pkt_highlighted, &next_pkt_hovering, &pkt_clicked);
+    PacketInfo export_first, export_last;
+    if (packet_index_get(&packet_index, file->export_from, &export_first) && packet_index_get(&packet_index, file->export_to, &export_last)) {
+        float seconds_per_tick = av_q2d(packet_index.video_time_base);
+        float selection_start = std::min(export_first.pts, export_last.pts) * seconds_per_tick;
+        float selection_end = std::max(export_first.pts + export_first.duration / seconds_per_tick,
+                                       export_last.pts + export_last.duration / seconds_per_tick) * seconds_per_tick;
+        auto color = ddui::rgb(0xffffff);
+        color.a = 0.3;
+        ddui::begin_path();
+        ddui::rect(selection_start * second_width, video_row_y - 2, (selection_end - selection_start) * second_width, FRAME_HEIGHT + 4);
+        ddui::fill_color(color);
+        ddui::fill();
+    }
+    if (file->export_running) {
+        char progress_str[64];
+        snprintf(progress_str, sizeof(progress_str), "exporting %d%%", (int)(file->export_frames_done * 100L / std::max(1, file->export_frames_total)));
+        ddui::fill_color(ddui::rgb(0xffffff));
+        ddui::font_size(12.0);
+        ddui::text(scroll_area_state.scroll_x + 4, y + 14, progress_str, NULL);
+        y += FRAME_HEIGHT + Y_SPACING;
+    }
+
+    // Draw the decode cost of video packets, once measured with 'c'
+    if (file->decode_cost_running) {
+        int num_packets = std::max(1, (int)packet_index.video_packets.size());
+        char progress_str[64];
+        snprintf(progress_str, sizeof(progress_str), "measuring decode cost %d%%", (int)(file->decode_cost_packets * 100L / num_packets));
+        ddui::fill_color(ddui::rgb(0xffffff));
+        ddui::font_size(12.0);
+        ddui::text(scroll_area_state.scroll_x + 4, y + 14, progress_str, NULL);
+        y += FRAME_HEIGHT + Y_SPACING;
+    } else if (file->show_decode_costs) {
+        y = draw_decode_costs(&packet_index.video_packets, time_from, time_to, second_width, y, file->decode_cost_scale_ms);
+    }
+
+    // Draw cuts, black and frozen frames, once analysed with 's'
+    if (file->scene_running) {
+        int num_packets = std::max(1, (int)packet_index.video_packets.size());
+        char progress_str[64];
+        snprintf(progress_str, sizeof(progress_str), "analysing scenes %d%%", (int)(file->scene_frames_done * 100L / num_packets));
+        ddui::fill_color(ddui::rgb(0xffffff));
+        ddui::font_size(12.0);
+        ddui::text(scroll_area_state.scroll_x + 4, y + 14, progress_str, NULL);
+        y += FRAME_HEIGHT + Y_SPACING;
+    } else if (!file->scene_frames.empty()) {
+        y = draw_scene_frames(&file->scene_frames, time_from, time_to, second_width, y);
+    }
+
+    // Draw audio packets
+    y = draw_packets(&packet_index.audio_packets, time_from, time_to, second_width, y, pkt_highlighted, &next_pkt_hovering, &pkt_clicked);
+
+    // Draw the momentary loudness, once measured with 'r'
+    if (file->loudness_running) {
+        int num_packets = std::max(1, (int)packet_index.audio_packets.size());
+        char progress_str[64];
+        snprintf(progress_str, sizeof(progress_str), "measuring loudness %d%%", (int)(file->loudness_frames_done * 100L / num_packets));
+        ddui::fill_color(ddui::rgb(0xffffff));
+        ddui::font_size(12.0);
+        ddui::text(scroll_area_state.scroll_x + 4, y + 14, progress_str, NULL);
+        y += FRAME_HEIGHT + Y_SPACING;
+    } else if (!file->loudness.blocks.empty()) {
+        y = draw_loudness(&file->loudness, time_from, time_to, second_width, y);
+    }
+
+    // Draw timestamp anomalies, on the same time axis as the stream rows
+    if (!file->anomalies.empty()) {
+        y = draw_anomalies(&file->anomalies, time_from, time_to, second_width, y, file->anomaly_selected);
+    }
+
+    // Draw mixed in-order packets
+    y = draw_packets(&packet_index.all_packets, time_from, time_to, second_width, y, pkt_highlighted, &next_pkt_hovering, &pkt_clicked);
+
+    if (pkt_clicked != -1) {
+        active_file = file;
+        touch_file(file);
+        file->pkt_requested = pkt_clicked;
+        PacketInfo pkt;
+        packet_index_get(&packet_index, pkt_clicked, &pkt);
+        if (pkt.type == PacketInfo::AUDIO) {
+            file->audio_pkt_requested = pkt_clicked;
+            ++file->audio_generation;
+            schedule_jobs(&file->audio_jobs, file, audio_work);
+        } else {
+            file->video_pkt_requested = pkt_clicked;
+            file->request_time = profiler_now_ns();
+            ++file->video_generation;
+            schedule_jobs(&file->video_jobs, file, video_work);
+        }
+    }
+
+    if (file->pkt_hovering != next_pkt_hovering) {
+        file->pkt_hovering = next_pkt_hovering;
+        if (next_pkt_hovering != -1) {
+            touch_file(file);
+        }
+        // Prefetch around the newly hovered packet
+        if (file->has_video) {
+            schedule_jobs(&file->video_jobs, file, video_work);
+        }
+        ddui::repaint(NULL);
+    }
+
+    return y + Y_SPACING;
+}
 
-    // Lookup the visible packet range to draw
-    int packet_from, packet_to;
+// Moves the packets the follow thread has read since the last frame into the
+// index. While the view is scrolled to the end it keeps following the end.
+void append_followed_packets(OpenFile* file, float second_width, float view_width) {
+    std::vector<std::unique_ptr<PacketBatch>> batches;
     {
-        PacketInfo pkt_lower_bound, pkt_upper_bound;
-        pkt_lower_bound.time_end = time_from;
-        pkt_upper_bound.time_start = time_to;
+        std::lock_guard<std::mutex> lock(file->follow_mutex);
+        batches.swap(file->follow_pending);
+    }
+    if (batches.empty()) {
+        return;
+    }
+
+    float old_end = std::max(0.0f, file->packet_index.duration * second_width - view_width);
+    bool at_end = scroll_area_state.scroll_x >= old_end - 1.0;
+
+    for (auto& batch : batches) {
+        packet_index_append(&file->packet_index, *batch);
+    }
+
+    // Rescanning is cheap but not free, so not for every new packet
+    if (profiler_now_ns() - file->anomalies_scanned_ns > 1000000000) {
+        scan_anomalies(file);
+    }
+
+    if (at_end) {
+        scroll_area_state.scroll_x = std::max(0.0f, file->packet_index.duration * second_width - view_width);
+    }
+    ddui::repaint(NULL);
+}
 
-        auto it_from = std::lower_bound(packets->begin(), packets->end(), pkt_lower_bound, cmp_pkt_end);
-        auto it_to   = std::upper_bound(it_from,          packets->end(), pkt_upper_bound, cmp_pkt_start);
+void scan_anomalies(OpenFile* file) {
+    file->anomalies = timestamp_anomalies_scan(&file->packet_index);
+    file->anomalies_scanned_ns = profiler_now_ns();
+    file->anomaly_selected = std::min(file->anomaly_selected, (int)file->anomalies.size() - 1);
+}
 
-        packet_from = it_from - packets->begin();
-        packet_to   = it_to   - packets->begin();
+// Selects the next or previous anomaly, from the selected one or else from
+// the middle of the view, and scrolls it into the middle
+void jump_to_anomaly(OpenFile* file, int direction, float second_width, float view_width) {
+    if (!file) {
+        return;
+    }
+    auto& anomalies = file->anomalies;
+    int i;
+    if (file->anomaly_selected != -1) {
+        i = file->anomaly_selected + direction;
+    } else {
+        float center = (scroll_area_state.scroll_x + view_width / 2) / second_width;
+        auto it = std::lower_bound(anomalies.begin(), anomalies.end(), center, [](const TimestampAnomaly& anomaly, float time) {
+            return anomaly.time < time;
+        });
+        i = (it - anomalies.begin()) + (direction < 0 ? -1 : 0);
+    }
+    if (i < 0 || i >= anomalies.size()) {
+        return;
     }
 
-    ddui::stroke_width(1.0);
-    for (int i = packet_from; i < packet_to; ++i) {
-        auto& pkt = (*packets)[i];
-        float pkt_x = pkt.time_start * second_width;
-        float pkt_w = pkt.time_end   * second_width - pkt_x;
-        float pkt_h = FRAME_HEIGHT;
+    file->anomaly_selected = i;
+    scroll_area_state.scroll_x = std::max(0.0f, anomalies[i].time * second_width - view_width / 2);
+    ddui::repaint(NULL);
+}
 
-        ddui::Color c;
-        switch (pkt.type) {
-            case PacketInfo::AUDIO:       c = ddui::rgb(0x33ff33); break;
-            case PacketInfo::VIDEO_KEY:   c = ddui::rgb(0x3388ff); break;
-            case PacketInfo::VIDEO_DELTA: c = ddui::rgb(0xff9922); break;
+// The worker keeps calling work until it has nothing left to do, then
+// checks whether it was scheduled again in the meantime
+void schedule_jobs(ReaderJobs* jobs, OpenFile* file, bool (*work)(OpenFile* file)) {
+    {
+        std::lock_guard<std::mutex> lock(jobs->mutex);
+        jobs->dirty = true;
+        if (jobs->scheduled) {
+            return;
         }
+        jobs->scheduled = true;
+    }
+    jobs->tasks.submit(&decode_pool, [jobs, file, work]() {
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock(jobs->mutex);
+                if (!jobs->dirty) {
+                    jobs->scheduled = false;
+                    return;
+                }
+                jobs->dirty = false;
+            }
+            while (work(file)) {}
+        }
+    });
+}
 
-        ddui::begin_path();
-        ddui::rect(pkt_x, y, pkt_w, FRAME_HEIGHT);
-        ddui::stroke_color(c);
-        ddui::stroke();
-        if (pkt.index == pkt_playing || (pkt_playing == -1 && pkt.index == pkt_hovering)) {
-            ddui::fill_color(c);
-            ddui::fill();
+void touch_file(OpenFile* file) {
+    file->last_used_ns = profiler_now_ns();
+    file->decoders_released = false;
+}
+
+// Picks up what the background threads of each file have finished, and
+// returns the width of the longest file on the timeline
+float update_files(float second_width, float view_width) {
+    float area_width = 0;
+    for (auto& file_ptr : files) {
+        auto file = file_ptr.get();
+        if (file->follow) {
+            append_followed_packets(file, second_width, view_width);
         }
-        if (ddui::mouse_over(pkt_x, y, pkt_w, pkt_h)) {
-            ddui::set_cursor(ddui::CURSOR_POINTING_HAND);
-            *next_pkt_hovering = pkt.index;
+        if (file->decode_cost_running && file->decode_cost_done) {
+            finish_decode_cost_pass(file);
         }
-        if (ddui::mouse_hit(pkt_x, y, pkt_w, pkt_h)) {
-            ddui::mouse_hit_accept();
-            pkt_requested = pkt.index;
+        if (file->scene_running && file->scene_done) {
+            finish_scene_analysis(file);
         }
+        if (file->loudness_running && file->loudness_done) {
+            finish_loudness_analysis(file);
+        }
+        if (file->export_running && file->export_done) {
+            finish_export(file);
+        }
+        area_width = std::max(area_width, (float)(file->packet_index.duration * second_width));
+    }
+    if (active_file) {
+        touch_file(active_file);
     }
+    release_idle_files();
+    return area_width;
+}
 
-    y += FRAME_HEIGHT + Y_SPACING;
+// Files left alone for a while give back their decoders and cached frames,
+// which hold most of their memory. The index, the analysis results and the
+// preview stay; decoders are opened again at the next click or hover.
+void release_idle_files() {
+    int64_t now = profiler_now_ns();
+    for (auto& file : files) {
+        if (file->decoders_released || now - file->last_used_ns < IDLE_RELEASE_NS ||
+            file->pkt_playing != -1 || file->pkt_decoding != -1) {
+            continue;
+        }
+        file->decoders_released = true;
+        if (file->has_video) {
+            file->release_video_decoders = true;
+            schedule_jobs(&file->video_jobs, file.get(), video_work);
+        }
+        if (file->has_audio) {
+            file->release_audio_decoders = true;
+            schedule_jobs(&file->audio_jobs, file.get(), audio_work);
+        }
+    }
+}
+
+static bool video_job_should_cancel(void* opaque) {
+    auto file = (OpenFile*)opaque;
+    if (file->should_close) {
+        return true;
+    }
+    // Superseded by a newer click on a video packet
+    if (file->video_generation != file->video_job_generation) {
+        return true;
+    }
+    // Speculative work for a packet that is no longer hovered
+    if (file->pkt_prefetching != -1) {
+        return file->pkt_hovering != file->pkt_prefetching;
+    }
+    return false;
+}
+
+static bool audio_job_should_cancel(void* opaque) {
+    auto file = (OpenFile*)opaque;
+    if (file->should_close) {
+        return true;
+    }
+    // Superseded by a newer click on an audio packet, of this file or another
+    if (file->audio_generation != file->audio_job_generation || audio_file != file) {
+        return true;
+    }
+    // Audio plays only while the mouse is held down
+    return file->pkt_requested == -1;
+}
+
+// The frame buffer is sized once the frame size is known, which for some
+// containers is only once the first frame has been decoded
+static bool ensure_frame_buffers(OpenFile* file) {
+    if (file->frame_buffer) {
+        return true;
+    }
+    auto& video_state = file->video_state;
+    if (video_state.width == 0) {
+        return false;
+    }
 
-    return y;
+    // Only the displayed frame is converted to RGB, straight to the size it
+    // is shown at
+    file->display_width = std::max(1, (int)(video_state.width * PREVIEW_SCALE));
+    file->display_height = std::max(1, (int)(video_state.height * PREVIEW_SCALE));
+    posix_memalign((void**)&file->frame_buffer, 128, (long)file->display_width * file->display_height * 4);
+
+    // Enough entries for the budget in 8 bit 4:2:0, the smallest common
+    // format, at this file's size. The cache only ever grows, so its
+    // capacity ends up fitting the smallest file opened so far.
+    long min_frame_bytes = (long)video_state.width * video_state.height * 3 / 2;
+    frame_cache.reserve(std::max(1L, FRAME_CACHE_BUDGET / min_frame_bytes));
+    return true;
 }
 
-void* decode_thread_func(void* ptr) {
+static void cache_frame(OpenFile* file, int pts, const AVFrame* frame) {
+    frame_cache.insert(file->id, pts, frame);
+    frame_cache_frames_per_gb = (int)frame_cache.frames_per_gb();
+    frame_cache_bytes = frame_cache.bytes;
+}
 
-    while (!should_close) {
+static bool prefetch_hovered_gop(OpenFile* file) {
+    int target = file->pkt_hovering;
+    if (target == -1 || target == file->pkt_prefetched || !file->frame_buffer) {
+        return false;
+    }
 
-        if (pkt_requested == -1) {
-            pkt_playing = -1;
-            timespec ts;
-            ts.tv_sec = 0;
-            ts.tv_nsec = 10000000;
-            nanosleep(&ts, NULL);
+    auto& video_state = file->video_state;
+    PacketInfo pkt;
+    if (!packet_index_get(&file->packet_index, target, &pkt) || pkt.type == PacketInfo::AUDIO || frame_cache.contains(file->id, pkt.pts)) {
+        file->pkt_prefetched = target;
+        return false;
+    }
+
+    int gop_end_pts = packet_index_gop_end_pts(&file->packet_index, target);
+
+    file->video_job_generation = file->video_generation;
+    file->pkt_prefetching = target;
+    packet_index_seek(&file->packet_index, &video_state, pkt);
+
+    // Decode from the keyframe through the hovered frame to the end of the GOP,
+    // keeping the later frames to at most half the cache so that they can't
+    // evict the hovered frame itself. Frames are cached as decoded, so
+    // prefetching costs no conversion.
+    bool reached_target = false;
+    int frames_after_target = 0;
+    int res, packet_pts, pts;
+    while ((res = video_reader_next_frame(&video_state, &packet_pts, &pts)) != RECEIVED_NONE) {
+        if (res == RECEIVED_CANCELLED) {
+            break;
+        }
+        if (res != RECEIVED_VIDEO) {
             continue;
         }
+        if (pts >= gop_end_pts) {
+            break;
+        }
+        if (!frame_cache.contains(file->id, pts)) {
+            if (video_state.export_side_data) {
+                side_data_overlay_add(&file->side_data_overlay, pts, video_state.video_frame);
+            }
+            cache_frame(file, pts, video_state.video_frame);
+        }
+        long frames_in_budget = frame_cache.budget / std::max(1L, FrameCache::frame_bytes(video_state.video_frame));
+        if (pts == pkt.pts) {
+            reached_target = true;
+        } else if (reached_target && ++frames_after_target >= frames_in_budget / 2) {
+            break;
+        }
+    }
 
-        auto& pkt = all_packets[pkt_requested];
-        video_reader_seek(&vr_state, pkt.type != PacketInfo::AUDIO, pkt.pts);
+    file->pkt_prefetching = -1;
+    file->pkt_prefetched = (res == RECEIVED_CANCELLED) ? -1 : target;
+    return true;
+}
 
-        if (pkt.type == PacketInfo::AUDIO) {
-            while (pkt_requested != -1) {
+static void show_frame(OpenFile* file, const AVFrame* frame, int64_t request_time) {
+    pixel_inspector_set_frame(&pixel_inspector, frame);
+    file->frame_shown_pts = (int)frame->pts;
+    video_reader_convert_frame(&file->video_state, frame, file->display_width, file->display_height, file->frame_buffer);
+    file->frame_buffer_request_time = request_time;
+    file->frame_buffer_filled = true;
+}
 
-                int res, packet_pts, pts;
-                while ((res = video_reader_next_frame(&vr_state, &packet_pts, &pts)) == RECEIVED_VIDEO) {}
+static void show_video_frame(OpenFile* file, const PacketInfo& pkt, int64_t request_time) {
+    auto& video_state = file->video_state;
 
-                if (res == RECEIVED_NONE) {
-                    pkt_playing = -1;
-                    pkt_requested = -1;
-                    break;
-                }
+    // Frames prefetched while hovering can be shown straight away, unless
+    // the overlay needs side data they were decoded without
+    if (frame_cache.find(file->id, pkt.pts, file->cached_frame) &&
+        (!video_state.export_side_data || side_data_overlay_has(&file->side_data_overlay, pkt.pts))) {
+        show_frame(file, file->cached_frame, request_time);
+        return;
+    }
 
-                auto it = std::find_if(all_packets.begin(), all_packets.end(), [&](PacketInfo& pkt) {
-                    return pkt.type == PacketInfo::AUDIO && pkt.pts == pts;
-                });
-                if (it != all_packets.end()) {
-                    pkt_playing = it - all_packets.begin();
-                }
+    packet_index_seek(&file->packet_index, &video_state, pkt);
 
-                int num_channels = vr_state.num_channels;
+    int res, packet_pts, pts;
+    while ((res = video_reader_next_frame(&video_state, &packet_pts, &pts)) != RECEIVED_NONE) {
+        if (res == RECEIVED_CANCELLED) {
+            return;
+        }
+        if (res != RECEIVED_VIDEO) {
+            continue;
+        }
 
-                int size_1, size_2;
-                float *buffer_1, *buffer_2;
-                rb.write_start(res * num_channels, &size_1, &buffer_1, &size_2, &buffer_2);
-                video_reader_transfer_audio_frame(&vr_state, size_1 / num_channels, buffer_1, size_2 / num_channels, buffer_2);
-                rb.write_end(res * num_channels);
+        // Find the packet we're looking at
+        int decoding = packet_index_find(&file->packet_index, true, packet_pts);
+        if (decoding != -1) {
+            file->pkt_decoding = decoding;
+        }
 
-            }
-        } else {
+        if (pts == pkt.pts) {
+            break;
+        }
+    }
 
-            int res, packet_pts, pts;
-            while ((res = video_reader_next_frame(&vr_state, &packet_pts, &pts)) != RECEIVED_NONE) {
-                if (res != RECEIVED_VIDEO) {
-                    continue;
-                }
+    if (res == RECEIVED_NONE || !ensure_frame_buffers(file)) {
+        return;
+    }
 
-                // Find the packet we're looking at
-                auto it = std::find_if(all_packets.begin(), all_packets.end(), [&](PacketInfo& pkt) {
-                    return pkt.type != PacketInfo::AUDIO && pkt.pts == packet_pts;
-                });
-                if (it != all_packets.end()) {
-                    pkt_playing = it - all_packets.begin();
-                }
+    if (video_state.export_side_data) {
+        side_data_overlay_add(&file->side_data_overlay, pts, video_state.video_frame);
+    }
+    cache_frame(file, pts, video_state.video_frame);
+    show_frame(file, video_state.video_frame, request_time);
+}
 
-                if (pts == pkt.pts) {
-                    break;
-                }
-            }
+// One video job on the decode pool: the latest click, or else prefetching
+// around the hovered packet. Returns false once there is nothing to do.
+bool video_work(OpenFile* file) {
+    PROFILE_SCOPE("video_work");
+    if (file->should_close) {
+        return false;
+    }
 
-            if (res == RECEIVED_NONE) {
-                pkt_playing = -1;
-                pkt_requested = -1;
-                break;
-            }
+    if (file->release_video_decoders.exchange(false)) {
+        video_reader_release_decoders(&file->video_state);
+        frame_cache.clear(file->id);
+        side_data_overlay_clear(&file->side_data_overlay);
+        file->pkt_prefetched = -1;
+    }
 
-            auto it = std::find_if(all_packets.begin(), all_packets.end(), [&](PacketInfo& pkt) {
-                return pkt.type != PacketInfo::AUDIO && pkt.pts == pts;
-            });
-            if (it != all_packets.end()) {
-                pkt_playing = it - all_packets.begin();
-            }
+    // Decoding with the side data export on is slower, so it's only on
+    // while the overlay is shown. Every job seeks to a keyframe first.
+    video_reader_set_export_side_data(&file->video_state, show_side_data);
 
-            video_reader_transfer_video_frame(&vr_state, frame_buffer);
-            frame_buffer_filled = true;
-            pkt_requested = -1;
-            pkt_playing = -1;
+    // Each click is tagged with a generation number, any newer click
+    // cancels it at the next packet boundary (see video_job_should_cancel)
+    int generation = file->video_generation;
+    if (generation == file->video_handled_generation) {
+        return prefetch_hovered_gop(file);
+    }
+
+    file->video_handled_generation = generation;
+    file->video_job_generation = generation;
+    int64_t job_request_time = file->request_time;
+
+    PacketInfo pkt;
+    if (packet_index_get(&file->packet_index, file->video_pkt_requested, &pkt)) {
+        show_video_frame(file, pkt, job_request_time);
+    }
+    file->pkt_decoding = -1;
+    return true;
+}
+
+// The audio output is shared by every file, and opened again for a file
+// with another sample rate or channel count. Call with audio_mutex held.
+// Returns true if it was (re)opened, which starts the ring buffer afresh.
+// If the device rejects the format, audio_client_opened is left false.
+static bool ensure_audio_client(int sample_rate, int num_channels) {
+    if (audio_client_opened && audio_client_sample_rate == sample_rate && audio_client_num_channels == num_channels) {
+        return false;
+    }
+    if (audio_client_opened) {
+        audio_client_close();
+        audio_client_opened = false;
+    }
+
+    // Samples left over are interleaved for the old channel count
+    rb.clear();
+    if (!audio_client_open(sample_rate, BUFFER_SIZE, num_channels, audio_callback)) {
+        return false;
+    }
+    audio_client_opened = true;
+    audio_client_sample_rate = sample_rate;
+    audio_client_num_channels = num_channels;
+
+    audio_underruns = 0;
+    decode_jitter_us = 0;
+    ring_buffer_floor = 0;
+    audio_buffer_filled = false;
+    rb.set_limit(RING_BUFFER_MIN_LIMIT);
+    return true;
+}
+
+// Sizes the ring buffer to the decode jitter seen so far: enough to ride out
+// the longest recent stall between two decoded audio frames, so fast files
+// play with little buffered latency while slow (e.g. network mounted) files
+// get more headroom. Any underrun doubles a floor under the limit, which
+// then decays over some seconds, so one bad stall isn't forgotten a frame later.
+static void adapt_ring_buffer_limit(int64_t stall_ns, int frame_samples, int* underruns_seen) {
+    int num_channels = audio_client_num_channels;
+
+    int jitter_us = (int)(stall_ns / 1000);
+    int decayed_us = decode_jitter_us * 31 / 32;
+    decode_jitter_us = jitter_us > decayed_us ? jitter_us : decayed_us;
+
+    int jitter_samples = (int)((int64_t)decode_jitter_us * audio_client_sample_rate / 1000000) * num_channels;
+    int limit = 2 * (jitter_samples + BUFFER_SIZE * num_channels) + frame_samples;
+
+    ring_buffer_floor -= ring_buffer_floor / 256;
+    int underruns = audio_underruns;
+    if (underruns != *underruns_seen) {
+        *underruns_seen = underruns;
+        ring_buffer_floor = std::min(std::max(ring_buffer_floor, rb.limit.load()) * 2, rb.buffer_size);
+    }
+    limit = std::max(limit, ring_buffer_floor);
+
+    rb.set_limit(std::min(std::max(limit, RING_BUFFER_MIN_LIMIT), rb.buffer_size));
+}
+
+static void play_audio(OpenFile* file, const PacketInfo& pkt) {
+    auto& audio_state = file->audio_state;
+
+    // A file that played before stops at its next packet (see
+    // audio_job_should_cancel), then hands over the ring buffer
+    std::lock_guard<std::mutex> lock(audio_mutex);
+    packet_index_seek(&file->packet_index, &audio_state, pkt);
+
+    audio_buffer_filled = false;
+    audio_streaming = true;
+    int underruns_seen = audio_underruns;
+    int64_t last_write_end = profiler_now_ns();
+
+    while (true) {
+
+        int res, packet_pts, pts;
+        while ((res = video_reader_next_frame(&audio_state, &packet_pts, &pts)) == RECEIVED_VIDEO) {}
+
+        if (res == RECEIVED_NONE || res == RECEIVED_CANCELLED) {
+            break;
+        }
+
+        // Files that don't store their sample rate and channels in the
+        // container only tell us with the first decoded frame
+        if (ensure_audio_client(audio_state.sample_rate, audio_state.num_channels)) {
+            underruns_seen = 0;
+        }
+        if (!audio_client_opened) {
+            printf("Couldn't open audio output for %s, not playing its audio\n", file->filename.c_str());
+            break;
+        }
+
+        adapt_ring_buffer_limit(profiler_now_ns() - last_write_end, res * audio_state.num_channels, &underruns_seen);
+
+        int playing = packet_index_find(&file->packet_index, false, pts);
+        if (playing != -1) {
+            file->pkt_playing = playing;
+        }
+
+        int num_channels = audio_state.num_channels;
+
+        int size_1, size_2;
+        float *buffer_1, *buffer_2;
+        rb.write_start(res * num_channels, &size_1, &buffer_1, &size_2, &buffer_2);
+        video_reader_transfer_audio_frame(&audio_state, size_1 / num_channels, buffer_1, size_2 / num_channels, buffer_2);
+        rb.write_end(res * num_channels);
+        last_write_end = profiler_now_ns();
+
+        // Underruns while the first frames trickle in are expected, not counted
+        if (!audio_buffer_filled && !rb.can_write(res * num_channels)) {
+            audio_buffer_filled = true;
         }
 
     }
 
-    return 0;
+    audio_streaming = false;
+}
+
+// One audio job on the decode pool: plays from the latest click for as long
+// as the mouse is held down
+bool audio_work(OpenFile* file) {
+    if (file->should_close) {
+        return false;
+    }
+
+    if (file->release_audio_decoders.exchange(false)) {
+        video_reader_release_decoders(&file->audio_state);
+    }
+
+    int generation = file->audio_generation;
+    if (generation == file->audio_handled_generation || file->pkt_requested == -1) {
+        return false;
+    }
+
+    file->audio_handled_generation = generation;
+    file->audio_job_generation = generation;
+    audio_file = file;
+
+    PacketInfo pkt;
+    if (packet_index_get(&file->packet_index, file->audio_pkt_requested, &pkt)) {
+        play_audio(file, pkt);
+    }
+    file->pkt_playing = -1;
+    return true;
 }
 
 void audio_callback(int num_samples, int num_channels, float* buffer) {
+    // Registering would lock and allocate on the real-time thread
+    profiler_use_thread(audio_profile_thread);
+    PROFILE_SCOPE("audio_callback");
+
     if (!rb.can_read(num_samples * num_channels)) {
+        if (audio_streaming && audio_buffer_filled) {
+            ++audio_underruns;
+        }
+
         // Write silence
         auto ptr = buffer;
         auto ptr_end = buffer + num_samples * num_channels;
@@ -336,97 +1138,634 @@ void audio_callback(int num_samples, int num_channels, float* buffer) {
     rb.read_end(num_samples * num_channels);
 }
 
-void open_file(const char* fname) {
+static bool follow_should_cancel(void* opaque) {
+    auto file = (OpenFile*)opaque;
+    return file->should_close;
+}
+
+// Reads packets as the file grows, until the file is closed. The UI thread
+// moves them into the index (see append_followed_packets). This stays a
+// thread of its own rather than a job on the decode pool, since it spends
+// most of its time waiting for the file to grow.
+void* follow_thread_func(void* ptr) {
+    profiler_set_thread_name("follow");
+
+    auto file = (OpenFile*)ptr;
+    while (true) {
+        std::unique_ptr<PacketBatch> batch(new PacketBatch);
+        if (video_reader_read_packets(&file->follow_state, batch.get()) == 0) {
+            break;
+        }
+        std::lock_guard<std::mutex> lock(file->follow_mutex);
+        file->follow_pending.push_back(std::move(batch));
+    }
+
+    return 0;
+}
+
+void* decode_cost_thread_func(void* ptr) {
+    profiler_set_thread_name("decode cost");
+
+    auto file = (OpenFile*)ptr;
+    decode_cost_measure(file->filename.c_str(), &file->packet_index, thread_pool_shared(), &file->decode_cost_cancel, &file->decode_cost_packets, &file->decode_costs);
 
-    should_close = false;
-    pkt_requested = -1;
-    pkt_playing = -1;
-    pkt_hovering = -1;
-    frame_buffer_filled = false;
+    file->decode_cost_done = true;
+    return 0;
+}
 
-    video_reader_open(&vr_state, fname);
-    if (vr_state.video_stream_index != -1) {
-        posix_memalign((void**)&frame_buffer, 128, vr_state.width * vr_state.height * 4);
-        image_id = ddui::create_image_from_rgba(vr_state.width, vr_state.height, 0, frame_buffer);
+// Times the decoding of every video packet in the background. The UI thread
+// picks up the results in finish_decode_cost_pass.
+void start_decode_cost_pass(OpenFile* file) {
+    if (!file || !file->has_video || file->decode_cost_running) {
+        return;
     }
+    file->decode_cost_running = true;
+    file->decode_cost_cancel = false;
+    file->decode_cost_done = false;
+    file->decode_cost_packets = 0;
+    file->decode_costs.clear();
+    pthread_create(&file->decode_cost_thread, NULL, decode_cost_thread_func, file);
+}
 
-    if (vr_state.audio_stream_index != -1) {
-        audio_client_open(vr_state.sample_rate, BUFFER_SIZE, vr_state.num_channels, audio_callback);
+void finish_decode_cost_pass(OpenFile* file) {
+    pthread_join(file->decode_cost_thread, NULL);
+    file->decode_cost_running = false;
+    if (file->decode_cost_cancel) {
+        return;
     }
 
-    // Parse all packets
-    duration = 0.0;
-    video_reader_read_all_packets(&vr_state, [](bool is_video, bool is_keyframe, int pts, int dts, int dur) {
-        auto time_base = is_video ? vr_state.video_time_base : vr_state.audio_time_base;
+    auto& decode_costs = file->decode_costs;
+    packet_index_set_decode_costs(&file->packet_index, decode_costs);
 
-        PacketInfo pkt;
-        pkt.type = is_video ? is_keyframe ? PacketInfo::VIDEO_KEY : PacketInfo::VIDEO_DELTA : PacketInfo::AUDIO;
-        pkt.index = all_packets.size();
-        pkt.pts = pts;
-        pkt.dts = dts;
-        pkt.duration = dur * (time_base.num / (float)time_base.den);
-
-        if (is_video) {
-            PacketInfo pkt_video = pkt;
-            pkt_video.time_start = pts * (time_base.num / (float)time_base.den);
-            pkt_video.time_end   = (pts + dur) * (time_base.num / (float)time_base.den);
-            video_packets.push_back(pkt_video);
-        } else {
-            PacketInfo pkt_audio = pkt;
-            pkt_audio.time_start = pts * (time_base.num / (float)time_base.den);
-            pkt_audio.time_end   = (pts + dur) * (time_base.num / (float)time_base.den);
-            audio_packets.push_back(pkt_audio);
+    // Scale the heatmap to the 99th percentile, so one outlier doesn't
+    // wash out the rest
+    std::vector<float> times;
+    times.reserve(decode_costs.size());
+    for (auto& cost : decode_costs) {
+        times.push_back(cost.second);
+    }
+    file->decode_cost_scale_ms = 0;
+    if (!times.empty()) {
+        auto p99 = times.begin() + (times.size() - 1) * 99 / 100;
+        std::nth_element(times.begin(), p99, times.end());
+        file->decode_cost_scale_ms = *p99;
+    }
+    decode_costs.clear();
+    file->show_decode_costs = true;
+    ddui::repaint(NULL);
+}
+
+void* scene_thread_func(void* ptr) {
+    profiler_set_thread_name("scene analysis");
+
+    auto file = (OpenFile*)ptr;
+    scene_analysis_run(file->filename.c_str(), &file->packet_index, thread_pool_shared(), &file->scene_cancel, &file->scene_frames_done, &file->scene_frames_pending);
+
+    file->scene_done = true;
+    return 0;
+}
+
+// Finds cuts, black and frozen frames in the background. The UI thread
+// picks up the results in finish_scene_analysis.
+void start_scene_analysis(OpenFile* file) {
+    if (!file || !file->has_video || file->scene_running) {
+        return;
+    }
+    file->scene_running = true;
+    file->scene_cancel = false;
+    file->scene_done = false;
+    file->scene_frames_done = 0;
+    file->scene_frames_pending.clear();
+    pthread_create(&file->scene_thread, NULL, scene_thread_func, file);
+}
+
+void finish_scene_analysis(OpenFile* file) {
+    pthread_join(file->scene_thread, NULL);
+    file->scene_running = false;
+    if (!file->scene_cancel) {
+        file->scene_frames.swap(file->scene_frames_pending);
+    }
+    file->scene_frames_pending.clear();
+    ddui::repaint(NULL);
+}
+
+void* loudness_thread_func(void* ptr) {
+    profiler_set_thread_name("loudness");
+
+    auto file = (OpenFile*)ptr;
+    loudness_analyze(file->filename.c_str(), &file->loudness_cancel, &file->loudness_frames_done, &file->loudness_pending);
+
+    file->loudness_done = true;
+    return 0;
+}
+
+// Measures loudness and true peak over the whole audio stream in the
+// background. The UI thread picks up the results in finish_loudness_analysis.
+void start_loudness_analysis(OpenFile* file) {
+    if (!file || !file->has_audio || file->loudness_running) {
+        return;
+    }
+    file->loudness_running = true;
+    file->loudness_cancel = false;
+    file->loudness_done = false;
+    file->loudness_frames_done = 0;
+    file->loudness_pending.blocks.clear();
+    pthread_create(&file->loudness_thread, NULL, loudness_thread_func, file);
+}
+
+void finish_loudness_analysis(OpenFile* file) {
+    pthread_join(file->loudness_thread, NULL);
+    file->loudness_running = false;
+    if (!file->loudness_cancel) {
+        std::swap(file->loudness, file->loudness_pending);
+    }
+    file->loudness_pending.blocks.clear();
+    ddui::repaint(NULL);
+}
+
+struct ExportJob {
+    OpenFile* file;
+    PacketInfo first;
+    PacketInfo last;
+    ExportFormat format;
+};
+
+void* export_thread_func(void* ptr) {
+    profiler_set_thread_name("export");
+
+    auto job = (ExportJob*)ptr;
+    auto file = job->file;
+    file->export_success = frame_export_run(file->filename.c_str(), &file->packet_index, job->first, job->last, job->format,
+                                            thread_pool_shared(), &file->export_cancel, &file->export_frames_done, &file->export_path);
+    delete job;
+
+    file->export_done = true;
+    return 0;
+}
+
+// Exports the selected frames in the background. Asking again while an
+// export runs cancels it.
+void start_export(OpenFile* file, ExportFormat format) {
+    if (!file) {
+        return;
+    }
+    if (file->export_running) {
+        file->export_cancel = true;
+        return;
+    }
+    auto job = new ExportJob;
+    if (!file->has_video ||
+        !packet_index_get(&file->packet_index, file->export_from, &job->first) ||
+        !packet_index_get(&file->packet_index, file->export_to, &job->last)) {
+        printf("Select the frames to export with 'b' and 'e' first\n");
+        delete job;
+        return;
+    }
+    if (job->first.pts > job->last.pts) {
+        std::swap(job->first, job->last);
+    }
+    job->file = file;
+    job->format = format;
+
+    // Frames in the selection, for progress
+    {
+        std::lock_guard<std::mutex> lock(file->packet_index.mutex);
+        auto& packets = file->packet_index.video_packets;
+        auto it_from = std::lower_bound(packets.begin(), packets.end(), job->first.pts, [](const PacketInfo& pkt, int pts) {
+            return pkt.pts < pts;
+        });
+        auto it_to = std::upper_bound(it_from, packets.end(), job->last.pts, [](int pts, const PacketInfo& pkt) {
+            return pts < pkt.pts;
+        });
+        file->export_frames_total = it_to - it_from;
+    }
+
+    file->export_running = true;
+    file->export_cancel = false;
+    file->export_done = false;
+    file->export_success = false;
+    file->export_frames_done = 0;
+    file->export_path.clear();
+    pthread_create(&file->export_thread, NULL, export_thread_func, job);
+}
+
+void finish_export(OpenFile* file) {
+    pthread_join(file->export_thread, NULL);
+    file->export_running = false;
+    if (file->export_cancel) {
+        printf("Export cancelled\n");
+    } else if (file->export_success) {
+        printf("Exported %d frames to %s\n", (int)file->export_frames_done, file->export_path.c_str());
+    } else {
+        printf("Export failed\n");
+    }
+    ddui::repaint(NULL);
+}
+
+// Opens every reader the file needs on the shared source, or none of them
+static bool open_readers(OpenFile* file, MediaSource* media_source, bool follow) {
+    if (!video_reader_open_source(&file->video_state, media_source)) {
+        return false;
+    }
+    file->has_video = file->video_state.video_stream_index != -1;
+    file->has_audio = file->video_state.audio_stream_index != -1;
+
+    if (follow && !video_reader_open_source(&file->follow_state, media_source)) {
+        video_reader_close(&file->video_state);
+        return false;
+    }
+    if (file->has_audio && !video_reader_open_source(&file->audio_state, media_source)) {
+        if (follow) {
+            video_reader_close(&file->follow_state);
+        }
+        video_reader_close(&file->video_state);
+        return false;
+    }
+    return true;
+}
+
+// Opens the file below the ones already open. Returns NULL if it can't be read.
+OpenFile* open_file(const char* fname, bool follow) {
+
+    // Every reader of the file shares the one open source
+    auto media_source = media_source_open(fname);
+    if (!media_source) {
+        return NULL;
+    }
+
+    // Value-initialised, so everything starts out zero
+    auto file = new OpenFile();
+    if (!open_readers(file, media_source, follow)) {
+        media_source_release(media_source);
+        delete file;
+        return NULL;
+    }
+    files.emplace_back(file);
+    file->id = ++next_file_id;
+    file->filename = fname;
+    file->media_source = media_source;
+    file->follow = follow;
+
+    file->pkt_requested = -1;
+    file->video_pkt_requested = -1;
+    file->audio_pkt_requested = -1;
+    file->pkt_playing = -1;
+    file->pkt_decoding = -1;
+    file->pkt_hovering = -1;
+    file->pkt_prefetched = -1;
+    file->pkt_prefetching = -1;
+    file->image_id = -1;
+    file->cached_frame = av_frame_alloc();
+    file->export_from = -1;
+    file->export_to = -1;
+    file->anomaly_selected = -1;
+    SideDataOverlay::init(&file->side_data_overlay);
+    touch_file(file);
+
+    if (follow) {
+        // Index in the background, starting with what has been written so far
+        file->follow_state.follow = true;
+        file->follow_state.should_cancel = follow_should_cancel;
+        file->follow_state.should_cancel_opaque = file;
+        packet_index_init(&file->packet_index, &file->follow_state);
+        pthread_create(&file->follow_thread, NULL, follow_thread_func, file);
+    } else {
+        packet_index_build(&file->packet_index, &file->video_state);
+    }
+    scan_anomalies(file);
+
+    if (file->has_video) {
+        video_reader_select_streams(&file->video_state, true, false);
+        file->video_state.should_cancel = video_job_should_cancel;
+        file->video_state.should_cancel_opaque = file;
+        ensure_frame_buffers(file);
+    }
+
+    if (file->has_audio) {
+        auto& audio_state = file->audio_state;
+        video_reader_select_streams(&audio_state, false, true);
+        audio_state.should_cancel = audio_job_should_cancel;
+        audio_state.should_cancel_opaque = file;
+
+        // Open the output ahead of the first click, unless another file has it
+        if (audio_state.sample_rate != 0 && audio_state.num_channels != 0) {
+            std::lock_guard<std::mutex> lock(audio_mutex);
+            if (!audio_client_opened) {
+                ensure_audio_client(audio_state.sample_rate, audio_state.num_channels);
+            }
+        }
+    }
+
+    return file;
+}
+
+// Opens the file again in its place, e.g. to start or stop following it
+OpenFile* reopen_file(OpenFile* file, bool follow) {
+    auto fname = file->filename;
+    int position = 0;
+    while (files[position].get() != file) {
+        ++position;
+    }
+    close_file(file);
+
+    auto reopened = open_file(fname.c_str(), follow);
+    if (reopened) {
+        std::rotate(files.begin() + position, files.end() - 1, files.end());
+    }
+    return reopened ? reopened : active_file;
+}
+
+void close_file(OpenFile* file) {
+    file->should_close = true;
+    if (file->decode_cost_running) {
+        file->decode_cost_cancel = true;
+        finish_decode_cost_pass(file);
+    }
+    if (file->scene_running) {
+        file->scene_cancel = true;
+        finish_scene_analysis(file);
+    }
+    if (file->loudness_running) {
+        file->loudness_cancel = true;
+        finish_loudness_analysis(file);
+    }
+    if (file->export_running) {
+        file->export_cancel = true;
+        finish_export(file);
+    }
+    if (file->follow) {
+        pthread_join(file->follow_thread, NULL);
+        video_reader_close(&file->follow_state);
+        file->follow_pending.clear();
+    }
+
+    // Jobs on the decode pool stop at their next packet
+    file->video_jobs.tasks.wait();
+    file->audio_jobs.tasks.wait();
+    if (audio_file == file) {
+        audio_file = NULL;
+    }
+
+    if (file->has_audio) {
+        video_reader_close(&file->audio_state);
+    }
+    if (file->has_video) {
+        free(file->frame_buffer);
+        file->frame_buffer = NULL;
+        if (file->image_id != -1) {
+            ddui::delete_image(file->image_id);
+            file->image_id = -1;
         }
+    }
+    frame_cache.clear(file->id);
+    av_frame_free(&file->cached_frame);
+    SideDataOverlay::destroy(&file->side_data_overlay);
+
+    video_reader_close(&file->video_state);
+    media_source_release(file->media_source);
+    packet_index_clear(&file->packet_index);
 
-        all_packets.push_back(pkt);
-        duration += pkt.duration;
+    // Keys go to the file below, or else the one above
+    auto it = std::find_if(files.begin(), files.end(), [&](const std::unique_ptr<OpenFile>& open) {
+        return open.get() == file;
     });
+    it = files.erase(it);
+    if (active_file == file) {
+        active_file = it != files.end() ? it->get() : files.empty() ? NULL : files.back().get();
+    }
+}
+
+void draw_audio_stats(float x, float bottom) {
+
+    AudioClientStats stats;
+    audio_client_get_stats(&stats);
+
+    ddui::font_face("mono");
+    ddui::font_size(12.0);
+    float asc, desc, lineh;
+    ddui::text_metrics(&asc, &desc, &lineh);
+
+    char lines[5][64];
+    double samples_per_ms = std::max(1.0, audio_client_sample_rate * audio_client_num_channels / 1000.0);
+    sprintf(lines[0], "ring underruns    %d", (int)audio_underruns);
+    sprintf(lines[1], "device under/over %d / %d", stats.output_underflows, stats.output_overflows);
+    sprintf(lines[2], "callback jitter   %.2fms", stats.callback_jitter_ms);
+    sprintf(lines[3], "decode jitter     %.2fms", decode_jitter_us / 1000.0);
+    sprintf(lines[4], "ring limit        %.0fms (+%.0fms output)", rb.limit / samples_per_ms, stats.output_latency_ms);
+
+    float h = 16 + 5 * lineh;
+    float y = bottom - h;
 
-    int num_streams = audio_packets.empty() || video_packets.empty() ? 1 : 2;
-    duration = duration / num_streams;
-    float time = 0.0;
-    for (int i = 0; i < all_packets.size(); ++i) {
-        auto& pkt = all_packets[i];
-        pkt.time_start = time;
-        time += pkt.duration / num_streams;
-        pkt.time_end   = time;
+    auto background = ddui::rgb(0x000000);
+    background.a = 0.7;
+
+    ddui::begin_path();
+    ddui::fill_color(background);
+    ddui::rect(x, y, AUDIO_STATS_WIDTH, h);
+    ddui::fill();
+
+    ddui::fill_color(ddui::rgb(0xffffff));
+    for (int i = 0; i < 5; ++i) {
+        ddui::text(x + 8, y + 8 + i * lineh + asc, lines[i], NULL);
     }
+}
+
+void draw_profile_overlay(float x, float y) {
 
-    std::sort(video_packets.begin(), video_packets.end(), cmp_pkt_start);
-    std::sort(audio_packets.begin(), audio_packets.end(), cmp_pkt_start);
-    
-    pthread_create(&decode_thread, NULL, decode_thread_func, NULL);
+    // Percentiles are recomputed a few times a second, not every frame
+    static std::vector<ProfileStats> stats;
+    static int64_t stats_time = 0;
+    auto now = profiler_now_ns();
+    if (now - stats_time > 250000000) {
+        profiler_collect_stats(PROFILE_WINDOW_MS, &stats);
+        stats_time = now;
+    }
+
+    ddui::font_face("mono");
+    ddui::font_size(12.0);
+    float asc, desc, lineh;
+    ddui::text_metrics(&asc, &desc, &lineh);
+
+    auto background = ddui::rgb(0x000000);
+    background.a = 0.7;
+
+    ddui::begin_path();
+    ddui::fill_color(background);
+    ddui::rect(x, y, PROFILE_WIDTH, 16 + (stats.size() + 2) * lineh);
+    ddui::fill();
+
+    char str[128];
+    ddui::fill_color(ddui::rgb(0xaaaaaa));
+    sprintf(str, "%-22s %6s %7s %7s %7s", "scope (2s, ms)", "count", "p50", "p95", "p99");
+    ddui::text(x + 8, y + 8 + asc, str, NULL);
+
+    ddui::fill_color(ddui::rgb(0xffffff));
+    for (int i = 0; i < stats.size(); ++i) {
+        auto& s = stats[i];
+        sprintf(str, "%-22s %6d %7.3f %7.3f %7.3f", s.name, s.count, s.p50_ms, s.p95_ms, s.p99_ms);
+        ddui::text(x + 8, y + 8 + (i + 1) * lineh + asc, str, NULL);
+    }
+
+    ddui::fill_color(ddui::rgb(0xaaaaaa));
+    sprintf(str, "frame cache %.0f/%.0fMB, %d frames/GB, %zu files", frame_cache_bytes / (1024.0 * 1024.0),
+            FRAME_CACHE_BUDGET / (1024.0 * 1024.0), (int)frame_cache_frames_per_gb, files.size());
+    ddui::text(x + 8, y + 8 + (stats.size() + 1) * lineh + asc, str, NULL);
 }
 
-void close_file() {
-    should_close = true;
-    pthread_join(decode_thread, NULL);
-    
-    if (vr_state.audio_stream_index != -1) {
-        audio_client_close();
+void draw_click_latency(float x, float y) {
+
+    auto background = ddui::rgb(0x000000);
+    background.a = 0.7;
+
+    ddui::begin_path();
+    ddui::fill_color(background);
+    ddui::rect(x, y, LATENCY_WIDTH, LATENCY_HEIGHT);
+    ddui::fill();
+
+    ddui::font_face("mono");
+    ddui::font_size(12.0);
+    float asc, desc, lineh;
+    ddui::text_metrics(&asc, &desc, &lineh);
+
+    char str[64];
+    ddui::fill_color(ddui::rgb(0xffffff));
+    sprintf(str, "click to frame: %d shown", click_latency.total);
+    ddui::text(x + 8, y + 8 + asc, str, NULL);
+    sprintf(str, "p50 <%.0fms p95 <%.0fms max %.0fms",
+            click_latency.percentile(50),
+            click_latency.percentile(95),
+            click_latency.max_ms);
+    ddui::text(x + 8, y + 8 + lineh + asc, str, NULL);
+
+    // One bar per bucket, scaled to the fullest bucket
+    int max_count = 1;
+    for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+        max_count = std::max(max_count, click_latency.counts[i]);
+    }
+    float bars_y = y + 16 + 2 * lineh;
+    float bars_h = LATENCY_HEIGHT - (bars_y - y) - 8 - lineh;
+    float bar_w = (LATENCY_WIDTH - 16) / LatencyHistogram::NUM_BUCKETS;
+    ddui::begin_path();
+    ddui::fill_color(ddui::rgb(0x3388ff));
+    for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; ++i) {
+        float h = bars_h * click_latency.counts[i] / max_count;
+        ddui::rect(x + 8 + i * bar_w, bars_y + bars_h - h, bar_w - 2, h);
     }
-    if (vr_state.video_stream_index != -1) {
-        free(frame_buffer);
-        frame_buffer_filled = false;
-        frame_buffer = NULL;
-        ddui::delete_image(image_id);
-        image_id = -1;
+    ddui::fill();
+
+    ddui::fill_color(ddui::rgb(0xaaaaaa));
+    for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; i += 2) {
+        sprintf(str, "%.0f", LatencyHistogram::bucket_upper_bound(i));
+        ddui::text(x + 8 + i * bar_w, bars_y + bars_h + asc + 2, str, NULL);
+    }
+}
+
+// Headless: indexes the file and hashes every decoded frame
+static bool hash_file(const char* fname, PacketIndex* index, FileHashes* hashes) {
+    VideoReaderState state;
+    if (!video_reader_open(&state, fname)) {
+        return false;
     }
+    packet_index_build(index, &state);
+    video_reader_close(&state);
 
-    video_reader_close(&vr_state);
+    auto start = profiler_now_ns();
+    if (!frame_hash_file(fname, index, thread_pool_shared(), NULL, hashes)) {
+        printf("Failed to hash %s\n", fname);
+        return false;
+    }
+    double seconds = (profiler_now_ns() - start) / 1e9;
+    fprintf(stderr, "Hashed %s in %.2fs (%.1fx real time)\n", fname, seconds, index->duration / seconds);
 
-    should_close = false;
-    pkt_requested = -1;
-    pkt_playing = -1;
-    pkt_hovering = -1;
-    
+    packet_index_set_content_hashes(index, *hashes);
+    return true;
+}
 
-    video_packets.clear();
-    audio_packets.clear();
-    all_packets.clear();
+// Prints the hash of every frame in presentation order
+static int run_hash(const char* fname) {
+    PacketIndex index;
+    FileHashes hashes;
+    if (!hash_file(fname, &index, &hashes)) {
+        return 1;
+    }
+    for (auto& pkt : index.video_packets) {
+        printf("video %d %016llx\n", pkt.pts, (unsigned long long)pkt.content_hash);
+    }
+    for (auto& pkt : index.audio_packets) {
+        printf("audio %d %016llx\n", pkt.pts, (unsigned long long)pkt.content_hash);
+    }
+    return 0;
+}
+
+// Compares the decoded frames of two files, e.g. a source and its
+// transcode, and prints the frames that differ. Exits with 0 only if every
+// frame matches bit for bit.
+static int run_diff(const char* fname_a, const char* fname_b) {
+    PacketIndex index_a, index_b;
+    FileHashes hashes_a, hashes_b;
+    if (!hash_file(fname_a, &index_a, &hashes_a) || !hash_file(fname_b, &index_b, &hashes_b)) {
+        return 2;
+    }
+
+    auto mismatches = frame_hash_diff(hashes_a, hashes_b);
+    for (auto& mismatch : mismatches) {
+        char planes[32] = "";
+        for (int p = 0; p < 4; ++p) {
+            if (mismatch.planes & (1 << p)) {
+                snprintf(planes + strlen(planes), sizeof(planes) - strlen(planes), " %d", p);
+            }
+        }
+        if (mismatch.pts_a == INT_MIN || mismatch.pts_b == INT_MIN) {
+            printf("%s frame %d: only in %s\n", mismatch.is_video ? "video" : "audio", mismatch.frame,
+                   mismatch.pts_a == INT_MIN ? fname_b : fname_a);
+        } else {
+            printf("%s frame %d (pts %d / %d): planes%s differ\n", mismatch.is_video ? "video" : "audio", mismatch.frame,
+                   mismatch.pts_a, mismatch.pts_b, planes);
+        }
+    }
+    printf("%zu frames differ, out of %zu video and %zu audio frames\n", mismatches.size(),
+           std::max(hashes_a.video.size(), hashes_b.video.size()),
+           std::max(hashes_a.audio.size(), hashes_b.audio.size()));
+
+    return mismatches.empty() ? 0 : 1;
+}
+
+// Prints the loudness figures of the audio stream (EBU R128)
+static int run_loudness(const char* fname) {
+    LoudnessResult result;
+    auto start = profiler_now_ns();
+    if (!loudness_analyze(fname, NULL, NULL, &result)) {
+        printf("Failed to measure the loudness of %s\n", fname);
+        return 1;
+    }
+    double seconds = (profiler_now_ns() - start) / 1e9;
+    fprintf(stderr, "Measured %s in %.2fs (%.1fx real time)\n", fname, seconds, result.duration / seconds);
+
+    printf("Integrated loudness: %.1f LUFS\n", result.integrated);
+    printf("Loudness range:      %.1f LU\n", result.range);
+    printf("True peak:           %.1f dBTP\n", result.true_peak);
+    printf("Sample peak:         %.1f dBFS\n", result.sample_peak);
+    printf("Max momentary:       %.1f LUFS\n", result.max_momentary);
+    printf("Max short-term:      %.1f LUFS\n", result.max_short_term);
+    return 0;
 }
 
 int main(int argc, const char** argv) {
+    first_paint_start_ns = profiler_now_ns();
+
+    // Headless modes, which don't need a window:
+    //   VideoInspect --hash file
+    //   VideoInspect --diff file_a file_b
+    //   VideoInspect --loudness file
+    if (argc == 3 && strcmp(argv[1], "--hash") == 0) {
+        return run_hash(argv[2]);
+    }
+    if (argc == 4 && strcmp(argv[1], "--diff") == 0) {
+        return run_diff(argv[2], argv[3]);
+    }
+    if (argc == 3 && strcmp(argv[1], "--loudness") == 0) {
+        return run_loudness(argv[2]);
+    }
 
     // ddui (graphics and UI system)
     if (!ddui::app_init(700, 600, "Video Inspector", update)) {
@@ -434,21 +1773,62 @@ int main(int argc, const char** argv) {
         return 1;
     }
 
+    profiler_set_thread_name("ui");
+    audio_profile_thread = profiler_reserve_thread("audio");
+
     // Type faces
     ddui::create_font("mono", "PTMono.ttf");
 
     RingBuffer::init(&rb, RING_BUFFER_SIZE);
-    
+    PixelInspector::init(&pixel_inspector);
+
+    // Shared by every open file; the cache grows its entries as files open
+    ThreadPool::init(&decode_pool, DECODE_POOL_THREADS);
+    FrameCache::init(&frame_cache, FRAME_CACHE_BUDGET, 0);
+
     audio_client_init();
 
-    // Open our video file
-    auto fname = get_content_filename("demo.mp4");
-    open_file(fname.c_str());
+    // Open our video files, stacked to compare them, or follow them while
+    // they are still being written, e.g. by a live capture:
+    //   VideoInspect [--follow] [--probesize bytes] [--analyzeduration us] [files or http:// URLs]
+    std::vector<std::string> fnames;
+    bool follow = false;
+    auto probe_limits = PROBE_LIMITS_FAST;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--follow") == 0) {
+            follow = true;
+        } else if (strcmp(argv[i], "--probesize") == 0 && i + 1 < argc) {
+            probe_limits.probe_size = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--analyzeduration") == 0 && i + 1 < argc) {
+            probe_limits.analyze_duration = atoll(argv[++i]);
+        } else {
+            fnames.push_back(argv[i]);
+        }
+    }
+    if (fnames.empty()) {
+        fnames.push_back(get_content_filename("demo.mp4"));
+    }
+    video_reader_set_probe_limits(probe_limits);
+    for (auto& fname : fnames) {
+        auto file = open_file(fname.c_str(), follow);
+        if (file && !active_file) {
+            active_file = file;
+        }
+    }
 
     ddui::app_run();
 
-    close_file();
+    while (!files.empty()) {
+        close_file(files.back().get());
+    }
+    if (audio_client_opened) {
+        audio_client_close();
+        audio_client_opened = false;
+    }
     audio_client_destroy();
+    ThreadPool::destroy(&decode_pool);
+    FrameCache::destroy(&frame_cache);
+    PixelInspector::destroy(&pixel_inspector);
     RingBuffer::destroy(&rb);
 
     return 0;
@@ -0,0 +1,116 @@
+#include "media_source.hpp"
+#include "http_source.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+struct FileSource {
+    int fd;
+    int inotify_fd; // -1 until a reader first waits for the file to grow
+};
+
+static int file_read_at(MediaSource* source, int64_t offset, uint8_t* buffer, int size) {
+    auto file = (FileSource*)source->opaque;
+    ssize_t bytes;
+    do {
+        bytes = pread(file->fd, buffer, size, offset);
+    } while (bytes < 0 && errno == EINTR);
+    return (int)bytes;
+}
+
+static int64_t file_get_size(MediaSource* source) {
+    auto file = (FileSource*)source->opaque;
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) {
+        return -1;
+    }
+    return st.st_size;
+}
+
+static bool file_wait_for_data(MediaSource* source, int64_t size, int timeout_ms) {
+    auto file = (FileSource*)source->opaque;
+    if (file_get_size(source) > size) {
+        return true;
+    }
+
+#ifdef __linux__
+    // Sleep until the writer modifies the file
+    if (file->inotify_fd == -1) {
+        file->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (file->inotify_fd != -1 && inotify_add_watch(file->inotify_fd, source->filename.c_str(), IN_MODIFY) < 0) {
+            close(file->inotify_fd);
+            file->inotify_fd = -2;
+        }
+    }
+    if (file->inotify_fd >= 0) {
+        pollfd pfd = { file->inotify_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout_ms) > 0) {
+            char events[4096];
+            while (read(file->inotify_fd, events, sizeof(events)) > 0) {}
+        }
+        return file_get_size(source) > size;
+    }
+#endif
+
+    // No file notifications, poll the size instead
+    poll(NULL, 0, timeout_ms);
+    return file_get_size(source) > size;
+}
+
+static void file_destroy(MediaSource* source) {
+    auto file = (FileSource*)source->opaque;
+    if (file->inotify_fd >= 0) {
+        close(file->inotify_fd);
+    }
+    close(file->fd);
+    delete file;
+}
+
+MediaSource* media_source_open_file(const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Couldn't open %s\n", filename);
+        return NULL;
+    }
+
+    auto file = new FileSource;
+    file->fd = fd;
+    file->inotify_fd = -1;
+
+    auto source = new MediaSource;
+    source->filename = filename;
+    source->ref_count = 1;
+    source->read_at = file_read_at;
+    source->get_size = file_get_size;
+    source->wait_for_data = file_wait_for_data;
+    source->destroy = file_destroy;
+    source->opaque = file;
+    return source;
+}
+
+MediaSource* media_source_open(const char* filename) {
+    if (strncmp(filename, "http://", 7) == 0) {
+        return media_source_open_http(filename, NULL);
+    }
+    return media_source_open_file(filename);
+}
+
+MediaSource* media_source_retain(MediaSource* source) {
+    ++source->ref_count;
+    return source;
+}
+
+void media_source_release(MediaSource* source) {
+    if (--source->ref_count == 0) {
+        source->destroy(source);
+        delete source;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef media_source_hpp
+#define media_source_hpp
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+// A seekable byte source shared by any number of readers. Reads are
+// positioned, so readers never disturb each other, and each reader keeps its
+// own position in its AVIOContext.
+struct MediaSource {
+    std::string filename;
+    std::atomic_int ref_count;
+
+    // Backend, called from any thread
+    int (*read_at)(MediaSource* source, int64_t offset, uint8_t* buffer, int size);
+    int64_t (*get_size)(MediaSource* source);
+    // Waits up to timeout_ms for the source to grow past size, returns
+    // whether it has. Only used by one reader at a time.
+    bool (*wait_for_data)(MediaSource* source, int64_t size, int timeout_ms);
+    void (*destroy)(MediaSource* source);
+    void* opaque;
+};
+
+// Opens a local file. All readers share its single file descriptor.
+MediaSource* media_source_open_file(const char* filename);
+
+// Opens an http:// URL (see http_source.hpp) or else a local file
+MediaSource* media_source_open(const char* filename);
+
+MediaSource* media_source_retain(MediaSource* source);
+void media_source_release(MediaSource* source);
+
+#endif
@@ -0,0 +1,224 @@
+#include "packet_index.hpp"
+#include "frame_hash.hpp"
+#include <algorithm>
+#include <limits.h>
+
+static void add_packets(PacketIndex* index, const PacketBatch& batch) {
+    float seconds_per_tick[2] = {
+        index->audio_time_base.num / (float)index->audio_time_base.den,
+        index->video_time_base.num / (float)index->video_time_base.den,
+    };
+
+    for (int i = 0; i < batch.count; ++i) {
+        bool is_video = batch.is_video[i];
+        float tick = seconds_per_tick[is_video];
+
+        PacketInfo pkt;
+        pkt.type = is_video ? batch.is_keyframe[i] ? PacketInfo::VIDEO_KEY : PacketInfo::VIDEO_DELTA : PacketInfo::AUDIO;
+        pkt.index = index->all_packets.size();
+        pkt.pts = batch.pts[i];
+        pkt.dts = batch.dts[i];
+        pkt.has_pts = batch.has_pts[i];
+        pkt.has_dts = batch.has_dts[i];
+        pkt.duration = batch.duration[i] * tick;
+        pkt.pos = batch.pos[i];
+        pkt.picture = batch.picture_type[i];
+        pkt.is_reference = batch.is_reference[i];
+        pkt.decode_ms = -1.0;
+        pkt.content_hash = 0;
+
+        // Every audio packet can be decoded on its own
+        if (!is_video) {
+            pkt.keyframe_index = pkt.index;
+        } else {
+            if (batch.is_keyframe[i] || index->last_keyframe_index == -1) {
+                index->prev_keyframe_index = index->last_keyframe_index;
+                index->last_keyframe_index = pkt.index;
+            }
+            pkt.keyframe_index = index->last_keyframe_index;
+
+            // Leading pictures of an open GOP (MPEG-2 B-frames after the
+            // I-frame, HEVC RASL) reference the GOP before, so decoding has
+            // to start at its keyframe. Without one, seek by pts instead.
+            if (pkt.keyframe_index != pkt.index && pkt.pts < index->all_packets[pkt.keyframe_index].pts) {
+                pkt.keyframe_index = index->prev_keyframe_index;
+            }
+        }
+
+        // The stream rows lay packets out by presentation time
+        auto& stream_packets = is_video ? index->video_packets : index->audio_packets;
+        stream_packets.push_back(pkt);
+        stream_packets.back().time_start = batch.pts[i] * tick;
+        stream_packets.back().time_end   = (batch.pts[i] + batch.duration[i]) * tick;
+
+        // The mixed row shares the timeline between the streams
+        pkt.time_start = index->duration;
+        index->duration += pkt.duration / index->num_streams;
+        pkt.time_end   = index->duration;
+        index->all_packets.push_back(pkt);
+    }
+}
+
+// Sorts the packets from index `from` on, and merges them into the already
+// sorted packets before them. Only the part of the old packets that the new
+// ones overlap is touched.
+static void merge_new_packets(std::vector<PacketInfo>* packets, size_t from) {
+    auto first_new = packets->begin() + from;
+    std::sort(first_new, packets->end(), cmp_pkt_start);
+    if (first_new == packets->begin() || first_new == packets->end()) {
+        return;
+    }
+    auto merge_from = std::upper_bound(packets->begin(), first_new, *first_new, cmp_pkt_start);
+    std::inplace_merge(merge_from, first_new, packets->end(), cmp_pkt_start);
+}
+
+void packet_index_init(PacketIndex* index, VideoReaderState* state) {
+    std::lock_guard<std::mutex> lock(index->mutex);
+    index->duration = 0.0;
+    index->last_keyframe_index = -1;
+    index->prev_keyframe_index = -1;
+    index->video_time_base = state->video_time_base;
+    index->audio_time_base = state->audio_time_base;
+    index->num_streams = (state->video_stream_index != -1 && state->audio_stream_index != -1) ? 2 : 1;
+}
+
+void packet_index_build(PacketIndex* index, VideoReaderState* state) {
+    packet_index_init(index, state);
+
+    // Reserve for what the container says is in there, so that millions of
+    // packets don't reallocate and copy the index over and over
+    int64_t video_estimate, audio_estimate;
+    video_reader_estimate_packet_counts(state, &video_estimate, &audio_estimate);
+
+    std::lock_guard<std::mutex> lock(index->mutex);
+    index->video_packets.reserve(index->video_packets.size() + video_estimate);
+    index->audio_packets.reserve(index->audio_packets.size() + audio_estimate);
+    index->all_packets.reserve(index->all_packets.size() + video_estimate + audio_estimate);
+
+    // Parse all packets
+    size_t video_from = index->video_packets.size();
+    size_t audio_from = index->audio_packets.size();
+    PacketBatch* batch = new PacketBatch;
+    while (video_reader_read_packets(state, batch) > 0) {
+        add_packets(index, *batch);
+    }
+    delete batch;
+    merge_new_packets(&index->video_packets, video_from);
+    merge_new_packets(&index->audio_packets, audio_from);
+}
+
+void packet_index_append(PacketIndex* index, const PacketBatch& batch) {
+    std::lock_guard<std::mutex> lock(index->mutex);
+    size_t video_from = index->video_packets.size();
+    size_t audio_from = index->audio_packets.size();
+    add_packets(index, batch);
+    merge_new_packets(&index->video_packets, video_from);
+    merge_new_packets(&index->audio_packets, audio_from);
+}
+
+// Finds the packet with the given pts, for lookups in increasing pts order
+// that each continue from where the last one ended
+static PacketInfo* find_pts_from(std::vector<PacketInfo>* packets, std::vector<PacketInfo>::iterator* it, int pts) {
+    *it = std::lower_bound(*it, packets->end(), pts, [](const PacketInfo& pkt, int pts) {
+        return pkt.pts < pts;
+    });
+    if (*it == packets->end() || (*it)->pts != pts) {
+        return NULL;
+    }
+    return &**it;
+}
+
+void packet_index_set_decode_costs(PacketIndex* index, const std::vector<std::pair<int, float>>& costs) {
+    std::lock_guard<std::mutex> lock(index->mutex);
+
+    auto sorted = costs;
+    std::sort(sorted.begin(), sorted.end());
+    auto it = index->video_packets.begin();
+    for (auto& cost : sorted) {
+        if (auto pkt = find_pts_from(&index->video_packets, &it, cost.first)) {
+            pkt->decode_ms = cost.second;
+            index->all_packets[pkt->index].decode_ms = cost.second;
+        }
+    }
+}
+
+static void set_content_hashes(PacketIndex* index, std::vector<PacketInfo>* packets, const std::vector<FrameHash>& hashes) {
+    auto sorted = hashes;
+    std::sort(sorted.begin(), sorted.end(), [](const FrameHash& a, const FrameHash& b) {
+        return a.pts < b.pts;
+    });
+    auto it = packets->begin();
+    for (auto& hash : sorted) {
+        if (auto pkt = find_pts_from(packets, &it, hash.pts)) {
+            pkt->content_hash = hash.combined();
+            index->all_packets[pkt->index].content_hash = pkt->content_hash;
+        }
+    }
+}
+
+void packet_index_set_content_hashes(PacketIndex* index, const FileHashes& hashes) {
+    std::lock_guard<std::mutex> lock(index->mutex);
+    set_content_hashes(index, &index->video_packets, hashes.video);
+    set_content_hashes(index, &index->audio_packets, hashes.audio);
+}
+
+bool packet_index_get(PacketIndex* index, int i, PacketInfo* pkt) {
+    std::lock_guard<std::mutex> lock(index->mutex);
+    if (i < 0 || i >= index->all_packets.size()) {
+        return false;
+    }
+    *pkt = index->all_packets[i];
+    return true;
+}
+
+int packet_index_find(PacketIndex* index, bool video, int pts) {
+    std::lock_guard<std::mutex> lock(index->mutex);
+
+    // The per-stream rows are sorted by presentation time, so by pts
+    auto& packets = video ? index->video_packets : index->audio_packets;
+    auto it = std::lower_bound(packets.begin(), packets.end(), pts, [](const PacketInfo& pkt, int pts) {
+        return pkt.pts < pts;
+    });
+    if (it == packets.end() || it->pts != pts) {
+        return -1;
+    }
+    return it->index;
+}
+
+int packet_index_gop_end_pts(PacketIndex* index, int i) {
+    std::lock_guard<std::mutex> lock(index->mutex);
+
+    // The GOP ends at the next keyframe in decode order
+    for (int j = i + 1; j < index->all_packets.size(); ++j) {
+        if (index->all_packets[j].type == PacketInfo::VIDEO_KEY) {
+            return index->all_packets[j].pts;
+        }
+    }
+    return INT_MAX;
+}
+
+void packet_index_seek(PacketIndex* index, VideoReaderState* state, const PacketInfo& pkt) {
+    PacketInfo keyframe;
+    if (!packet_index_get(index, pkt.keyframe_index, &keyframe)) {
+        keyframe.pos = -1;
+    }
+    video_reader_seek_packet(state, pkt.type != PacketInfo::AUDIO, pkt.pts, keyframe.pos);
+}
+
+void packet_index_clear(PacketIndex* index) {
+    std::lock_guard<std::mutex> lock(index->mutex);
+    index->video_packets.clear();
+    index->audio_packets.clear();
+    index->all_packets.clear();
+    index->duration = 0.0;
+    index->last_keyframe_index = -1;
+    index->prev_keyframe_index = -1;
+}
+
+bool cmp_pkt_start(const PacketInfo& a, const PacketInfo& b) {
+    return a.time_start < b.time_start;
+}
+
+bool cmp_pkt_end(const PacketInfo& a, const PacketInfo& b) {
+    return a.time_end < b.time_end;
+}
@@ -0,0 +1,82 @@
+#ifndef packet_index_hpp
+#define packet_index_hpp
+
+#include <mutex>
+#include <vector>
+#include "video_reader.hpp"
+
+struct PacketInfo {
+    enum PacketType : unsigned char {
+        AUDIO,
+        VIDEO_KEY,
+        VIDEO_DELTA
+    };
+
+    PacketType type;
+    int index;
+    int pts;            // 0 without has_pts, see PacketBatch
+    int dts;
+    bool has_pts;
+    bool has_dts;
+    float duration;
+    float time_start;
+    float time_end;
+    int64_t pos;        // byte position in the file, -1 if unknown
+    int keyframe_index; // packet to seek to in order to decode this one, -1 to seek by pts
+    PictureType picture; // from the bitstream, see picture_type.hpp
+    bool is_reference;  // other pictures are predicted from this one
+    float decode_ms;    // time to decode, -1 until measured (see decode_cost.hpp)
+    uint64_t content_hash; // of the decoded frame, 0 until hashed (see frame_hash.hpp)
+};
+
+struct PacketIndex {
+    // Packets in file order, laid out by cumulative duration
+    std::vector<PacketInfo> all_packets;
+
+    // Packets per stream, laid out and sorted by presentation time
+    std::vector<PacketInfo> video_packets;
+    std::vector<PacketInfo> audio_packets;
+
+    float duration;
+
+    // Layout state, so that packets can be appended to a built index
+    int num_streams;
+    int last_keyframe_index;
+    int prev_keyframe_index;
+    AVRational video_time_base;
+    AVRational audio_time_base;
+
+    // The UI thread is the only writer and takes the lock to write; other
+    // threads read through the packet_index_get/find functions below
+    std::mutex mutex;
+};
+
+// Prepares an empty index for the reader's streams, packet_index_build
+// does this before reading all packets
+void packet_index_init(PacketIndex* index, VideoReaderState* state);
+void packet_index_build(PacketIndex* index, VideoReaderState* state);
+void packet_index_clear(PacketIndex* index);
+
+// Appends packets read after the index was built, e.g. from a file that is
+// still being written. Costs time proportional to the new packets only.
+void packet_index_append(PacketIndex* index, const PacketBatch& batch);
+
+// Stores measured decode times by video packet pts
+void packet_index_set_decode_costs(PacketIndex* index, const std::vector<std::pair<int, float>>& costs);
+
+// Stores the combined hash of each decoded frame by packet pts
+struct FileHashes;
+void packet_index_set_content_hashes(PacketIndex* index, const FileHashes& hashes);
+
+// Thread-safe reads
+bool packet_index_get(PacketIndex* index, int i, PacketInfo* pkt);
+int  packet_index_find(PacketIndex* index, bool video, int pts);
+int  packet_index_gop_end_pts(PacketIndex* index, int i);
+
+// Seeks the reader so that decoding continues from the packet's keyframe
+void packet_index_seek(PacketIndex* index, VideoReaderState* state, const PacketInfo& pkt);
+
+bool cmp_pkt_start(const PacketInfo& a, const PacketInfo& b);
+bool cmp_pkt_end(const PacketInfo& a, const PacketInfo& b);
+
+#endif
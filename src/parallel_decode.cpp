@@ -0,0 +1,123 @@
+#include "parallel_decode.hpp"
+#include <algorithm>
+#include <limits.h>
+
+std::vector<DecodeRange> parallel_decode_split(PacketIndex* index, int num_ranges) {
+    auto& packets = index->video_packets;
+
+    std::vector<DecodeRange> ranges;
+    DecodeRange range;
+    range.seek_pts = INT_MIN;
+    range.start_pts = INT_MIN;
+
+    // Cut at the first keyframe after each equal share of the packets
+    long share = packets.size() / std::max(1, num_ranges);
+    long next_cut = share;
+    long packets_seen = 0;
+    for (auto& pkt : packets) {
+        ++packets_seen;
+        if (pkt.type != PacketInfo::VIDEO_KEY || packets_seen < next_cut || share == 0) {
+            continue;
+        }
+        if (range.start_pts != INT_MIN && pkt.pts <= range.start_pts) {
+            continue;
+        }
+        range.end_pts = pkt.pts;
+        ranges.push_back(range);
+        range.seek_pts = pkt.pts;
+        range.start_pts = pkt.pts;
+        next_cut += share;
+    }
+    range.end_pts = INT_MAX;
+    ranges.push_back(range);
+
+    return ranges;
+}
+
+static bool cancelled(void* opaque) {
+    return ((const std::atomic_bool*)opaque)->load();
+}
+
+struct PacketTiming {
+    int range;
+    const DecodeRange* bounds;
+    ParallelDecodePacketVisitor* visit_packet;
+};
+
+static void packet_decoded(void* opaque, int packet_pts, int64_t decode_ns) {
+    auto timing = (PacketTiming*)opaque;
+    if (packet_pts >= timing->bounds->start_pts && packet_pts < timing->bounds->end_pts) {
+        (*timing->visit_packet)(timing->range, packet_pts, decode_ns);
+    }
+}
+
+static bool decode_range(MediaSource* source, int i, const DecodeRange& range, const std::atomic_bool* cancel,
+                         ParallelDecodeVisitor& visit_frame, ParallelDecodePacketVisitor& visit_packet) {
+    VideoReaderState state;
+    if (!video_reader_open_source(&state, source)) {
+        return false;
+    }
+    video_reader_select_streams(&state, true, false);
+    if (cancel) {
+        state.should_cancel = cancelled;
+        state.should_cancel_opaque = (void*)cancel;
+    }
+    PacketTiming timing = { i, &range, &visit_packet };
+    if (visit_packet) {
+        state.on_video_packet_decoded = packet_decoded;
+        state.on_video_packet_decoded_opaque = &timing;
+    }
+
+    if (range.seek_pts != INT_MIN) {
+        video_reader_seek(&state, true, range.seek_pts);
+    }
+
+    int res, packet_pts, pts;
+    while ((res = video_reader_next_frame(&state, &packet_pts, &pts)) != RECEIVED_NONE) {
+        if (res == RECEIVED_CANCELLED) {
+            break;
+        }
+        if (res != RECEIVED_VIDEO) {
+            continue;
+        }
+        if (pts >= range.end_pts) {
+            break;
+        }
+        if (pts < range.start_pts) {
+            continue;
+        }
+        if (visit_frame) {
+            visit_frame(i, &state, pts);
+        }
+    }
+
+    video_reader_close(&state);
+    return res != RECEIVED_CANCELLED;
+}
+
+bool parallel_decode_video(const char* filename,
+                           const std::vector<DecodeRange>& ranges,
+                           ThreadPool* pool,
+                           const std::atomic_bool* cancel,
+                           ParallelDecodeVisitor visit_frame,
+                           ParallelDecodePacketVisitor visit_packet) {
+    // All readers share one open file
+    auto source = media_source_open(filename);
+    if (!source) {
+        return false;
+    }
+
+    std::atomic_bool success(true);
+    TaskGroup group;
+    for (int i = 0; i < ranges.size(); ++i) {
+        group.submit(pool, [&, i]() {
+            if (!decode_range(source, i, ranges[i], cancel, visit_frame, visit_packet)) {
+                success = false;
+            }
+        });
+    }
+    group.wait();
+
+    media_source_release(source);
+    return success;
+}
@@ -0,0 +1,70 @@
+#ifndef parallel_decode_hpp
+#define parallel_decode_hpp
+
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "video_reader.hpp"
+#include "packet_index.hpp"
+#include "thread_pool.hpp"
+
+// Range of the video stream that one reader decodes. A range starts at a
+// keyframe and owns every frame whose pts lies in [start_pts, end_pts).
+//
+// Each reader keeps decoding past the next keyframe until its output passes
+// end_pts, and skips output before start_pts. Decoder output is in
+// presentation order, so the leading pictures of an open GOP (which follow
+// the keyframe in decode order but precede it in presentation order) are
+// produced by the range before, with their references intact, and are
+// dropped by the range that starts at that keyframe. Closed GOPs simply have
+// no such pictures.
+struct DecodeRange {
+    int seek_pts;  // keyframe to seek to, INT_MIN to decode from the start
+    int start_pts;
+    int end_pts;
+};
+
+// Splits the video stream at keyframes into about num_ranges ranges of
+// similar packet counts
+std::vector<DecodeRange> parallel_decode_split(PacketIndex* index, int num_ranges);
+
+typedef std::function<void(int range, VideoReaderState* state, int frame_pts)> ParallelDecodeVisitor;
+typedef std::function<void(int range, int packet_pts, int64_t decode_ns)> ParallelDecodePacketVisitor;
+
+// Decodes every video frame of the file exactly once, with one independent
+// reader per range running on the pool. visit_frame is called on pool
+// threads; the frames of one range arrive in presentation order. Setting
+// *cancel abandons the remaining work.
+//
+// visit_packet, if given, gets the decode time of every packet, each once:
+// a range reports only the packets whose pts it owns.
+bool parallel_decode_video(const char* filename,
+                           const std::vector<DecodeRange>& ranges,
+                           ThreadPool* pool,
+                           const std::atomic_bool* cancel,
+                           ParallelDecodeVisitor visit_frame,
+                           ParallelDecodePacketVisitor visit_packet);
+
+// Per-range results, concatenated in range order by merge() to give
+// results for the whole file in presentation order
+template <typename T>
+struct RangeResults {
+    std::vector<std::vector<T>> ranges;
+
+    RangeResults(int num_ranges) : ranges(num_ranges) {}
+
+    std::vector<T> merge() {
+        size_t count = 0;
+        for (auto& range : ranges) {
+            count += range.size();
+        }
+        std::vector<T> merged;
+        merged.reserve(count);
+        for (auto& range : ranges) {
+            merged.insert(merged.end(), range.begin(), range.end());
+        }
+        return merged;
+    }
+};
+
+#endif
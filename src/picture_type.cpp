@@ -0,0 +1,301 @@
+#include "picture_type.hpp"
+#include <string.h>
+
+// Reads the bits of a slice or parameter set header. Reading past the end
+// gives zeros, which the callers treat as a malformed header.
+struct BitReader {
+    const uint8_t* data;
+    int size;
+    int bit;
+};
+
+static int read_bit(BitReader* r) {
+    if (r->bit >= r->size * 8) {
+        return 0;
+    }
+    int b = (r->data[r->bit >> 3] >> (7 - (r->bit & 7))) & 1;
+    ++r->bit;
+    return b;
+}
+
+static int read_bits(BitReader* r, int n) {
+    int value = 0;
+    while (n-- > 0) {
+        value = (value << 1) | read_bit(r);
+    }
+    return value;
+}
+
+// Exp-Golomb code, -1 if there is none
+static int read_ue(BitReader* r) {
+    int zeros = 0;
+    while (!read_bit(r)) {
+        if (++zeros > 30) {
+            return -1;
+        }
+    }
+    return (1 << zeros) - 1 + read_bits(r, zeros);
+}
+
+// Copies the start of a NAL unit without its emulation prevention bytes
+// (00 00 03 xx stands for 00 00 xx), which is all a header needs
+static int unescape(const uint8_t* nal, int size, uint8_t* rbsp, int max_size) {
+    int n = 0;
+    int zeros = 0;
+    for (int i = 0; i < size && n < max_size; ++i) {
+        if (zeros >= 2 && nal[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = nal[i] == 0 ? zeros + 1 : 0;
+        rbsp[n++] = nal[i];
+    }
+    return n;
+}
+
+static const uint8_t* find_start_code(const uint8_t* p, const uint8_t* end) {
+    for (; end - p >= 3; ++p) {
+        if (p[0] == 0 && p[1] == 0 && p[2] == 1) {
+            return p;
+        }
+    }
+    return end;
+}
+
+// Steps through the NAL units of a packet, either length prefixed (MP4) or
+// separated by start codes (Annex B, e.g. in TS)
+static bool next_nal(const uint8_t** p, const uint8_t* end, int nal_length_size, const uint8_t** nal, int* nal_size) {
+    if (nal_length_size > 0) {
+        if (end - *p < nal_length_size) {
+            return false;
+        }
+        int64_t size = 0;
+        for (int i = 0; i < nal_length_size; ++i) {
+            size = (size << 8) | (*p)[i];
+        }
+        *p += nal_length_size;
+        if (size > end - *p) {
+            size = end - *p;
+        }
+        *nal = *p;
+        *nal_size = (int)size;
+        *p += size;
+        return true;
+    }
+
+    auto start = find_start_code(*p, end);
+    if (start == end) {
+        return false;
+    }
+    *nal = start + 3;
+    *p = find_start_code(*nal, end);
+    *nal_size = *p - *nal;
+    return true;
+}
+
+static PictureType from_av_picture_type(int pict_type) {
+    switch (pict_type) {
+        case AV_PICTURE_TYPE_I:
+        case AV_PICTURE_TYPE_SI:
+        case AV_PICTURE_TYPE_BI: return PICTURE_I;
+        case AV_PICTURE_TYPE_P:
+        case AV_PICTURE_TYPE_SP:
+        case AV_PICTURE_TYPE_S:  return PICTURE_P;
+        case AV_PICTURE_TYPE_B:  return PICTURE_B;
+        default:                 return PICTURE_UNKNOWN;
+    }
+}
+
+static bool parse_h264_slice(const uint8_t* nal, int size, PictureType* type, bool* is_reference) {
+    int nal_type = nal[0] & 0x1f;
+    if (nal_type != 1 && nal_type != 5) {
+        return false;
+    }
+
+    uint8_t rbsp[16];
+    BitReader r = { rbsp, unescape(nal + 1, size - 1, rbsp, sizeof(rbsp)), 0 };
+    read_ue(&r); // first_mb_in_slice
+    int slice_type = read_ue(&r);
+    if (slice_type < 0) {
+        return false;
+    }
+    switch (slice_type % 5) {
+        case 0: case 3: *type = PICTURE_P; break;
+        case 1:         *type = PICTURE_B; break;
+        default:        *type = PICTURE_I; break;
+    }
+    *is_reference = (nal[0] >> 5) & 3; // nal_ref_idc
+    return true;
+}
+
+static void parse_hevc_pps(PictureTypeParser* parser, const uint8_t* nal, int size) {
+    uint8_t rbsp[16];
+    BitReader r = { rbsp, unescape(nal + 2, size - 2, rbsp, sizeof(rbsp)), 0 };
+    int pps_id = read_ue(&r);
+    read_ue(&r); // pps_seq_parameter_set_id
+    read_bit(&r); // dependent_slice_segments_enabled_flag
+    read_bit(&r); // output_flag_present_flag
+    int extra_bits = read_bits(&r, 3);
+    if (pps_id >= 0 && pps_id < PictureTypeParser::MAX_HEVC_PPS) {
+        parser->hevc_extra_slice_header_bits[pps_id] = extra_bits;
+    }
+}
+
+static bool parse_hevc_nal(PictureTypeParser* parser, const uint8_t* nal, int size, PictureType* type, bool* is_reference) {
+    if (size < 3) {
+        return false;
+    }
+    int nal_type = (nal[0] >> 1) & 0x3f;
+    if (nal_type == 34) {
+        parse_hevc_pps(parser, nal, size);
+        return false;
+    }
+
+    // Slices are types 0-9 and the random access points 16-21
+    if (nal_type > 21 || (nal_type > 9 && nal_type < 16)) {
+        return false;
+    }
+
+    uint8_t rbsp[16];
+    BitReader r = { rbsp, unescape(nal + 2, size - 2, rbsp, sizeof(rbsp)), 0 };
+    bool first_slice_segment_in_pic = read_bit(&r);
+    if (!first_slice_segment_in_pic) {
+        return false;
+    }
+    if (nal_type >= 16) {
+        read_bit(&r); // no_output_of_prior_pics_flag
+    }
+    int pps_id = read_ue(&r);
+    if (pps_id < 0 || pps_id >= PictureTypeParser::MAX_HEVC_PPS) {
+        return false;
+    }
+    read_bits(&r, parser->hevc_extra_slice_header_bits[pps_id]);
+    switch (read_ue(&r)) {
+        case 0:  *type = PICTURE_B; break;
+        case 1:  *type = PICTURE_P; break;
+        case 2:  *type = PICTURE_I; break;
+        default: return false;
+    }
+
+    // Even types below 16 are sub-layer non-reference pictures
+    *is_reference = !(nal_type < 16 && nal_type % 2 == 0);
+    return true;
+}
+
+// Picks the parameter sets out of an hvcC box
+static void parse_hvcc(PictureTypeParser* parser, const uint8_t* data, int size) {
+    if (size < 23) {
+        return;
+    }
+    int num_arrays = data[22];
+    auto p = data + 23;
+    auto end = data + size;
+    for (int i = 0; i < num_arrays && end - p >= 3; ++i) {
+        int nal_type = p[0] & 0x3f;
+        int num_nalus = (p[1] << 8) | p[2];
+        p += 3;
+        for (int j = 0; j < num_nalus && end - p >= 2; ++j) {
+            int nal_size = (p[0] << 8) | p[1];
+            p += 2;
+            if (nal_size > end - p) {
+                return;
+            }
+            if (nal_type == 34 && nal_size >= 3) {
+                parse_hevc_pps(parser, p, nal_size);
+            }
+            p += nal_size;
+        }
+    }
+}
+
+static bool is_annex_b(const uint8_t* data, int size) {
+    return size >= 3 && data[0] == 0 && data[1] == 0 && (data[2] == 1 || (size >= 4 && data[2] == 0 && data[3] == 1));
+}
+
+void PictureTypeParser::init(PictureTypeParser* parser, const AVCodecParameters* params) {
+    parser->codec_id = params->codec_id;
+    parser->nal_length_size = 0;
+    memset(parser->hevc_extra_slice_header_bits, 0, sizeof(parser->hevc_extra_slice_header_bits));
+    parser->parser = NULL;
+    parser->parser_ctx = NULL;
+
+    auto extradata = params->extradata;
+    int extradata_size = params->extradata_size;
+
+    if (params->codec_id == AV_CODEC_ID_H264) {
+        // avcC, otherwise the packets carry start codes
+        if (extradata_size >= 7 && extradata[0] == 1) {
+            parser->nal_length_size = (extradata[4] & 3) + 1;
+        }
+        return;
+    }
+
+    if (params->codec_id == AV_CODEC_ID_HEVC) {
+        if (extradata_size >= 23 && !is_annex_b(extradata, extradata_size)) {
+            parser->nal_length_size = (extradata[21] & 3) + 1;
+            parse_hvcc(parser, extradata, extradata_size);
+        } else if (extradata_size > 0) {
+            auto p = (const uint8_t*)extradata;
+            const uint8_t* nal;
+            int nal_size;
+            while (next_nal(&p, extradata + extradata_size, 0, &nal, &nal_size)) {
+                if (nal_size >= 3 && ((nal[0] >> 1) & 0x3f) == 34) {
+                    parse_hevc_pps(parser, nal, nal_size);
+                }
+            }
+        }
+        return;
+    }
+
+    parser->parser = av_parser_init(params->codec_id);
+    if (!parser->parser) {
+        return;
+    }
+    parser->parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+    parser->parser_ctx = avcodec_alloc_context3(NULL);
+    if (!parser->parser_ctx || avcodec_parameters_to_context(parser->parser_ctx, params) < 0) {
+        destroy(parser);
+    }
+}
+
+void PictureTypeParser::destroy(PictureTypeParser* parser) {
+    if (parser->parser) {
+        av_parser_close(parser->parser);
+        parser->parser = NULL;
+    }
+    if (parser->parser_ctx) {
+        avcodec_free_context(&parser->parser_ctx);
+    }
+}
+
+void PictureTypeParser::parse(const AVPacket* packet, PictureType* type, bool* is_reference) {
+    *type = PICTURE_UNKNOWN;
+    *is_reference = true;
+
+    if (codec_id == AV_CODEC_ID_H264 || codec_id == AV_CODEC_ID_HEVC) {
+        // The first slice of the picture tells
+        auto p = (const uint8_t*)packet->data;
+        auto end = p + packet->size;
+        const uint8_t* nal;
+        int nal_size;
+        while (next_nal(&p, end, nal_length_size, &nal, &nal_size)) {
+            if (nal_size < 2) {
+                continue;
+            }
+            bool found = codec_id == AV_CODEC_ID_H264 ? parse_h264_slice(nal, nal_size, type, is_reference)
+                                                      : parse_hevc_nal(this, nal, nal_size, type, is_reference);
+            if (found) {
+                return;
+            }
+        }
+        return;
+    }
+
+    if (parser) {
+        uint8_t* out;
+        int out_size;
+        av_parser_parse2(parser, parser_ctx, &out, &out_size, packet->data, packet->size, packet->pts, packet->dts, packet->pos);
+        *type = from_av_picture_type(parser->pict_type);
+        *is_reference = *type != PICTURE_B;
+    }
+}
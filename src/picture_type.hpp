@@ -0,0 +1,40 @@
+#ifndef picture_type_hpp
+#define picture_type_hpp
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+enum PictureType : unsigned char {
+    PICTURE_UNKNOWN,
+    PICTURE_I,
+    PICTURE_P,
+    PICTURE_B,
+};
+
+// Picture type and whether other pictures reference this one, read from
+// the start of each packet without decoding it. H.264 and HEVC slice
+// headers are parsed directly, which is the only way to learn the
+// reference flag. Other codecs go through their libavcodec parser, if
+// there is one, and count every non-B picture as a reference.
+struct PictureTypeParser {
+    static constexpr int MAX_HEVC_PPS = 64;
+
+    AVCodecID codec_id;
+    int nal_length_size; // 0 for Annex B start codes
+
+    // HEVC slice headers depend on their picture parameter set
+    int hevc_extra_slice_header_bits[MAX_HEVC_PPS];
+
+    // Fallback for other codecs
+    AVCodecParserContext* parser;
+    AVCodecContext* parser_ctx;
+
+    // Constructor, destructor
+    static void init(PictureTypeParser* parser, const AVCodecParameters* params);
+    static void destroy(PictureTypeParser* parser);
+
+    void parse(const AVPacket* packet, PictureType* type, bool* is_reference);
+};
+
+#endif
@@ -0,0 +1,352 @@
+#include "pixel_inspector.hpp"
+#include "profiler.hpp"
+#include <ddui/core>
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+constexpr float MAX_ZOOM = 64.0;
+constexpr int64_t TILE_TIME_BUDGET_NS = 8000000; // per update, the rest follow next frame
+constexpr int IMAGE_NEAREST = 1 << 5;            // NVG_IMAGE_NEAREST, shows pixels as squares
+
+// Constructor, destructor
+void PixelInspector::init(PixelInspector* inspector) {
+    inspector->pending_frame = av_frame_alloc();
+    inspector->has_pending_frame = false;
+    inspector->frame = av_frame_alloc();
+    inspector->has_frame = false;
+    inspector->zoom = 0.0; // fit on the first frame
+    inspector->center_x = 0.0;
+    inspector->center_y = 0.0;
+    inspector->dragging = false;
+    for (auto& tile : inspector->tiles) {
+        tile.used = false;
+        tile.image_id = -1;
+    }
+    inspector->clock = 0;
+    inspector->sws_ctx = NULL;
+    posix_memalign((void**)&inspector->tile_buffer, 128, PixelInspector::TILE_SIZE * PixelInspector::TILE_SIZE * 4);
+}
+
+void PixelInspector::destroy(PixelInspector* inspector) {
+    for (auto& tile : inspector->tiles) {
+        if (tile.image_id != -1) {
+            ddui::delete_image(tile.image_id);
+            tile.image_id = -1;
+        }
+        tile.used = false;
+    }
+    av_frame_free(&inspector->pending_frame);
+    av_frame_free(&inspector->frame);
+    if (inspector->sws_ctx) {
+        sws_freeContext(inspector->sws_ctx);
+        inspector->sws_ctx = NULL;
+    }
+    free(inspector->tile_buffer);
+    inspector->tile_buffer = NULL;
+}
+
+void pixel_inspector_set_frame(PixelInspector* inspector, const AVFrame* frame) {
+    std::lock_guard<std::mutex> lock(inspector->mutex);
+    av_frame_unref(inspector->pending_frame);
+    inspector->has_pending_frame = av_frame_ref(inspector->pending_frame, frame) == 0;
+}
+
+// Components 1 and 2 of YUV formats are the subsampled chroma
+static void component_shift(const AVPixFmtDescriptor* desc, int component, int* shift_x, int* shift_y) {
+    bool chroma = !(desc->flags & AV_PIX_FMT_FLAG_RGB) && (component == 1 || component == 2);
+    *shift_x = chroma ? desc->log2_chroma_w : 0;
+    *shift_y = chroma ? desc->log2_chroma_h : 0;
+}
+
+// Points the planes at pixel (x, y), so that swscale sees the tile as an
+// image of its own. x and y are multiples of the tile size, so they line up
+// with the chroma subsampling.
+static bool offset_planes(const AVFrame* frame, int x, int y, const uint8_t* planes[4]) {
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL))) {
+        return false;
+    }
+    for (int p = 0; p < 4; ++p) {
+        planes[p] = frame->data[p];
+    }
+    for (int c = 0; c < desc->nb_components; ++c) {
+        auto& comp = desc->comp[c];
+        int shift_x, shift_y;
+        component_shift(desc, c, &shift_x, &shift_y);
+        planes[comp.plane] = frame->data[comp.plane] + (y >> shift_y) * frame->linesize[comp.plane] + (x >> shift_x) * comp.step;
+    }
+    return true;
+}
+
+// Converts the tile to RGB0 in tile_buffer, downscaled by 2^level
+static bool convert_tile(PixelInspector* inspector, int level, int tile_x, int tile_y, int* width, int* height) {
+    PROFILE_SCOPE("inspector_tile");
+
+    auto frame = inspector->frame;
+    int span = PixelInspector::TILE_SIZE << level;
+    int x = tile_x * span;
+    int y = tile_y * span;
+    int source_width = std::min(span, frame->width - x);
+    int source_height = std::min(span, frame->height - y);
+    *width = std::max(1, (source_width + (1 << level) - 1) >> level);
+    *height = std::max(1, (source_height + (1 << level) - 1) >> level);
+
+    const uint8_t* planes[4];
+    if (!offset_planes(frame, x, y, planes)) {
+        return false;
+    }
+
+    // Level 0 is pixel exact; coarser levels average the pixels they cover
+    inspector->sws_ctx = sws_getCachedContext(inspector->sws_ctx,
+                                              source_width, source_height, (AVPixelFormat)frame->format,
+                                              *width, *height, AV_PIX_FMT_RGB0,
+                                              level == 0 ? SWS_POINT : SWS_AREA, NULL, NULL, NULL);
+    if (!inspector->sws_ctx) {
+        return false;
+    }
+
+    uint8_t* dest[4] = { inspector->tile_buffer, NULL, NULL, NULL };
+    int dest_linesize[4] = { *width * 4, 0, 0, 0 };
+    sws_scale(inspector->sws_ctx, planes, frame->linesize, 0, source_height, dest, dest_linesize);
+    return true;
+}
+
+static PixelInspector::Tile* find_tile(PixelInspector* inspector, int level, int tile_x, int tile_y) {
+    for (auto& tile : inspector->tiles) {
+        if (tile.used && tile.level == level && tile.tile_x == tile_x && tile.tile_y == tile_y) {
+            tile.last_used = ++inspector->clock;
+            return &tile;
+        }
+    }
+    return NULL;
+}
+
+// Converts and uploads a tile into a free or the least recently used slot,
+// reusing its texture when the size matches
+static PixelInspector::Tile* load_tile(PixelInspector* inspector, int level, int tile_x, int tile_y) {
+    int width, height;
+    if (!convert_tile(inspector, level, tile_x, tile_y, &width, &height)) {
+        return NULL;
+    }
+
+    PixelInspector::Tile* victim = NULL;
+    for (auto& tile : inspector->tiles) {
+        if (!tile.used) {
+            victim = &tile;
+            break;
+        }
+        if (!victim || tile.last_used < victim->last_used) {
+            victim = &tile;
+        }
+    }
+
+    if (victim->image_id != -1 && (victim->width != width || victim->height != height)) {
+        ddui::delete_image(victim->image_id);
+        victim->image_id = -1;
+    }
+    if (victim->image_id == -1) {
+        victim->image_id = ddui::create_image_from_rgba(width, height, IMAGE_NEAREST, inspector->tile_buffer);
+    } else {
+        ddui::update_image(victim->image_id, inspector->tile_buffer);
+    }
+
+    victim->used = true;
+    victim->level = level;
+    victim->tile_x = tile_x;
+    victim->tile_y = tile_y;
+    victim->width = width;
+    victim->height = height;
+    victim->last_used = ++inspector->clock;
+    return victim;
+}
+
+static void take_pending_frame(PixelInspector* inspector) {
+    std::lock_guard<std::mutex> lock(inspector->mutex);
+    if (!inspector->has_pending_frame) {
+        return;
+    }
+    bool same_size = inspector->has_frame &&
+                     inspector->frame->width == inspector->pending_frame->width &&
+                     inspector->frame->height == inspector->pending_frame->height;
+    av_frame_unref(inspector->frame);
+    av_frame_move_ref(inspector->frame, inspector->pending_frame);
+    inspector->has_pending_frame = false;
+    inspector->has_frame = true;
+
+    // The textures are kept for reuse, but their contents are stale
+    for (auto& tile : inspector->tiles) {
+        tile.used = false;
+    }
+    if (!same_size) {
+        inspector->zoom = 0.0;
+    }
+}
+
+static void fit_frame(PixelInspector* inspector, float width, float height) {
+    auto frame = inspector->frame;
+    inspector->zoom = std::min(width / frame->width, height / frame->height);
+    inspector->center_x = frame->width / 2.0;
+    inspector->center_y = frame->height / 2.0;
+}
+
+static void handle_input(PixelInspector* inspector, float x, float y, float width, float height) {
+    if (ddui::has_key_event() && ddui::key_state.character) {
+        char c = ddui::key_state.character[0];
+        if (c == '=') {
+            ddui::consume_key_event();
+            inspector->zoom = std::min(inspector->zoom * 2.0f, MAX_ZOOM);
+        } else if (c == '-') {
+            ddui::consume_key_event();
+            inspector->zoom = std::max(inspector->zoom / 2.0f, 1.0f / 64.0f);
+        } else if (c == '0') {
+            ddui::consume_key_event();
+            fit_frame(inspector, width, height);
+        }
+    }
+
+    // Dragging pans
+    if (ddui::mouse_hit(x, y, width, height)) {
+        ddui::mouse_hit_accept();
+        inspector->dragging = true;
+        inspector->drag_x = ddui::mouse_state.x;
+        inspector->drag_y = ddui::mouse_state.y;
+    }
+    if (inspector->dragging) {
+        if (!ddui::mouse_state.pressed) {
+            inspector->dragging = false;
+        } else {
+            inspector->center_x -= (ddui::mouse_state.x - inspector->drag_x) / inspector->zoom;
+            inspector->center_y -= (ddui::mouse_state.y - inspector->drag_y) / inspector->zoom;
+            inspector->drag_x = ddui::mouse_state.x;
+            inspector->drag_y = ddui::mouse_state.y;
+        }
+    }
+}
+
+// Reads the raw component values of pixel (x, y), as stored in the planes
+static int read_pixel(const AVFrame* frame, int x, int y, int values[4]) {
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_PAL))) {
+        return 0;
+    }
+    for (int c = 0; c < desc->nb_components; ++c) {
+        auto& comp = desc->comp[c];
+        int shift_x, shift_y;
+        component_shift(desc, c, &shift_x, &shift_y);
+        const uint8_t* ptr = frame->data[comp.plane] + (y >> shift_y) * frame->linesize[comp.plane] + (x >> shift_x) * comp.step + comp.offset;
+        int value = ptr[0];
+        if (comp.depth + comp.shift > 8) {
+            value = (desc->flags & AV_PIX_FMT_FLAG_BE) ? (ptr[0] << 8 | ptr[1]) : (ptr[1] << 8 | ptr[0]);
+        }
+        values[c] = (value >> comp.shift) & ((1 << comp.depth) - 1);
+    }
+    return desc->nb_components;
+}
+
+static void draw_pixel_values(PixelInspector* inspector, float x, float y, float width, float height) {
+    auto frame = inspector->frame;
+    if (!ddui::mouse_over(x, y, width, height)) {
+        return;
+    }
+    int pixel_x = (int)floor(inspector->center_x + (ddui::mouse_state.x - x - width / 2) / inspector->zoom);
+    int pixel_y = (int)floor(inspector->center_y + (ddui::mouse_state.y - y - height / 2) / inspector->zoom);
+    if (pixel_x < 0 || pixel_y < 0 || pixel_x >= frame->width || pixel_y >= frame->height) {
+        return;
+    }
+
+    int values[4];
+    int num_values = read_pixel(frame, pixel_x, pixel_y, values);
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    const char* names = (desc && (desc->flags & AV_PIX_FMT_FLAG_RGB)) ? "RGBA" : "YUVA";
+
+    char str[128];
+    int length = snprintf(str, sizeof(str), "%s  x %d y %d ", desc ? desc->name : "?", pixel_x, pixel_y);
+    for (int i = 0; i < num_values && length < (int)sizeof(str); ++i) {
+        length += snprintf(str + length, sizeof(str) - length, " %c %d", names[i], values[i]);
+    }
+
+    ddui::font_face("mono");
+    ddui::font_size(14.0);
+    float asc, descender, lineh;
+    ddui::text_metrics(&asc, &descender, &lineh);
+
+    auto background = ddui::rgb(0x000000);
+    background.a = 0.7;
+    ddui::begin_path();
+    ddui::fill_color(background);
+    ddui::rect(x + 10, y + height - 10 - lineh - 12, 480, lineh + 12);
+    ddui::fill();
+
+    ddui::fill_color(ddui::rgb(0xffffff));
+    ddui::text(x + 16, y + height - 10 - lineh - 6 + asc, str, NULL);
+}
+
+void pixel_inspector_update(PixelInspector* inspector, float x, float y, float width, float height) {
+    PROFILE_SCOPE("pixel_inspector");
+
+    take_pending_frame(inspector);
+
+    ddui::begin_path();
+    ddui::fill_color(ddui::rgb(0x1a1a1a));
+    ddui::rect(x, y, width, height);
+    ddui::fill();
+
+    if (!inspector->has_frame) {
+        return;
+    }
+    auto frame = inspector->frame;
+    if (inspector->zoom == 0.0) {
+        fit_frame(inspector, width, height);
+    }
+    handle_input(inspector, x, y, width, height);
+
+    // Zoomed out, each screen pixel covers 2^level frame pixels or more
+    float zoom = inspector->zoom;
+    int level = zoom >= 1.0 ? 0 : (int)floor(log2(1.0 / zoom));
+    int span = PixelInspector::TILE_SIZE << level;
+
+    float frame_x0 = inspector->center_x - width / 2 / zoom;
+    float frame_y0 = inspector->center_y - height / 2 / zoom;
+    int first_x = std::max(0, (int)floor(frame_x0 / span));
+    int first_y = std::max(0, (int)floor(frame_y0 / span));
+    int last_x = std::min((frame->width - 1) / span, (int)floor((frame_x0 + width / zoom) / span));
+    int last_y = std::min((frame->height - 1) / span, (int)floor((frame_y0 + height / zoom) / span));
+
+    auto start = profiler_now_ns();
+    bool tiles_missing = false;
+    for (int tile_y = first_y; tile_y <= last_y; ++tile_y) {
+        for (int tile_x = first_x; tile_x <= last_x; ++tile_x) {
+            auto tile = find_tile(inspector, level, tile_x, tile_y);
+            if (!tile && profiler_now_ns() - start < TILE_TIME_BUDGET_NS) {
+                tile = load_tile(inspector, level, tile_x, tile_y);
+            }
+            if (!tile) {
+                tiles_missing = true;
+                continue;
+            }
+
+            float tile_screen_x = x + (tile_x * span - frame_x0) * zoom;
+            float tile_screen_y = y + (tile_y * span - frame_y0) * zoom;
+            float tile_screen_w = tile->width * (1 << level) * zoom;
+            float tile_screen_h = tile->height * (1 << level) * zoom;
+            auto paint = ddui::image_pattern(tile_screen_x, tile_screen_y, tile_screen_w, tile_screen_h, 0, tile->image_id, 1.0f);
+            ddui::fill_paint(paint);
+            ddui::begin_path();
+            ddui::rect(tile_screen_x, tile_screen_y, tile_screen_w, tile_screen_h);
+            ddui::fill();
+        }
+    }
+
+    // Tiles over the time budget are converted in the next updates
+    if (tiles_missing) {
+        ddui::repaint(NULL);
+    }
+
+    draw_pixel_values(inspector, x, y, width, height);
+}
@@ -0,0 +1,61 @@
+#ifndef pixel_inspector_hpp
+#define pixel_inspector_hpp
+
+#include <mutex>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libswscale/swscale.h>
+}
+
+// Full resolution view of a decoded frame with zoom and pan. The frame is
+// cut into tiles that are converted and uploaded only once they become
+// visible; zoomed out, tiles of a coarser level cover more of the frame.
+// Raw component values under the cursor are read straight from the planes.
+struct PixelInspector {
+    static constexpr int TILE_SIZE = 256;
+    static constexpr int MAX_TILES = 384; // more than a 4K screen shows at once
+
+    struct Tile {
+        bool used;
+        int level;
+        int tile_x;
+        int tile_y;
+        int width;
+        int height;
+        int image_id;
+        unsigned long last_used;
+    };
+
+    // Handed over from the video thread, taken by the UI thread
+    std::mutex mutex;
+    AVFrame* pending_frame;
+    bool has_pending_frame;
+
+    // UI thread state
+    AVFrame* frame;
+    bool has_frame;
+    float zoom;
+    float center_x; // frame pixel at the center of the view
+    float center_y;
+    bool dragging;
+    float drag_x;
+    float drag_y;
+    Tile tiles[MAX_TILES];
+    unsigned long clock;
+    SwsContext* sws_ctx;
+    uint8_t* tile_buffer;
+
+    // Constructor, destructor
+    static void init(PixelInspector* inspector);
+    static void destroy(PixelInspector* inspector);
+};
+
+// Shows a new frame, from any thread. Only a reference is taken.
+void pixel_inspector_set_frame(PixelInspector* inspector, const AVFrame* frame);
+
+// Draws the inspector and handles its input ('=' / '-' zoom, '0' fits the
+// frame, dragging pans). UI thread only.
+void pixel_inspector_update(PixelInspector* inspector, float x, float y, float width, float height);
+
+#endif
@@ -0,0 +1,221 @@
+#include "profiler.hpp"
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <map>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+constexpr int MAX_THREADS = 64;
+constexpr int RING_SIZE = 8192; // power of two
+
+struct ProfileThread {
+    int thread_id;
+    char name[32];
+    bool in_use; // threads_mutex
+    std::atomic_uint first_count; // events before it were recorded by the slot's previous thread
+    std::atomic_uint write_count;
+    ProfileEvent events[RING_SIZE];
+};
+
+// The slot of the calling thread. Slots the thread registered itself go
+// back to the free list when it exits.
+struct ThreadSlot {
+    ProfileThread* thread;
+    bool owned;
+
+    ~ThreadSlot();
+};
+
+static std::mutex threads_mutex;
+static ProfileThread* threads[MAX_THREADS];
+static std::atomic_int num_threads;
+static thread_local ThreadSlot this_thread;
+
+int64_t profiler_now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Takes a free slot, or a new one while there are fewer than MAX_THREADS.
+// The events a previous thread left in a free slot are dropped.
+static ProfileThread* take_slot() {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    int count = num_threads;
+    for (int i = 0; i < count; ++i) {
+        auto thread = threads[i];
+        if (!thread->in_use) {
+            thread->in_use = true;
+            snprintf(thread->name, sizeof(thread->name), "thread %d", thread->thread_id);
+            thread->first_count.store(thread->write_count.load(std::memory_order_relaxed), std::memory_order_release);
+            return thread;
+        }
+    }
+    if (count == MAX_THREADS) {
+        return NULL;
+    }
+
+    auto thread = new ProfileThread;
+    thread->thread_id = count + 1;
+    snprintf(thread->name, sizeof(thread->name), "thread %d", thread->thread_id);
+    thread->in_use = true;
+    thread->first_count = 0;
+    thread->write_count = 0;
+    threads[count] = thread;
+    num_threads = count + 1;
+    return thread;
+}
+
+ThreadSlot::~ThreadSlot() {
+    if (thread && owned) {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        thread->in_use = false;
+    }
+}
+
+// Registers the calling thread; only taken once per thread
+static ProfileThread* register_thread() {
+    this_thread.thread = take_slot();
+    this_thread.owned = true;
+    return this_thread.thread;
+}
+
+ProfileThread* profiler_reserve_thread(const char* name) {
+    auto thread = take_slot();
+    if (thread) {
+        strncpy(thread->name, name, sizeof(thread->name) - 1);
+    }
+    return thread;
+}
+
+void profiler_use_thread(ProfileThread* thread) {
+    if (this_thread.thread != thread) {
+        this_thread.thread = thread;
+        this_thread.owned = false;
+    }
+}
+
+void profiler_set_thread_name(const char* name) {
+    auto thread = this_thread.thread;
+    if (!thread) {
+        thread = register_thread();
+        if (!thread) {
+            return;
+        }
+    }
+    strncpy(thread->name, name, sizeof(thread->name) - 1);
+}
+
+void profiler_record(const char* name, int64_t start_ns, int64_t end_ns) {
+    auto thread = this_thread.thread;
+    if (!thread) {
+        thread = register_thread();
+        if (!thread) {
+            return;
+        }
+    }
+
+    unsigned int index = thread->write_count.load(std::memory_order_relaxed);
+    auto& event = thread->events[index & (RING_SIZE - 1)];
+    event.name = name;
+    event.start_ns = start_ns;
+    event.end_ns = end_ns;
+    thread->write_count.store(index + 1, std::memory_order_release);
+}
+
+// Copies the events of a thread that are guaranteed not to have been
+// overwritten while they were being copied
+static void copy_events(ProfileThread* thread, std::vector<ProfileEvent>* out) {
+    unsigned int first = thread->first_count.load(std::memory_order_acquire);
+    unsigned int end = thread->write_count.load(std::memory_order_acquire);
+    unsigned int begin = std::max(end > RING_SIZE ? end - RING_SIZE : 0, first);
+
+    size_t out_begin = out->size();
+    for (unsigned int i = begin; i < end; ++i) {
+        out->push_back(thread->events[i & (RING_SIZE - 1)]);
+    }
+
+    // The writer may already be filling the slot of index end_after, which
+    // is the slot of end_after - RING_SIZE. The fence keeps the copies above
+    // from being reordered after the load.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    unsigned int end_after = thread->write_count.load(std::memory_order_relaxed);
+    unsigned int valid_begin = end_after + 1 > RING_SIZE ? end_after + 1 - RING_SIZE : 0;
+    if (valid_begin > begin) {
+        auto first = out->begin() + out_begin;
+        out->erase(first, first + std::min(valid_begin - begin, end - begin));
+    }
+}
+
+void profiler_collect_stats(double window_ms, std::vector<ProfileStats>* stats) {
+    stats->clear();
+
+    int64_t since_ns = profiler_now_ns() - (int64_t)(window_ms * 1000000.0);
+
+    std::vector<ProfileEvent> events;
+    std::map<const char*, std::vector<double>> durations;
+    int count = num_threads;
+    for (int i = 0; i < count; ++i) {
+        events.clear();
+        copy_events(threads[i], &events);
+        for (auto& event : events) {
+            if (event.end_ns >= since_ns) {
+                durations[event.name].push_back((event.end_ns - event.start_ns) / 1000000.0);
+            }
+        }
+    }
+
+    for (auto& it : durations) {
+        auto& values = it.second;
+        std::sort(values.begin(), values.end());
+
+        ProfileStats s;
+        s.name = it.first;
+        s.count = values.size();
+        s.p50_ms = values[(values.size() - 1) * 50 / 100];
+        s.p95_ms = values[(values.size() - 1) * 95 / 100];
+        s.p99_ms = values[(values.size() - 1) * 99 / 100];
+        s.max_ms = values.back();
+        stats->push_back(s);
+    }
+
+    std::sort(stats->begin(), stats->end(), [](const ProfileStats& a, const ProfileStats& b) {
+        return strcmp(a.name, b.name) < 0;
+    });
+}
+
+bool profiler_write_chrome_trace(const char* filename) {
+    FILE* f = fopen(filename, "w");
+    if (!f) {
+        printf("Couldn't open %s for writing\n", filename);
+        return false;
+    }
+
+    fprintf(f, "{\"traceEvents\":[\n");
+    bool first = true;
+
+    std::vector<ProfileEvent> events;
+    int count = num_threads;
+    for (int i = 0; i < count; ++i) {
+        auto thread = threads[i];
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", thread->thread_id, thread->name);
+        first = false;
+
+        events.clear();
+        copy_events(thread, &events);
+        for (auto& event : events) {
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    event.name,
+                    thread->thread_id,
+                    event.start_ns / 1000.0,
+                    (event.end_ns - event.start_ns) / 1000.0);
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return true;
+}
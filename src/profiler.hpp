@@ -0,0 +1,58 @@
+#ifndef profiler_hpp
+#define profiler_hpp
+
+#include <stdint.h>
+#include <vector>
+
+// Lightweight scoped timers. Every thread records into its own ring of
+// events, so recording takes no locks; readers copy the rings and drop any
+// entries that were overwritten while copying.
+
+struct ProfileEvent {
+    const char* name; // must be a string literal
+    int64_t start_ns;
+    int64_t end_ns;
+};
+
+struct ProfileStats {
+    const char* name;
+    int count;
+    double p50_ms;
+    double p95_ms;
+    double p99_ms;
+    double max_ms;
+};
+
+struct ProfileThread;
+
+int64_t profiler_now_ns();
+void profiler_set_thread_name(const char* name);
+void profiler_record(const char* name, int64_t start_ns, int64_t end_ns);
+
+// A thread registers itself on its first event, which locks and allocates,
+// and frees its slot when it exits. A thread that can't do either, e.g. a
+// real-time audio callback, records into a slot reserved for it up front
+// instead. The slot stays reserved, so threads that replace each other
+// (as the audio callback's does when the output reopens) can share it.
+ProfileThread* profiler_reserve_thread(const char* name);
+void profiler_use_thread(ProfileThread* thread);
+
+// Percentiles per event name over the last window_ms milliseconds
+void profiler_collect_stats(double window_ms, std::vector<ProfileStats>* stats);
+
+// Writes every event still in the rings as Chrome trace JSON (chrome://tracing)
+bool profiler_write_chrome_trace(const char* filename);
+
+struct ProfileScope {
+    const char* name;
+    int64_t start_ns;
+
+    ProfileScope(const char* name) : name(name), start_ns(profiler_now_ns()) {}
+    ~ProfileScope() { profiler_record(name, start_ns, profiler_now_ns()); }
+};
+
+#define PROFILE_SCOPE_CONCAT_(a, b) a##b
+#define PROFILE_SCOPE_CONCAT(a, b) PROFILE_SCOPE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_SCOPE_CONCAT(profile_scope_, __LINE__)(name)
+
+#endif
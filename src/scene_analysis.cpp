@@ -0,0 +1,268 @@
+#include "scene_analysis.hpp"
+#include "parallel_decode.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+constexpr float BLACK_MEAN_LUMA = 32;  // limited range black is 16
+constexpr int   BLACK_MAX_BLOCK = 48;
+constexpr float FROZEN_MAX_DIFF = 0.5;
+constexpr int   FROZEN_MIN_FRAMES = 10;
+constexpr float CUT_MIN_DIFF = 12;
+constexpr float CUT_DIFF_RATIO = 3;    // to the average of the frames before
+constexpr int   CUT_HISTORY = 8;
+
+// Adds the sum of each group of 8 pixels of the row to sums
+static void sum_groups_of_8(const uint8_t* row, int num_groups, uint32_t* sums) {
+    int g = 0;
+#if defined(__SSE2__)
+    // Summing absolute differences against zero sums 8 bytes per lane
+    const __m128i zero = _mm_setzero_si128();
+    for (; g + 2 <= num_groups; g += 2) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(row + g * 8));
+        __m128i sad = _mm_sad_epu8(pixels, zero);
+        sums[g]     += _mm_cvtsi128_si32(sad);
+        sums[g + 1] += _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+    }
+#endif
+    for (; g < num_groups; ++g) {
+        auto p = row + g * 8;
+        sums[g] += p[0] + p[1] + p[2] + p[3] + p[4] + p[5] + p[6] + p[7];
+    }
+}
+
+static uint32_t sum_abs_diff(const uint8_t* a, const uint8_t* b, int size) {
+    uint32_t sum = 0;
+    int i = 0;
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+    for (; i < size; ++i) {
+        sum += abs(a[i] - b[i]);
+    }
+    return sum;
+}
+
+bool luma_thumbnail_compute(const AVFrame* frame, LumaThumbnail* thumbnail) {
+    PROFILE_SCOPE("luma_thumbnail");
+
+    constexpr int W = LumaThumbnail::WIDTH;
+    constexpr int H = LumaThumbnail::HEIGHT;
+
+    // Planar luma in native byte order only
+    auto desc = av_pix_fmt_desc_get((AVPixelFormat)frame->format);
+    if (!desc || (desc->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BE))) {
+        return false;
+    }
+    int depth = desc->comp[0].depth;
+    int bytes_per_sample = depth > 8 ? 2 : 1;
+    if (desc->comp[0].plane != 0 || desc->comp[0].offset != 0 || desc->comp[0].step != bytes_per_sample) {
+        return false;
+    }
+
+    int width = frame->width;
+    int height = frame->height;
+    int num_groups = width / 8; // the last few columns of odd widths are left out
+    if (num_groups == 0 || height == 0) {
+        return false;
+    }
+
+    static thread_local std::vector<uint32_t> group_sums;
+    static thread_local std::vector<uint8_t> row_8bit;
+    group_sums.resize(num_groups);
+    row_8bit.resize(num_groups * 8);
+
+    // Block column of each group
+    int groups_per_block[W] = {};
+    for (int g = 0; g < num_groups; ++g) {
+        ++groups_per_block[g * W / num_groups];
+    }
+
+    uint64_t total = 0;
+    for (int by = 0; by < H; ++by) {
+        int y_from = by * height / H;
+        int y_to = (by + 1) * height / H;
+
+        std::fill(group_sums.begin(), group_sums.end(), 0);
+        for (int y = y_from; y < y_to; ++y) {
+            auto row = frame->data[0] + (ptrdiff_t)y * frame->linesize[0];
+            if (bytes_per_sample == 2) {
+                auto samples = (const uint16_t*)row;
+                for (int x = 0; x < num_groups * 8; ++x) {
+                    row_8bit[x] = samples[x] >> (depth - 8);
+                }
+                row = row_8bit.data();
+            }
+            sum_groups_of_8(row, num_groups, group_sums.data());
+        }
+
+        uint64_t block_sums[W] = {};
+        for (int g = 0; g < num_groups; ++g) {
+            block_sums[g * W / num_groups] += group_sums[g];
+        }
+        for (int bx = 0; bx < W; ++bx) {
+            uint64_t pixels = (uint64_t)groups_per_block[bx] * 8 * (y_to - y_from);
+            thumbnail->blocks[by * W + bx] = pixels ? block_sums[bx] / pixels : 0;
+            total += block_sums[bx];
+        }
+    }
+    thumbnail->mean = total / ((double)num_groups * 8 * height);
+
+    return true;
+}
+
+float luma_thumbnail_diff(const LumaThumbnail& a, const LumaThumbnail& b) {
+    constexpr int SIZE = LumaThumbnail::WIDTH * LumaThumbnail::HEIGHT;
+    return sum_abs_diff(a.blocks, b.blocks, SIZE) / (float)SIZE;
+}
+
+// Each range compares its frames with the one before within the range. The
+// first frame of a range is compared with the last of the range before
+// once all ranges are done.
+struct SceneRange {
+    std::vector<SceneFrame> frames;
+    LumaThumbnail first;
+    LumaThumbnail last;
+    bool has_thumbnail;
+};
+
+// Black frames are flagged as they are decoded, cuts and freezes here once
+// the differences between all frames are known
+static void classify(std::vector<SceneFrame>* frames) {
+    float recent_diffs[CUT_HISTORY] = {};
+    int num_recent = 0;
+    int num_written = 0;
+    int frozen_run = 0;
+
+    for (size_t i = 0; i < frames->size(); ++i) {
+        auto& frame = (*frames)[i];
+        bool is_black = frame.flags & SCENE_BLACK;
+        if (frame.diff < 0) {
+            frozen_run = 0;
+            continue;
+        }
+
+        // A cut stands out from the motion of the frames before it
+        float recent = 0;
+        for (int j = 0; j < num_recent; ++j) {
+            recent += recent_diffs[j];
+        }
+        recent = num_recent ? recent / num_recent : 0;
+        if (frame.diff > CUT_MIN_DIFF && frame.diff > CUT_DIFF_RATIO * recent) {
+            frame.flags |= SCENE_CUT;
+        }
+        recent_diffs[num_written++ % CUT_HISTORY] = frame.diff;
+        num_recent = std::min(num_recent + 1, CUT_HISTORY);
+
+        // Black frames are all alike, that isn't a freeze
+        if (frame.diff <= FROZEN_MAX_DIFF && !is_black) {
+            if (++frozen_run == FROZEN_MIN_FRAMES) {
+                for (size_t j = i + 1 - FROZEN_MIN_FRAMES; j < i; ++j) {
+                    (*frames)[j].flags |= SCENE_FROZEN;
+                }
+            }
+            if (frozen_run >= FROZEN_MIN_FRAMES) {
+                frame.flags |= SCENE_FROZEN;
+            }
+        } else {
+            frozen_run = 0;
+        }
+    }
+}
+
+bool scene_analysis_run(const char* filename,
+                        PacketIndex* index,
+                        ThreadPool* pool,
+                        const std::atomic_bool* cancel,
+                        std::atomic_int* frames_done,
+                        std::vector<SceneFrame>* frames) {
+    std::vector<DecodeRange> ranges;
+    AVRational time_base;
+    {
+        std::lock_guard<std::mutex> lock(index->mutex);
+        ranges = parallel_decode_split(index, pool->num_threads() * 4);
+        time_base = index->video_time_base;
+    }
+    float seconds_per_tick = time_base.num / (float)time_base.den;
+
+    std::vector<SceneRange> results(ranges.size());
+    for (auto& result : results) {
+        result.has_thumbnail = false;
+    }
+
+    bool success = parallel_decode_video(filename, ranges, pool, cancel, [&](int range, VideoReaderState* state, int pts) {
+        auto& result = results[range];
+
+        SceneFrame frame;
+        frame.pts = pts;
+        frame.mean_luma = -1;
+        frame.diff = -1;
+        frame.flags = 0;
+
+        LumaThumbnail thumbnail;
+        if (luma_thumbnail_compute(state->video_frame, &thumbnail)) {
+            frame.mean_luma = thumbnail.mean;
+            if (!result.has_thumbnail) {
+                result.first = thumbnail;
+                result.has_thumbnail = true;
+            } else {
+                frame.diff = luma_thumbnail_diff(result.last, thumbnail);
+            }
+            result.last = thumbnail;
+
+            // Dark on average isn't enough, a dark scene has brighter parts
+            int brightest = *std::max_element(thumbnail.blocks, thumbnail.blocks + sizeof(thumbnail.blocks));
+            if (frame.mean_luma < BLACK_MEAN_LUMA && brightest < BLACK_MAX_BLOCK) {
+                frame.flags |= SCENE_BLACK;
+            }
+        }
+        result.frames.push_back(frame);
+        if (frames_done) {
+            ++*frames_done;
+        }
+    }, nullptr);
+
+    // Join the ranges up at their boundaries
+    frames->clear();
+    const SceneRange* previous = NULL;
+    for (auto& result : results) {
+        if (previous && result.has_thumbnail && !result.frames.empty() && result.frames[0].diff < 0 && result.frames[0].mean_luma >= 0) {
+            result.frames[0].diff = luma_thumbnail_diff(previous->last, result.first);
+        }
+        if (result.has_thumbnail) {
+            previous = &result;
+        }
+        frames->insert(frames->end(), result.frames.begin(), result.frames.end());
+    }
+
+    for (size_t i = 0; i < frames->size(); ++i) {
+        auto& frame = (*frames)[i];
+        frame.time_start = frame.pts * seconds_per_tick;
+        if (i > 0) {
+            (*frames)[i - 1].time_end = frame.time_start;
+        }
+    }
+    if (!frames->empty()) {
+        auto& last = frames->back();
+        float duration = frames->size() > 1 ? (*frames)[frames->size() - 2].time_end - (*frames)[frames->size() - 2].time_start : 0;
+        last.time_end = last.time_start + duration;
+    }
+
+    classify(frames);
+    return success;
+}
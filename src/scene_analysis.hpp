@@ -0,0 +1,56 @@
+#ifndef scene_analysis_hpp
+#define scene_analysis_hpp
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+#include "packet_index.hpp"
+#include "thread_pool.hpp"
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Average luma of a grid of blocks over the frame, taken straight from the
+// decoder's Y plane
+struct LumaThumbnail {
+    static constexpr int WIDTH = 32;
+    static constexpr int HEIGHT = 18;
+
+    uint8_t blocks[WIDTH * HEIGHT];
+    float mean; // of the whole plane, 0-255
+};
+
+// Fills the thumbnail from a YUV or gray frame of any bit depth. Returns
+// false for pixel formats without a luma plane.
+bool luma_thumbnail_compute(const AVFrame* frame, LumaThumbnail* thumbnail);
+
+// Mean absolute difference between the blocks of two thumbnails, 0-255
+float luma_thumbnail_diff(const LumaThumbnail& a, const LumaThumbnail& b);
+
+enum SceneFlags : unsigned char {
+    SCENE_CUT    = 1 << 0, // first frame after a cut
+    SCENE_BLACK  = 1 << 1,
+    SCENE_FROZEN = 1 << 2, // part of a run of (nearly) identical frames
+};
+
+struct SceneFrame {
+    int pts;
+    float time_start; // on the video row
+    float time_end;
+    float mean_luma;
+    float diff; // from the frame before, -1 for the first frame
+    unsigned char flags;
+};
+
+// Finds cuts, black frames and frozen frames in the video stream, decoding
+// GOP ranges in parallel. Frames are returned in presentation order;
+// frames_done counts up as it goes, for progress.
+bool scene_analysis_run(const char* filename,
+                        PacketIndex* index,
+                        ThreadPool* pool,
+                        const std::atomic_bool* cancel,
+                        std::atomic_int* frames_done,
+                        std::vector<SceneFrame>* frames);
+
+#endif
@@ -0,0 +1,206 @@
+#include "side_data_overlay.hpp"
+#include "profiler.hpp"
+#include <ddui/core>
+#include <algorithm>
+#include <limits.h>
+#include <stdio.h>
+
+extern "C" {
+#include <libavutil/motion_vector.h>
+#include <libavutil/video_enc_params.h>
+}
+
+constexpr int NUM_QP_LEVELS = 8; // one path each, from the frame's lowest to highest QP
+
+// Constructor, destructor
+void SideDataOverlay::init(SideDataOverlay* overlay) {
+    overlay->entries.clear();
+    overlay->bytes = 0;
+    overlay->clock = 0;
+}
+
+void SideDataOverlay::destroy(SideDataOverlay* overlay) {
+    overlay->entries = std::vector<Entry>();
+    overlay->bytes = 0;
+}
+
+static SideDataOverlay::Entry* find_entry(SideDataOverlay* overlay, int pts) {
+    for (auto& entry : overlay->entries) {
+        if (entry.pts == pts) {
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+bool side_data_overlay_has(SideDataOverlay* overlay, int pts) {
+    std::lock_guard<std::mutex> lock(overlay->mutex);
+    return find_entry(overlay, pts) != NULL;
+}
+
+static void extract_motion_vectors(const AVFrame* frame, SideDataOverlay::Entry* entry) {
+    auto side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_MOTION_VECTORS);
+    if (!side_data) {
+        return;
+    }
+    auto mvs = (const AVMotionVector*)side_data->data;
+    int count = side_data->size / sizeof(AVMotionVector);
+
+    // Past references first, so each direction draws as one path
+    entry->vectors.reserve(count);
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int i = 0; i < count; ++i) {
+            auto& mv = mvs[i];
+            if ((mv.source > 0) != (pass == 1) || (mv.src_x == mv.dst_x && mv.src_y == mv.dst_y)) {
+                continue;
+            }
+            entry->vectors.push_back({ (int16_t)mv.src_x, (int16_t)mv.src_y, (int16_t)mv.dst_x, (int16_t)mv.dst_y });
+        }
+        if (pass == 0) {
+            entry->num_past = (int)entry->vectors.size();
+        }
+    }
+}
+
+static void extract_qp(const AVFrame* frame, SideDataOverlay::Entry* entry) {
+    auto side_data = av_frame_get_side_data(frame, AV_FRAME_DATA_VIDEO_ENC_PARAMS);
+    if (!side_data) {
+        return;
+    }
+    auto params = (AVVideoEncParams*)side_data->data;
+
+    entry->qp_min = INT_MAX;
+    entry->qp_max = INT_MIN;
+    auto add_block = [&](int x, int y, int width, int height, int qp) {
+        entry->blocks.push_back({ (uint16_t)x, (uint16_t)y,
+                                  (uint16_t)width, (uint16_t)height,
+                                  (int16_t)qp });
+        entry->qp_min = std::min(entry->qp_min, qp);
+        entry->qp_max = std::max(entry->qp_max, qp);
+    };
+
+    // Some codecs only give a QP for the whole frame
+    if (params->nb_blocks == 0) {
+        add_block(0, 0, frame->width, frame->height, params->qp);
+        return;
+    }
+    entry->blocks.reserve(params->nb_blocks);
+    for (unsigned int i = 0; i < params->nb_blocks; ++i) {
+        auto block = av_video_enc_params_block(params, i);
+        add_block(block->src_x, block->src_y, block->w, block->h, params->qp + block->delta_qp);
+    }
+}
+
+void side_data_overlay_add(SideDataOverlay* overlay, int pts, const AVFrame* frame) {
+    PROFILE_SCOPE("side_data_overlay_add");
+
+    // Extract outside the lock, the UI thread may be drawing
+    SideDataOverlay::Entry entry;
+    entry.pts = pts;
+    entry.frame_width = frame->width;
+    entry.frame_height = frame->height;
+    entry.num_past = 0;
+    entry.qp_min = 0;
+    entry.qp_max = 0;
+    extract_motion_vectors(frame, &entry);
+    extract_qp(frame, &entry);
+    entry.bytes = sizeof(entry) +
+                  entry.vectors.size() * sizeof(SideDataOverlay::MotionVector) +
+                  entry.blocks.size() * sizeof(SideDataOverlay::QpBlock);
+
+    std::lock_guard<std::mutex> lock(overlay->mutex);
+    if (find_entry(overlay, pts)) {
+        return;
+    }
+
+    // Make room, least recently used first
+    while (!overlay->entries.empty() && overlay->bytes + entry.bytes > SideDataOverlay::BUDGET) {
+        auto oldest = std::min_element(overlay->entries.begin(), overlay->entries.end(), [](const SideDataOverlay::Entry& a, const SideDataOverlay::Entry& b) {
+            return a.last_used < b.last_used;
+        });
+        overlay->bytes -= oldest->bytes;
+        std::swap(*oldest, overlay->entries.back());
+        overlay->entries.pop_back();
+    }
+    entry.last_used = ++overlay->clock;
+    overlay->bytes += entry.bytes;
+    overlay->entries.push_back(std::move(entry));
+}
+
+void side_data_overlay_clear(SideDataOverlay* overlay) {
+    std::lock_guard<std::mutex> lock(overlay->mutex);
+    overlay->entries.clear();
+    overlay->bytes = 0;
+}
+
+void side_data_overlay_draw(SideDataOverlay* overlay, int pts, float x, float y, float width, float height) {
+    PROFILE_SCOPE("side_data_overlay_draw");
+
+    std::lock_guard<std::mutex> lock(overlay->mutex);
+    auto entry = find_entry(overlay, pts);
+    if (!entry || entry->frame_width == 0 || entry->frame_height == 0) {
+        return;
+    }
+    entry->last_used = ++overlay->clock;
+
+    float scale_x = width / entry->frame_width;
+    float scale_y = height / entry->frame_height;
+
+    ddui::save();
+    ddui::translate(x, y);
+
+    // QP map, low QP (fine quantization) green to high QP red, batched into
+    // one path per level
+    int qp_range = std::max(1, entry->qp_max - entry->qp_min);
+    for (int level = 0; level < NUM_QP_LEVELS; ++level) {
+        bool any = false;
+        ddui::begin_path();
+        for (auto& block : entry->blocks) {
+            int block_level = std::min((block.qp - entry->qp_min) * NUM_QP_LEVELS / qp_range, NUM_QP_LEVELS - 1);
+            if (block_level != level) {
+                continue;
+            }
+            ddui::rect(block.x * scale_x, block.y * scale_y, block.width * scale_x, block.height * scale_y);
+            any = true;
+        }
+        if (any) {
+            int red = 255 * level / (NUM_QP_LEVELS - 1);
+            auto color = ddui::rgb((red << 16) | ((255 - red) << 8) | 0x33);
+            color.a = 0.35;
+            ddui::fill_color(color);
+            ddui::fill();
+        }
+    }
+
+    // Motion vectors, from the block to where it is predicted from, as one
+    // path per reference direction
+    ddui::stroke_width(1.0);
+    for (int direction = 0; direction < 2; ++direction) {
+        int from = direction == 0 ? 0 : entry->num_past;
+        int to = direction == 0 ? entry->num_past : (int)entry->vectors.size();
+        if (from == to) {
+            continue;
+        }
+        ddui::begin_path();
+        for (int i = from; i < to; ++i) {
+            auto& mv = entry->vectors[i];
+            ddui::move_to(mv.dst_x * scale_x, mv.dst_y * scale_y);
+            ddui::line_to(mv.src_x * scale_x, mv.src_y * scale_y);
+        }
+        ddui::stroke_color(ddui::rgb(direction == 0 ? 0x33ccff : 0xff55dd));
+        ddui::stroke();
+    }
+
+    char legend[64];
+    if (entry->blocks.empty()) {
+        snprintf(legend, sizeof(legend), "%zu vectors", entry->vectors.size());
+    } else {
+        snprintf(legend, sizeof(legend), "QP %d-%d  %zu vectors", entry->qp_min, entry->qp_max, entry->vectors.size());
+    }
+    ddui::fill_color(ddui::rgb(0xffffff));
+    ddui::font_face("mono");
+    ddui::font_size(11);
+    ddui::text(4, height - 4, legend, NULL);
+
+    ddui::restore();
+}
@@ -0,0 +1,71 @@
+#ifndef side_data_overlay_hpp
+#define side_data_overlay_hpp
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Motion vectors and QP of decoded frames, as exported by the decoder when
+// video_reader_set_export_side_data is on, kept in a compact form by pts.
+// The decoder's side data is around 40 bytes per vector; here it is 8, and
+// vectors that don't move are dropped.
+struct SideDataOverlay {
+    static constexpr long BUDGET = 32 * 1024 * 1024; // bytes
+
+    struct MotionVector {
+        int16_t src_x; // frame pixels
+        int16_t src_y;
+        int16_t dst_x;
+        int16_t dst_y;
+    };
+
+    struct QpBlock {
+        uint16_t x; // frame pixels
+        uint16_t y;
+        uint16_t width; // the whole frame for codecs with one QP per frame
+        uint16_t height;
+        int16_t qp;
+    };
+
+    struct Entry {
+        int pts;
+        int frame_width;
+        int frame_height;
+        int num_past; // vectors from past references come first, then future ones
+        std::vector<MotionVector> vectors;
+        std::vector<QpBlock> blocks;
+        int qp_min;
+        int qp_max;
+        unsigned long last_used;
+        long bytes;
+    };
+
+    // Written by the video thread, drawn by the UI thread
+    std::mutex mutex;
+    std::vector<Entry> entries;
+    long bytes;
+    unsigned long clock;
+
+    // Constructor, destructor
+    static void init(SideDataOverlay* overlay);
+    static void destroy(SideDataOverlay* overlay);
+};
+
+bool side_data_overlay_has(SideDataOverlay* overlay, int pts);
+
+// Stores the frame's motion vectors and QP under pts, evicting least
+// recently drawn frames to stay in the budget. A frame without side data is
+// stored as such, so that it isn't decoded again to look for it.
+void side_data_overlay_add(SideDataOverlay* overlay, int pts, const AVFrame* frame);
+
+void side_data_overlay_clear(SideDataOverlay* overlay);
+
+// Draws the QP map and motion vectors of the frame at pts over the preview
+// at (x, y, width, height). Draws nothing if the frame hasn't been added.
+void side_data_overlay_draw(SideDataOverlay* overlay, int pts, float x, float y, float width, float height);
+
+#endif
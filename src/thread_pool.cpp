@@ -0,0 +1,88 @@
+#include "thread_pool.hpp"
+#include "profiler.hpp"
+#include <thread>
+
+static void* worker_func(void* ptr) {
+    auto pool = (ThreadPool*)ptr;
+    profiler_set_thread_name("pool");
+
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->cv.wait(lock, [&]() { return pool->stopping || !pool->tasks.empty(); });
+            if (pool->tasks.empty()) {
+                return 0;
+            }
+            task = std::move(pool->tasks.front());
+            pool->tasks.pop_front();
+        }
+        task();
+    }
+}
+
+// Constructor, destructor
+void ThreadPool::init(ThreadPool* pool, int num_threads) {
+    pool->stopping = false;
+    pool->threads.resize(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+        pthread_create(&pool->threads[i], NULL, worker_func, pool);
+    }
+}
+
+void ThreadPool::destroy(ThreadPool* pool) {
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->stopping = true;
+    }
+    pool->cv.notify_all();
+    for (auto thread : pool->threads) {
+        pthread_join(thread, NULL);
+    }
+    pool->threads.clear();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push_back(std::move(task));
+    }
+    this->cv.notify_one();
+}
+
+int ThreadPool::num_threads() {
+    return this->threads.size();
+}
+
+void TaskGroup::submit(ThreadPool* pool, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        ++this->pending;
+    }
+    pool->submit([this, task]() {
+        task();
+        std::lock_guard<std::mutex> lock(this->mutex);
+        --this->pending;
+        this->cv.notify_all();
+    });
+}
+
+void TaskGroup::wait() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [&]() { return this->pending == 0; });
+}
+
+void TaskGroup::wait_below(int max_pending) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->cv.wait(lock, [&]() { return this->pending <= max_pending; });
+}
+
+ThreadPool* thread_pool_shared() {
+    static ThreadPool* pool = []() {
+        auto pool = new ThreadPool;
+        int num_threads = std::thread::hardware_concurrency();
+        ThreadPool::init(pool, num_threads > 0 ? num_threads : 4);
+        return pool;
+    }();
+    return pool;
+}
@@ -0,0 +1,43 @@
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <pthread.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+struct ThreadPool {
+    std::vector<pthread_t> threads;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    bool stopping;
+
+    // Constructor, destructor
+    static void init(ThreadPool* pool, int num_threads);
+    static void destroy(ThreadPool* pool);
+
+    void submit(std::function<void()> task);
+    int num_threads();
+};
+
+// Counts outstanding tasks so that a caller can wait for just its own work
+// on a pool that is shared with others
+struct TaskGroup {
+    std::mutex mutex;
+    std::condition_variable cv;
+    int pending = 0;
+
+    void submit(ThreadPool* pool, std::function<void()> task);
+    void wait();
+    // Waits until at most max_pending tasks are outstanding, so that a
+    // producer can't run too far ahead of the pool
+    void wait_below(int max_pending);
+};
+
+// Pool with one thread per core, shared by all background analysis
+ThreadPool* thread_pool_shared();
+
+#endif
@@ -0,0 +1,320 @@
+#include "timeline.hpp"
+#include "profiler.hpp"
+#include <ddui/core>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+// Lookup the range of packets visible between time_from and time_to
+static void visible_packets(std::vector<PacketInfo>* packets,
+                            float time_from,
+                            float time_to,
+                            int* packet_from,
+                            int* packet_to) {
+    PacketInfo pkt_lower_bound, pkt_upper_bound;
+    pkt_lower_bound.time_end = time_from;
+    pkt_upper_bound.time_start = time_to;
+
+    auto it_from = std::lower_bound(packets->begin(), packets->end(), pkt_lower_bound, cmp_pkt_end);
+    auto it_to   = std::upper_bound(it_from,          packets->end(), pkt_upper_bound, cmp_pkt_start);
+
+    *packet_from = it_from - packets->begin();
+    *packet_to   = it_to   - packets->begin();
+}
+
+float draw_packets(std::vector<PacketInfo>* packets,
+                   float time_from,
+                   float time_to,
+                   float second_width,
+                   float y,
+                   int pkt_highlighted,
+                   int* next_pkt_hovering,
+                   int* pkt_clicked) {
+    PROFILE_SCOPE("draw_packets");
+
+    int packet_from, packet_to;
+    visible_packets(packets, time_from, time_to, &packet_from, &packet_to);
+
+    ddui::stroke_width(1.0);
+    for (int i = packet_from; i < packet_to; ++i) {
+        auto& pkt = (*packets)[i];
+        float pkt_x = pkt.time_start * second_width;
+        float pkt_w = pkt.time_end   * second_width - pkt_x;
+        float pkt_h = FRAME_HEIGHT;
+
+        ddui::Color c;
+        switch (pkt.type) {
+            case PacketInfo::AUDIO:       c = ddui::rgb(0x33ff33); break;
+            case PacketInfo::VIDEO_KEY:   c = ddui::rgb(0x3388ff); break;
+            case PacketInfo::VIDEO_DELTA: c = ddui::rgb(0xff9922); break;
+        }
+
+        // Delta pictures by type where the bitstream told us, with the ones
+        // nothing references faded out
+        if (pkt.type == PacketInfo::VIDEO_DELTA) {
+            switch (pkt.picture) {
+                case PICTURE_I: c = ddui::rgb(0x33ccff); break;
+                case PICTURE_P: c = ddui::rgb(0xff9922); break;
+                case PICTURE_B: c = ddui::rgb(0xdd55ff); break;
+                default: break;
+            }
+            if (!pkt.is_reference) {
+                c.a = 0.5;
+            }
+        }
+
+        ddui::begin_path();
+        ddui::rect(pkt_x, y, pkt_w, FRAME_HEIGHT);
+        ddui::stroke_color(c);
+        ddui::stroke();
+        if (pkt.index == pkt_highlighted) {
+            ddui::fill_color(c);
+            ddui::fill();
+        }
+        if (ddui::mouse_over(pkt_x, y, pkt_w, pkt_h)) {
+            ddui::set_cursor(ddui::CURSOR_POINTING_HAND);
+            *next_pkt_hovering = pkt.index;
+        }
+        if (ddui::mouse_hit(pkt_x, y, pkt_w, pkt_h)) {
+            ddui::mouse_hit_accept();
+            *pkt_clicked = pkt.index;
+        }
+    }
+
+    y += FRAME_HEIGHT + Y_SPACING;
+
+    return y;
+}
+
+static ddui::Color heat_color(float t) {
+    // Dark blue for cheap packets, through orange, to red at the scale
+    static const float stops[3][3] = {
+        { 0x22, 0x33, 0x66 },
+        { 0xff, 0x99, 0x22 },
+        { 0xff, 0x22, 0x22 },
+    };
+    t = std::max(0.0f, std::min(1.0f, t)) * 2;
+    int i = std::min((int)t, 1);
+    float f = t - i;
+    int r = stops[i][0] + (stops[i + 1][0] - stops[i][0]) * f;
+    int g = stops[i][1] + (stops[i + 1][1] - stops[i][1]) * f;
+    int b = stops[i][2] + (stops[i + 1][2] - stops[i][2]) * f;
+    return ddui::rgb((r << 16) | (g << 8) | b);
+}
+
+float draw_decode_costs(std::vector<PacketInfo>* packets,
+                        float time_from,
+                        float time_to,
+                        float second_width,
+                        float y,
+                        float scale_ms) {
+    PROFILE_SCOPE("draw_decode_costs");
+
+    int packet_from, packet_to;
+    visible_packets(packets, time_from, time_to, &packet_from, &packet_to);
+
+    char label[32];
+    ddui::font_face("mono");
+    ddui::font_size(11);
+    for (int i = packet_from; i < packet_to; ++i) {
+        auto& pkt = (*packets)[i];
+        if (pkt.decode_ms < 0) {
+            continue;
+        }
+        float pkt_x = pkt.time_start * second_width;
+        float pkt_w = pkt.time_end   * second_width - pkt_x;
+
+        ddui::begin_path();
+        ddui::rect(pkt_x, y, pkt_w, FRAME_HEIGHT);
+        ddui::fill_color(heat_color(scale_ms > 0 ? pkt.decode_ms / scale_ms : 0));
+        ddui::fill();
+
+        // Label the packets that are wide enough to hold one
+        if (pkt_w >= 48) {
+            snprintf(label, sizeof(label), "%.2fms", pkt.decode_ms);
+            ddui::fill_color(ddui::rgb(0xffffff));
+            ddui::text(pkt_x + 3, y + 14, label, NULL);
+        }
+    }
+
+    y += FRAME_HEIGHT + Y_SPACING;
+
+    return y;
+}
+
+float draw_anomalies(const std::vector<TimestampAnomaly>* anomalies,
+                     float time_from,
+                     float time_to,
+                     float second_width,
+                     float y,
+                     int selected) {
+    PROFILE_SCOPE("draw_anomalies");
+
+    constexpr float MARKER_WIDTH = 6;
+    constexpr float MONO_ADVANCE = 11 * 0.6; // PT Mono at 11px
+
+    auto by_time = [](const TimestampAnomaly& anomaly, float time) {
+        return anomaly.time < time;
+    };
+    auto it_from = std::lower_bound(anomalies->begin(), anomalies->end(), time_from, by_time);
+    auto it_to   = std::lower_bound(it_from,            anomalies->end(), time_to,   by_time);
+
+    char label[64];
+    ddui::font_face("mono");
+    ddui::font_size(11);
+    float last_label_end = -1e9;
+    for (auto it = it_from; it != it_to; ++it) {
+        auto& anomaly = *it;
+        float x = anomaly.time * second_width;
+
+        ddui::Color c;
+        switch (anomaly.kind) {
+            case TimestampAnomaly::GAP:               c = ddui::rgb(0xffdd33); break;
+            case TimestampAnomaly::DTS_NOT_MONOTONIC: c = ddui::rgb(0xff3333); break;
+            case TimestampAnomaly::DUPLICATE_PTS:     c = ddui::rgb(0xff66cc); break;
+            case TimestampAnomaly::AV_DRIFT:          c = ddui::rgb(0x33ffee); break;
+        }
+
+        ddui::begin_path();
+        ddui::move_to(x, y);
+        ddui::line_to(x + MARKER_WIDTH / 2, y + FRAME_HEIGHT);
+        ddui::line_to(x - MARKER_WIDTH / 2, y + FRAME_HEIGHT);
+        ddui::fill_color(c);
+        ddui::fill();
+
+        // Label the selected marker, and others where there is room
+        int i = it - anomalies->begin();
+        bool hovered = ddui::mouse_over(x - MARKER_WIDTH / 2, y, MARKER_WIDTH, FRAME_HEIGHT);
+        if (i == selected || hovered || x > last_label_end) {
+            timestamp_anomaly_describe(anomaly, label, sizeof(label));
+            float label_x = x + MARKER_WIDTH;
+            ddui::fill_color(i == selected || hovered ? ddui::rgb(0xffffff) : c);
+            ddui::text(label_x, y + 14, label, NULL);
+            last_label_end = label_x + strlen(label) * MONO_ADVANCE + MARKER_WIDTH;
+        }
+    }
+
+    y += FRAME_HEIGHT + Y_SPACING;
+
+    return y;
+}
+
+float draw_scene_frames(const std::vector<SceneFrame>* frames,
+                        float time_from,
+                        float time_to,
+                        float second_width,
+                        float y) {
+    PROFILE_SCOPE("draw_scene_frames");
+
+    constexpr float STRIP_HEIGHT = 4;
+
+    auto it_from = std::lower_bound(frames->begin(), frames->end(), time_from, [](const SceneFrame& frame, float time) {
+        return frame.time_end < time;
+    });
+    auto it_to = std::upper_bound(it_from, frames->end(), time_to, [](float time, const SceneFrame& frame) {
+        return time < frame.time_start;
+    });
+
+    for (auto it = it_from; it != it_to; ++it) {
+        auto& frame = *it;
+        float x = frame.time_start * second_width;
+        float w = frame.time_end * second_width - x;
+        if (frame.mean_luma < 0) {
+            continue;
+        }
+
+        // The frame's brightness, which shows fades and cuts at a glance
+        int luma = (int)frame.mean_luma;
+        ddui::begin_path();
+        ddui::rect(x, y, w, FRAME_HEIGHT);
+        ddui::fill_color(ddui::rgb((luma << 16) | (luma << 8) | luma));
+        ddui::fill();
+
+        if (frame.flags & SCENE_BLACK) {
+            ddui::begin_path();
+            ddui::rect(x, y + FRAME_HEIGHT - STRIP_HEIGHT, w, STRIP_HEIGHT);
+            ddui::fill_color(ddui::rgb(0xff3333));
+            ddui::fill();
+        }
+        if (frame.flags & SCENE_FROZEN) {
+            ddui::begin_path();
+            ddui::rect(x, y, w, STRIP_HEIGHT);
+            ddui::fill_color(ddui::rgb(0x33ccff));
+            ddui::fill();
+        }
+        if (frame.flags & SCENE_CUT) {
+            ddui::begin_path();
+            ddui::rect(x - 1, y - 2, 2, FRAME_HEIGHT + 4);
+            ddui::fill_color(ddui::rgb(0xffdd33));
+            ddui::fill();
+        }
+    }
+
+    y += FRAME_HEIGHT + Y_SPACING;
+
+    return y;
+}
+
+float draw_loudness(const LoudnessResult* loudness,
+                    float time_from,
+                    float time_to,
+                    float second_width,
+                    float y) {
+    PROFILE_SCOPE("draw_loudness");
+
+    constexpr float ROW_HEIGHT = 2 * FRAME_HEIGHT;
+    constexpr float LUFS_MIN = -60; // bottom of the row
+    constexpr float LUFS_LOUD = -9; // bars above are drawn red
+
+    auto height_of = [&](float lufs) {
+        return std::min(std::max((lufs - LUFS_MIN) / -LUFS_MIN, 0.0f), 1.0f) * ROW_HEIGHT;
+    };
+
+    auto& blocks = loudness->blocks;
+    auto it_from = std::lower_bound(blocks.begin(), blocks.end(), time_from, [](const LoudnessBlock& block, float time) {
+        return block.time_end < time;
+    });
+    auto it_to = std::upper_bound(it_from, blocks.end(), time_to, [](float time, const LoudnessBlock& block) {
+        return time < block.time_start;
+    });
+
+    // One path per colour
+    for (int loud = 0; loud < 2; ++loud) {
+        ddui::begin_path();
+        for (auto it = it_from; it != it_to; ++it) {
+            if ((it->momentary > LUFS_LOUD) != (loud == 1)) {
+                continue;
+            }
+            float h = height_of(it->momentary);
+            if (h <= 0) {
+                continue;
+            }
+            float x = it->time_start * second_width;
+            float w = it->time_end * second_width - x;
+            ddui::rect(x, y + ROW_HEIGHT - h, w, h);
+        }
+        ddui::fill_color(ddui::rgb(loud ? 0xff3333 : 0x33cc66));
+        ddui::fill();
+    }
+
+    float x_from = time_from * second_width;
+    float x_to = time_to * second_width;
+    if (loudness->integrated > LUFS_MIN) {
+        ddui::begin_path();
+        ddui::rect(x_from, y + ROW_HEIGHT - height_of(loudness->integrated), x_to - x_from, 1);
+        ddui::fill_color(ddui::rgb(0xffffff));
+        ddui::fill();
+    }
+
+    char summary[128];
+    snprintf(summary, sizeof(summary), "I %.1f LUFS  LRA %.1f LU  TP %.1f dBTP",
+             loudness->integrated, loudness->range, loudness->true_peak);
+    ddui::fill_color(ddui::rgb(0xffffff));
+    ddui::font_face("mono");
+    ddui::font_size(11);
+    ddui::text(x_from + 4, y + 12, summary, NULL);
+
+    y += ROW_HEIGHT + Y_SPACING;
+
+    return y;
+}
@@ -0,0 +1,66 @@
+#ifndef timeline_hpp
+#define timeline_hpp
+
+#include <vector>
+#include "packet_index.hpp"
+#include "timestamp_anomalies.hpp"
+#include "scene_analysis.hpp"
+#include "loudness.hpp"
+
+constexpr float FRAME_HEIGHT = 20;
+constexpr float Y_SPACING = 10;
+
+// Draws the packets visible between time_from and time_to as one row at y,
+// filling in pkt_highlighted. Reports the packet under the mouse through
+// next_pkt_hovering and a clicked packet through pkt_clicked.
+// Returns the y of the next row.
+float draw_packets(std::vector<PacketInfo>* packets,
+                   float time_from,
+                   float time_to,
+                   float second_width,
+                   float y,
+                   int pkt_highlighted,
+                   int* next_pkt_hovering,
+                   int* pkt_clicked);
+
+// Draws the measured decode time of each packet visible between time_from
+// and time_to as a heatmap row at y, with scale_ms and above in the hottest
+// colour. Packets without a measurement are left empty.
+// Returns the y of the next row.
+float draw_decode_costs(std::vector<PacketInfo>* packets,
+                        float time_from,
+                        float time_to,
+                        float second_width,
+                        float y,
+                        float scale_ms);
+
+// Draws a marker for each anomaly visible between time_from and time_to as
+// one row at y, labelling the selected one and the one under the mouse.
+// Returns the y of the next row.
+float draw_anomalies(const std::vector<TimestampAnomaly>* anomalies,
+                     float time_from,
+                     float time_to,
+                     float second_width,
+                     float y,
+                     int selected);
+
+// Draws the mean luma of each analysed frame visible between time_from and
+// time_to as one row at y, with black and frozen frames and cuts marked.
+// Returns the y of the next row.
+float draw_scene_frames(const std::vector<SceneFrame>* frames,
+                        float time_from,
+                        float time_to,
+                        float second_width,
+                        float y);
+
+// Draws the momentary loudness of each 100ms block visible between
+// time_from and time_to as a row of bars at y, with the integrated loudness
+// as a line and the file's figures written over it.
+// Returns the y of the next row.
+float draw_loudness(const LoudnessResult* loudness,
+                    float time_from,
+                    float time_to,
+                    float second_width,
+                    float y);
+
+#endif
@@ -0,0 +1,156 @@
+#include "timestamp_anomalies.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+constexpr float GAP_MIN_SECONDS = 0.001;
+constexpr float AV_DRIFT_SECONDS = 0.5;
+
+// One stream's packets in decode order, as columns. The index keeps the
+// low 32 bits of each dts, so the columns unwrap them from the step between
+// packets; a packet without a dts repeats the one before and is skipped by
+// the checks.
+struct StreamColumns {
+    float seconds_per_tick;
+    std::vector<int> packet;
+    std::vector<int64_t> dts;
+    std::vector<unsigned char> has_dts;
+    std::vector<int> pts;
+    std::vector<float> duration;
+    int last_dts;
+    bool seen_dts;
+};
+
+// The checks compute a flag per packet in branch-free loops over the
+// columns, which the compiler vectorizes. Anomalies are rare, so collecting
+// the flagged packets afterwards is cheap.
+static void scan_stream(PacketIndex* index, bool is_video, const StreamColumns& columns, std::vector<TimestampAnomaly>* anomalies) {
+    auto& dts = columns.dts;
+    auto& has_dts = columns.has_dts;
+    auto& duration = columns.duration;
+    float seconds_per_tick = columns.seconds_per_tick;
+    size_t n = dts.size();
+
+    std::vector<unsigned char> backwards(n, 0);
+    std::vector<unsigned char> gap(n, 0);
+    for (size_t i = 1; i < n; ++i) {
+        backwards[i] = has_dts[i] & has_dts[i - 1] & (dts[i] <= dts[i - 1]);
+    }
+    for (size_t i = 1; i < n; ++i) {
+        // Packets without a duration can't tell us about gaps
+        float expected = duration[i - 1] > 0 ? duration[i - 1] : 1e9f;
+        float excess = (dts[i] - dts[i - 1]) * seconds_per_tick - expected;
+        gap[i] = has_dts[i] & has_dts[i - 1] & (excess > std::max(expected * 0.5f, GAP_MIN_SECONDS));
+    }
+
+    for (size_t i = 1; i < n; ++i) {
+        if (backwards[i]) {
+            anomalies->push_back({ TimestampAnomaly::DTS_NOT_MONOTONIC, is_video, columns.packet[i], columns.pts[i] * seconds_per_tick,
+                                   (dts[i - 1] - dts[i]) * seconds_per_tick });
+        } else if (gap[i] && !backwards[i - 1]) { // not the way back from a step back
+            anomalies->push_back({ TimestampAnomaly::GAP, is_video, columns.packet[i], columns.pts[i] * seconds_per_tick,
+                                   (dts[i] - dts[i - 1]) * seconds_per_tick - duration[i - 1] });
+        }
+    }
+
+    // Presentation order, which the stream rows already are in
+    auto& packets = is_video ? index->video_packets : index->audio_packets;
+    std::vector<unsigned char> duplicate(packets.size(), 0);
+    for (size_t i = 1; i < packets.size(); ++i) {
+        duplicate[i] = packets[i].has_pts & packets[i - 1].has_pts & (packets[i].pts == packets[i - 1].pts);
+    }
+    for (size_t i = 1; i < packets.size(); ++i) {
+        if (duplicate[i]) {
+            anomalies->push_back({ TimestampAnomaly::DUPLICATE_PTS, is_video, packets[i].index, packets[i].time_start, 0.0f });
+        }
+    }
+}
+
+std::vector<TimestampAnomaly> timestamp_anomalies_scan(PacketIndex* index) {
+    PROFILE_SCOPE("timestamp_anomalies_scan");
+
+    StreamColumns streams[2]; // audio, video
+    streams[0].seconds_per_tick = index->audio_time_base.num / (float)index->audio_time_base.den;
+    streams[1].seconds_per_tick = index->video_time_base.num / (float)index->video_time_base.den;
+    for (int s = 0; s < 2; ++s) {
+        streams[s].last_dts = 0;
+        streams[s].seen_dts = false;
+        size_t count = s ? index->video_packets.size() : index->audio_packets.size();
+        streams[s].packet.reserve(count);
+        streams[s].dts.reserve(count);
+        streams[s].has_dts.reserve(count);
+        streams[s].pts.reserve(count);
+        streams[s].duration.reserve(count);
+    }
+
+    // One pass over the packets in file order splits them into columns and
+    // follows how far apart the streams' timestamps are. Interleaved
+    // streams should carry about the same timestamps at the same place in
+    // the file, so each place where they start to differ by more than
+    // AV_DRIFT_SECONDS is flagged, until they are back within half of that.
+    std::vector<TimestampAnomaly> anomalies;
+    float last_time[2] = { 0, 0 };
+    bool seen[2] = { false, false };
+    bool drifting = false;
+    for (auto& pkt : index->all_packets) {
+        int s = pkt.type != PacketInfo::AUDIO;
+        auto& columns = streams[s];
+        int64_t dts = pkt.dts;
+        if (columns.seen_dts) {
+            dts = columns.dts.back();
+            if (pkt.has_dts) {
+                dts += (int)((unsigned int)pkt.dts - (unsigned int)columns.last_dts);
+            }
+        }
+        columns.packet.push_back(pkt.index);
+        columns.dts.push_back(dts);
+        columns.has_dts.push_back(pkt.has_dts);
+        columns.pts.push_back(pkt.pts);
+        columns.duration.push_back(pkt.duration);
+        if (!pkt.has_dts) {
+            continue;
+        }
+        columns.last_dts = pkt.dts;
+        columns.seen_dts = true;
+
+        last_time[s] = dts * columns.seconds_per_tick;
+        seen[s] = true;
+        if (!seen[0] || !seen[1]) {
+            continue;
+        }
+        float drift = last_time[0] - last_time[1];
+        if (!drifting && fabsf(drift) > AV_DRIFT_SECONDS) {
+            anomalies.push_back({ TimestampAnomaly::AV_DRIFT, s == 1, pkt.index, pkt.pts * columns.seconds_per_tick, drift });
+            drifting = true;
+        } else if (drifting && fabsf(drift) < AV_DRIFT_SECONDS / 2) {
+            drifting = false;
+        }
+    }
+
+    scan_stream(index, true,  streams[1], &anomalies);
+    scan_stream(index, false, streams[0], &anomalies);
+
+    std::sort(anomalies.begin(), anomalies.end(), [](const TimestampAnomaly& a, const TimestampAnomaly& b) {
+        return a.time < b.time;
+    });
+    return anomalies;
+}
+
+void timestamp_anomaly_describe(const TimestampAnomaly& anomaly, char* str, int size) {
+    auto stream = anomaly.is_video ? "video" : "audio";
+    switch (anomaly.kind) {
+        case TimestampAnomaly::GAP:
+            snprintf(str, size, "%s gap %.3fs", stream, anomaly.amount);
+            break;
+        case TimestampAnomaly::DTS_NOT_MONOTONIC:
+            snprintf(str, size, "%s dts back %.3fs", stream, anomaly.amount);
+            break;
+        case TimestampAnomaly::DUPLICATE_PTS:
+            snprintf(str, size, "%s duplicate pts", stream);
+            break;
+        case TimestampAnomaly::AV_DRIFT:
+            snprintf(str, size, "A/V drift %+.3fs", anomaly.amount);
+            break;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef timestamp_anomalies_hpp
+#define timestamp_anomalies_hpp
+
+#include <vector>
+#include "packet_index.hpp"
+
+struct TimestampAnomaly {
+    enum Kind : unsigned char {
+        GAP,               // the stream's dts jumps further than the packet's duration
+        DTS_NOT_MONOTONIC, // dts at or before the packet before it
+        DUPLICATE_PTS,
+        AV_DRIFT,          // audio and video timestamps apart at the same place in the file
+    };
+
+    Kind kind;
+    bool is_video;
+    int packet;   // index into all_packets
+    float time;   // on the stream rows, in seconds
+    float amount; // gap, step back or drift, in seconds
+};
+
+// Scans the packet table for timestamp problems, which the mixed row hides
+// by laying packets out by duration. Returns them sorted by time.
+std::vector<TimestampAnomaly> timestamp_anomalies_scan(PacketIndex* index);
+
+// Short description, e.g. "video gap 0.120s"
+void timestamp_anomaly_describe(const TimestampAnomaly& anomaly, char* str, int size);
+
+#endif
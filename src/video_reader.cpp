@@ -1,5 +1,8 @@
 #include "video_reader.hpp"
+#include "profiler.hpp"
+#include <algorithm>
 #include <assert.h>
+#include <string.h>
 #include <pthread.h>
 
 // av_err2str returns a temporary array. This doesn't work in gcc.
@@ -10,6 +13,10 @@ static const char* av_make_error(int errnum) {
     return av_make_error_string(str, AV_ERROR_MAX_STRING_SIZE, errnum);
 }
 
+constexpr int AVIO_BUFFER_SIZE = 64 * 1024;
+
+static VideoReaderProbeLimits probe_limits = PROBE_LIMITS_FAST;
+
 static AVPixelFormat correct_for_deprecated_pixel_format(AVPixelFormat pix_fmt) {
     // Fix swscaler deprecated pixel format warning
     // (YUVJ has been deprecated, change pixel format to regular YUV)
@@ -30,27 +37,169 @@ inline static float convert_s16(int16_t sample) {
     return (float)sample / -INT16_MIN;
 }
 
+// Each reader reads the shared source at its own position
+static int read_source(void* opaque, uint8_t* buf, int buf_size) {
+    auto state = (VideoReaderState*)opaque;
+    int bytes = state->source->read_at(state->source, state->source_pos, buf, buf_size);
+
+    // The demuxer never sees the end of a followed file, so it never has to
+    // deal with a packet cut short by the end of the data written so far
+    while (bytes == 0 && state->follow) {
+        if (state->should_cancel && state->should_cancel(state->should_cancel_opaque)) {
+            break;
+        }
+        if (state->source->wait_for_data(state->source, state->source_pos, 100)) {
+            bytes = state->source->read_at(state->source, state->source_pos, buf, buf_size);
+        }
+    }
+
+    if (bytes < 0) {
+        return AVERROR(EIO);
+    }
+    if (bytes == 0) {
+        return AVERROR_EOF;
+    }
+    state->source_pos += bytes;
+    return bytes;
+}
+
+static int64_t seek_source(void* opaque, int64_t offset, int whence) {
+    auto state = (VideoReaderState*)opaque;
+    switch (whence & ~AVSEEK_FORCE) {
+        case AVSEEK_SIZE:
+            return state->source->get_size(state->source);
+        case SEEK_SET:
+            state->source_pos = offset;
+            return state->source_pos;
+        case SEEK_CUR:
+            state->source_pos += offset;
+            return state->source_pos;
+        case SEEK_END: {
+            int64_t size = state->source->get_size(state->source);
+            if (size < 0) {
+                return AVERROR(ENOSYS);
+            }
+            state->source_pos = size + offset;
+            return state->source_pos;
+        }
+        default:
+            return AVERROR(EINVAL);
+    }
+}
+
+void video_reader_set_probe_limits(VideoReaderProbeLimits limits) {
+    probe_limits = limits;
+}
+
+// Codec contexts are opened on the first packet of their stream, so readers
+// that only demux (indexing, following) or discard a stream never pay for it
+static AVCodecContext* open_codec(VideoReaderState* state, int stream_index, AVCodec* codec) {
+    PROFILE_SCOPE("open_codec");
+
+    AVCodecContext* ctx = avcodec_alloc_context3(codec);
+    if (!ctx) {
+        printf("Couldn't create AVCodecContext\n");
+        return NULL;
+    }
+    if (avcodec_parameters_to_context(ctx, state->av_format_ctx->streams[stream_index]->codecpar) < 0) {
+        printf("Couldn't initialize AVCodecContext\n");
+        avcodec_free_context(&ctx);
+        return NULL;
+    }
+    if (stream_index == state->video_stream_index && state->export_side_data) {
+        ctx->export_side_data |= AV_CODEC_EXPORT_DATA_MVS | AV_CODEC_EXPORT_DATA_VIDEO_ENC_PARAMS;
+    }
+    if (avcodec_open2(ctx, codec, NULL) < 0) {
+        printf("Couldn't open codec\n");
+        avcodec_free_context(&ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
 bool video_reader_open(VideoReaderState* state, const char* filename) {
+    auto source = media_source_open(filename);
+    if (!source) {
+        return false;
+    }
+    bool success = video_reader_open_source(state, source);
+    media_source_release(source);
+    return success;
+}
+
+bool video_reader_open_source(VideoReaderState* state, MediaSource* source) {
+    PROFILE_SCOPE("video_reader_open");
 
     state->reached_end = false;
+    state->follow = false;
+    state->parse_picture_types = true;
+    state->export_side_data = false;
+    state->picture_parser_ready = false;
+    state->should_cancel = NULL;
+    state->should_cancel_opaque = NULL;
+    state->on_video_packet_decoded = NULL;
+    state->on_video_packet_decoded_opaque = NULL;
+
+    // Everything video_reader_close frees starts out empty, so any failure
+    // below can unwind through it
+    state->av_format_ctx = NULL;
+    state->avio_ctx = NULL;
+    state->av_packet = NULL;
+    state->video_codec_ctx = NULL;
+    state->audio_codec_ctx = NULL;
+    state->video_frame = NULL;
+    state->audio_frame = NULL;
+    state->sws_scaler_ctx = NULL;
+
+    // Read through our own AVIOContext so that readers can share one source
+    state->source = media_source_retain(source);
+    state->source_pos = 0;
+    auto avio_buffer = (unsigned char*)av_malloc(AVIO_BUFFER_SIZE);
+    if (avio_buffer) {
+        state->avio_ctx = avio_alloc_context(avio_buffer, AVIO_BUFFER_SIZE, 0, state, read_source, NULL, seek_source);
+    }
+    if (!state->avio_ctx) {
+        printf("Couldn't create AVIOContext\n");
+        av_free(avio_buffer);
+        video_reader_close(state);
+        return false;
+    }
 
     // Open the file using libavformat
     AVFormatContext* av_format_ctx = state->av_format_ctx = avformat_alloc_context();
     if (!av_format_ctx) {
         printf("Couldn't created AVFormatContext\n");
+        video_reader_close(state);
         return false;
     }
-
-    if (avformat_open_input(&av_format_ctx, filename, NULL, NULL) != 0) {
+    av_format_ctx->pb = state->avio_ctx;
+
+    // FFmpeg's defaults let some demuxers (e.g. MPEG-TS) read megabytes
+    // before the first packet. Anything not found within the limits is
+    // picked up from the first decoded frame instead.
+    AVDictionary* options = NULL;
+    av_dict_set_int(&options, "probesize", probe_limits.probe_size, 0);
+    av_dict_set_int(&options, "formatprobesize", probe_limits.probe_size, 0);
+    av_dict_set_int(&options, "analyzeduration", probe_limits.analyze_duration, 0);
+    int response = avformat_open_input(&av_format_ctx, source->filename.c_str(), NULL, &options);
+    av_dict_free(&options);
+    if (response != 0) {
+        // avformat_open_input has freed the context, but not our AVIOContext
         printf("Couldn't open audio file\n");
+        state->av_format_ctx = NULL;
+        video_reader_close(state);
         return false;
     }
 
     // Find the first valid audio stream inside the file
     state->video_stream_index = -1;
     state->audio_stream_index = -1;
-    AVCodecParameters* video_codec_params;
-    AVCodecParameters* audio_codec_params;
+    state->width = 0;
+    state->height = 0;
+    state->frame_rate = 0;
+    state->num_channels = 0;
+    state->sample_rate = 0;
+    state->sample_format = AV_SAMPLE_FMT_NONE;
     AVCodec* video_codec = NULL;
     AVCodec* audio_codec = NULL;
     for (int i = 0; i < av_format_ctx->nb_streams; ++i) {
@@ -61,7 +210,6 @@ bool video_reader_open(VideoReaderState* state, const char* filename) {
             continue;
         }
         if (!video_codec && av_codec_params->codec_type == AVMEDIA_TYPE_VIDEO) {
-            video_codec_params = av_codec_params;
             video_codec = av_codec;
             state->video_stream_index = i;
             state->width = av_codec_params->width;
@@ -71,10 +219,10 @@ bool video_reader_open(VideoReaderState* state, const char* filename) {
             continue;
         }
         if (!audio_codec && av_codec_params->codec_type == AVMEDIA_TYPE_AUDIO) {
-            audio_codec_params = av_codec_params;
             audio_codec = av_codec;
-            state->num_channels = audio_codec_params->channels;
-            state->sample_rate = audio_codec_params->sample_rate;
+            state->num_channels = av_codec_params->channels;
+            state->sample_rate = av_codec_params->sample_rate;
+            state->sample_format = (AVSampleFormat)av_codec_params->format;
             state->audio_stream_index = i;
             state->audio_time_base = av_stream->time_base;
             continue;
@@ -82,94 +230,104 @@ bool video_reader_open(VideoReaderState* state, const char* filename) {
     }
     if (!audio_codec && !video_codec) {
         printf("Couldn't find valid audio or video stream inside file\n");
+        video_reader_close(state);
         return false;
     }
 
+    // Formats with timestamp discontinuities (MPEG-TS, MPEG-PS) have no
+    // usable seek table, so seek them by byte position from our packet index
+    // instead, as ffplay does
+    state->seek_by_byte = (av_format_ctx->iformat->flags & AVFMT_TS_DISCONT) &&
+                          !(av_format_ctx->iformat->flags & AVFMT_NO_BYTE_SEEK) &&
+                          strcmp(av_format_ctx->iformat->name, "ogg") != 0;
+
     state->av_packet = av_packet_alloc();
     if (!state->av_packet) {
         printf("Couldn't allocate AVPacket\n");
+        video_reader_close(state);
         return false;
     }
 
-    // Set up a video codec context for the decoder
+    state->video_codec = video_codec;
     if (video_codec) {
-        AVCodecContext* ctx = state->video_codec_ctx = avcodec_alloc_context3(video_codec);
-        if (!ctx) {
-            printf("Couldn't create AVCodecContext\n");
-            return false;
-        }
-        if (avcodec_parameters_to_context(ctx, video_codec_params) < 0) {
-            printf("Couldn't initialize AVCodecContext\n");
-            return false;
-        }
-        if (avcodec_open2(ctx, video_codec, NULL) < 0) {
-            printf("Couldn't open codec\n");
-            return false;
-        }
-
         state->video_frame = av_frame_alloc();
         if (!state->video_frame) {
             printf("Couldn't allocate AVFrame\n");
+            video_reader_close(state);
             return false;
         }
-    } else {
-        state->video_stream_index = -1;
-        state->video_codec_ctx = NULL;
-        state->video_frame = NULL;
     }
 
-    // Set up a audio codec context for the decoder
+    state->audio_codec = audio_codec;
     if (audio_codec) {
-        AVCodecContext* ctx = state->audio_codec_ctx = avcodec_alloc_context3(audio_codec);
-        if (!ctx) {
-            printf("Couldn't create AVCodecContext\n");
-            return false;
-        }
-        if (avcodec_parameters_to_context(ctx, audio_codec_params) < 0) {
-            printf("Couldn't initialize AVCodecContext\n");
-            return false;
-        }
-        if (avcodec_open2(ctx, audio_codec, NULL) < 0) {
-            printf("Couldn't open codec\n");
-            return false;
-        }
-        state->sample_format = ctx->sample_fmt;
-
         state->audio_frame = av_frame_alloc();
         if (!state->audio_frame) {
             printf("Couldn't allocate AVFrame\n");
+            video_reader_close(state);
             return false;
         }
-        
-        // Need to determine sample rate by reading one frame
-        if (state->sample_rate == 0 || state->num_channels == 0) {
-            int res, packet_pts, frame_pts;
-            while ((res = video_reader_next_frame(state, &packet_pts, &frame_pts)) < 0) {}
-            if (res == RECEIVED_NONE) {
-                printf("Couldn't read any frames\n");
-                return false;
-            }
-            
-            state->sample_rate = state->audio_frame->sample_rate;
-            state->num_channels = state->audio_frame->channels;
-            video_reader_seek(state, false, 0);
-        }
+    }
 
-    } else {
-        state->audio_stream_index = -1;
-        state->audio_codec_ctx = NULL;
-        state->audio_frame = NULL;
+    return true;
+}
+
+void video_reader_select_streams(VideoReaderState* state, bool video, bool audio) {
+    // Discarded streams are skipped by the demuxer, so their packets are
+    // neither returned by av_read_frame nor decoded
+    auto streams = state->av_format_ctx->streams;
+    if (state->video_stream_index != -1) {
+        streams[state->video_stream_index]->discard = video ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
     }
+    if (state->audio_stream_index != -1) {
+        streams[state->audio_stream_index]->discard = audio ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    }
+}
 
-    state->sws_scaler_ctx = NULL;
+void video_reader_set_export_side_data(VideoReaderState* state, bool export_side_data) {
+    if (state->export_side_data == export_side_data) {
+        return;
+    }
+    // Decoders read the flags when they are opened
+    state->export_side_data = export_side_data;
+    if (state->video_codec_ctx) {
+        avcodec_free_context(&state->video_codec_ctx);
+    }
+}
 
-    return true;
+void video_reader_release_decoders(VideoReaderState* state) {
+    if (state->video_codec_ctx) {
+        avcodec_free_context(&state->video_codec_ctx);
+    }
+    if (state->audio_codec_ctx) {
+        avcodec_free_context(&state->audio_codec_ctx);
+    }
+    if (state->sws_scaler_ctx) {
+        sws_freeContext(state->sws_scaler_ctx);
+        state->sws_scaler_ctx = NULL;
+    }
+    if (state->video_frame) {
+        av_frame_unref(state->video_frame);
+    }
+    if (state->audio_frame) {
+        av_frame_unref(state->audio_frame);
+    }
 }
 
-void video_reader_read_all_packets(VideoReaderState* state, std::function<void(bool is_video, bool is_keyframe, int pts, int dts, int duration)> visit_packet) {
-    int response;
-    while (true) {
-        response = av_read_frame(state->av_format_ctx, state->av_packet);
+int video_reader_read_packets(VideoReaderState* state, PacketBatch* batch) {
+    PROFILE_SCOPE("read_packets");
+
+    batch->count = 0;
+    while (batch->count < PacketBatch::CAPACITY) {
+
+        // Hand over what we have before blocking on a file that is still
+        // being written
+        if (state->follow && batch->count > 0 &&
+            state->avio_ctx->buf_ptr == state->avio_ctx->buf_end &&
+            state->source_pos >= state->source->get_size(state->source)) {
+            break;
+        }
+
+        int response = av_read_frame(state->av_format_ctx, state->av_packet);
         if (response == AVERROR_EOF) {
             state->reached_end = true;
             break;
@@ -178,30 +336,86 @@ void video_reader_read_all_packets(VideoReaderState* state, std::function<void(b
             break;
         }
 
-        if (state->av_packet->stream_index == state->video_stream_index) {
-            visit_packet(true,
-                         (state->av_packet->flags & AV_PKT_FLAG_KEY),
-                         state->av_packet->pts,
-                         state->av_packet->dts,
-                         state->av_packet->duration);
-        } else if (state->av_packet->stream_index == state->audio_stream_index) {
-            visit_packet(false,
-                         true,
-                         state->av_packet->pts,
-                         state->av_packet->dts,
-                         state->av_packet->duration);
+        auto packet = state->av_packet;
+        bool is_video = packet->stream_index == state->video_stream_index;
+        if (is_video || packet->stream_index == state->audio_stream_index) {
+            int i = batch->count++;
+            batch->is_video[i] = is_video;
+            batch->is_keyframe[i] = !is_video || (packet->flags & AV_PKT_FLAG_KEY);
+            batch->has_pts[i] = packet->pts != AV_NOPTS_VALUE;
+            batch->has_dts[i] = packet->dts != AV_NOPTS_VALUE;
+            batch->pts[i] = batch->has_pts[i] ? (int)packet->pts : 0;
+            batch->dts[i] = batch->has_dts[i] ? (int)packet->dts : 0;
+            batch->duration[i] = packet->duration;
+            batch->pos[i] = packet->pos;
+            batch->picture_type[i] = PICTURE_UNKNOWN;
+            batch->is_reference[i] = true;
+            if (is_video && state->parse_picture_types) {
+                if (!state->picture_parser_ready) {
+                    PictureTypeParser::init(&state->picture_parser, state->av_format_ctx->streams[state->video_stream_index]->codecpar);
+                    state->picture_parser_ready = true;
+                }
+                state->picture_parser.parse(packet, &batch->picture_type[i], &batch->is_reference[i]);
+            }
         }
 
-        av_packet_unref(state->av_packet);
+        av_packet_unref(packet);
+    }
+    return batch->count;
+}
+
+static int64_t estimate_packet_count(AVFormatContext* format_ctx, AVStream* stream, bool is_video) {
+    if (stream->nb_frames > 0) {
+        return stream->nb_frames;
+    }
+
+    double seconds = 0.0;
+    if (stream->duration != AV_NOPTS_VALUE) {
+        seconds = stream->duration * av_q2d(stream->time_base);
+    } else if (format_ctx->duration != AV_NOPTS_VALUE) {
+        seconds = format_ctx->duration / (double)AV_TIME_BASE;
+    }
+
+    double packets_per_second = 0.0;
+    if (is_video) {
+        packets_per_second = stream->avg_frame_rate.den ? av_q2d(stream->avg_frame_rate) : 0.0;
+    } else {
+        // Audio codecs mostly use a fixed frame size, 1024 samples is AAC's
+        int frame_size = stream->codecpar->frame_size > 0 ? stream->codecpar->frame_size : 1024;
+        packets_per_second = stream->codecpar->sample_rate / (double)frame_size;
+    }
+
+    // Don't trust a broken header with gigabytes of memory
+    constexpr int64_t MAX_ESTIMATE = 64 * 1024 * 1024;
+    return std::max((int64_t)0, std::min((int64_t)(seconds * packets_per_second), MAX_ESTIMATE));
+}
+
+void video_reader_estimate_packet_counts(VideoReaderState* state, int64_t* video_packets, int64_t* audio_packets) {
+    auto format_ctx = state->av_format_ctx;
+    *video_packets = 0;
+    *audio_packets = 0;
+    if (state->video_stream_index != -1) {
+        *video_packets = estimate_packet_count(format_ctx, format_ctx->streams[state->video_stream_index], true);
+    }
+    if (state->audio_stream_index != -1) {
+        *audio_packets = estimate_packet_count(format_ctx, format_ctx->streams[state->audio_stream_index], false);
     }
 }
 
 int video_reader_next_frame(VideoReaderState* state, int* packet_pts, int* frame_pts) {
+    PROFILE_SCOPE("next_frame");
 
     // Decode one frame
     int response;
     while (true) {
-        response = av_read_frame(state->av_format_ctx, state->av_packet);
+        if (state->should_cancel && state->should_cancel(state->should_cancel_opaque)) {
+            return RECEIVED_CANCELLED;
+        }
+
+        {
+            PROFILE_SCOPE("demux");
+            response = av_read_frame(state->av_format_ctx, state->av_packet);
+        }
         if (response == AVERROR_EOF) {
             state->reached_end = true;
             return RECEIVED_NONE;
@@ -212,6 +426,18 @@ int video_reader_next_frame(VideoReaderState* state, int* packet_pts, int* frame
 
         if (state->av_packet->stream_index == state->video_stream_index) {
 
+            PROFILE_SCOPE("decode_video");
+
+            if (!state->video_codec_ctx) {
+                state->video_codec_ctx = open_codec(state, state->video_stream_index, state->video_codec);
+                if (!state->video_codec_ctx) {
+                    av_packet_unref(state->av_packet);
+                    return RECEIVED_NONE;
+                }
+            }
+
+            int64_t decode_start = state->on_video_packet_decoded ? profiler_now_ns() : 0;
+
             response = avcodec_send_packet(state->video_codec_ctx, state->av_packet);
             if (response < 0) {
                 printf("Failed to decode packet: %s\n", av_make_error(response));
@@ -219,6 +445,11 @@ int video_reader_next_frame(VideoReaderState* state, int* packet_pts, int* frame
             }
 
             response = avcodec_receive_frame(state->video_codec_ctx, state->video_frame);
+            if (state->on_video_packet_decoded) {
+                state->on_video_packet_decoded(state->on_video_packet_decoded_opaque,
+                                               state->av_packet->pts,
+                                               profiler_now_ns() - decode_start);
+            }
             if (response == AVERROR(EAGAIN) || response == AVERROR_EOF) {
                 av_packet_unref(state->av_packet);
                 continue;
@@ -227,6 +458,12 @@ int video_reader_next_frame(VideoReaderState* state, int* packet_pts, int* frame
                 return RECEIVED_NONE;
             }
 
+            // Containers that don't store the frame size get it from here
+            if (state->width == 0) {
+                state->width = state->video_frame->width;
+                state->height = state->video_frame->height;
+            }
+
             *packet_pts = state->av_packet->pts;
             *frame_pts = state->video_frame->pts;
             av_packet_unref(state->av_packet);
@@ -234,6 +471,16 @@ int video_reader_next_frame(VideoReaderState* state, int* packet_pts, int* frame
 
         } else if (state->av_packet->stream_index == state->audio_stream_index) {
 
+            PROFILE_SCOPE("decode_audio");
+
+            if (!state->audio_codec_ctx) {
+                state->audio_codec_ctx = open_codec(state, state->audio_stream_index, state->audio_codec);
+                if (!state->audio_codec_ctx) {
+                    av_packet_unref(state->av_packet);
+                    return RECEIVED_NONE;
+                }
+            }
+
             response = avcodec_send_packet(state->audio_codec_ctx, state->av_packet);
             if (response < 0) {
                 printf("Failed to decode packet: %s\n", av_make_error(response));
@@ -249,6 +496,12 @@ int video_reader_next_frame(VideoReaderState* state, int* packet_pts, int* frame
                 return RECEIVED_NONE;
             }
 
+            // The decoder has the final say on the sample parameters, which
+            // some containers don't store at all
+            state->sample_rate = state->audio_frame->sample_rate;
+            state->num_channels = state->audio_frame->channels;
+            state->sample_format = (AVSampleFormat)state->audio_frame->format;
+
             *packet_pts = state->av_packet->pts;
             *frame_pts = state->audio_frame->pts;
             av_packet_unref(state->av_packet);
@@ -264,27 +517,56 @@ int video_reader_next_frame(VideoReaderState* state, int* packet_pts, int* frame
     return RECEIVED_NONE;
 }
 
-void video_reader_transfer_video_frame(VideoReaderState* state, unsigned char* frame_buffer) {
+bool video_reader_next_packet(VideoReaderState* state, AVPacket* packet) {
+    PROFILE_SCOPE("next_packet");
 
-    // Set up sws scaler
-    if (!state->sws_scaler_ctx) {
-        auto source_pix_fmt = correct_for_deprecated_pixel_format(state->video_codec_ctx->pix_fmt);
-        state->sws_scaler_ctx = sws_getContext(state->width, state->height, source_pix_fmt,
-                                               state->width, state->height, AV_PIX_FMT_RGB0,
-                                               SWS_BILINEAR, NULL, NULL, NULL);
+    while (true) {
+        if (state->should_cancel && state->should_cancel(state->should_cancel_opaque)) {
+            return false;
+        }
+        int response = av_read_frame(state->av_format_ctx, packet);
+        if (response == AVERROR_EOF) {
+            state->reached_end = true;
+            return false;
+        } else if (response < 0) {
+            printf("Failed to read frame: %s\n", av_make_error(response));
+            return false;
+        }
+        if (packet->stream_index == state->video_stream_index ||
+            packet->stream_index == state->audio_stream_index) {
+            return true;
+        }
+        av_packet_unref(packet);
     }
+}
+
+void video_reader_transfer_video_frame(VideoReaderState* state, unsigned char* frame_buffer) {
+    PROFILE_SCOPE("transfer_video_frame");
+    video_reader_convert_frame(state, state->video_frame, state->width, state->height, frame_buffer);
+}
+
+void video_reader_convert_frame(VideoReaderState* state, const AVFrame* frame, int width, int height, unsigned char* frame_buffer) {
+    PROFILE_SCOPE("convert_frame");
+
+    // Set up sws scaler, the context is only rebuilt when the sizes or
+    // formats change
+    auto source_pix_fmt = correct_for_deprecated_pixel_format((AVPixelFormat)frame->format);
+    state->sws_scaler_ctx = sws_getCachedContext(state->sws_scaler_ctx,
+                                                 frame->width, frame->height, source_pix_fmt,
+                                                 width, height, AV_PIX_FMT_RGB0,
+                                                 SWS_BILINEAR, NULL, NULL, NULL);
     if (!state->sws_scaler_ctx) {
         printf("Couldn't initialize sw scaler\n");
         assert(0);
     }
 
     uint8_t* dest[4] = { frame_buffer, NULL, NULL, NULL };
-    int dest_linesize[4] = { state->width * 4, 0, 0, 0 };
+    int dest_linesize[4] = { width * 4, 0, 0, 0 };
     sws_scale(state->sws_scaler_ctx,
-              state->video_frame->data,
-              state->video_frame->linesize,
+              frame->data,
+              frame->linesize,
               0,
-              state->video_frame->height,
+              frame->height,
               dest,
               dest_linesize);
 
@@ -338,6 +620,7 @@ static void video_reader_copy_audio_buffer(VideoReaderState* state, int offset,
 }
 
 void video_reader_transfer_audio_frame(VideoReaderState* state, int size_1, float* buffer_1, int size_2, float* buffer_2) {
+    PROFILE_SCOPE("transfer_audio_frame");
     assert(size_1 + size_2 == state->audio_frame->nb_samples);
     video_reader_copy_audio_buffer(state, 0, size_1, buffer_1);
     if (size_2 > 0) {
@@ -362,9 +645,34 @@ void video_reader_seek(VideoReaderState* state, bool video_pts, int pts) {
     }
 }
 
+void video_reader_seek_packet(VideoReaderState* state, bool video_pts, int pts, int64_t pos) {
+    if (!state->seek_by_byte || pos < 0) {
+        video_reader_seek(state, video_pts, pts);
+        return;
+    }
+
+    // pos is the exact start of the keyframe packet, so there is no
+    // bisection and no walking forward from an earlier landing point
+    av_seek_frame(state->av_format_ctx, -1, pos, AVSEEK_FLAG_BYTE);
+    if (state->audio_codec_ctx) {
+        avcodec_flush_buffers(state->audio_codec_ctx);
+    }
+    if (state->video_codec_ctx) {
+        avcodec_flush_buffers(state->video_codec_ctx);
+    }
+}
+
 void video_reader_close(VideoReaderState* state) {
     avformat_close_input(&state->av_format_ctx);
     avformat_free_context(state->av_format_ctx);
+    if (state->avio_ctx) {
+        av_freep(&state->avio_ctx->buffer);
+        avio_context_free(&state->avio_ctx);
+    }
+    if (state->source) {
+        media_source_release(state->source);
+        state->source = NULL;
+    }
     if (state->video_frame) {
         av_frame_free(&state->video_frame);
     }
@@ -375,6 +683,10 @@ void video_reader_close(VideoReaderState* state) {
         sws_freeContext(state->sws_scaler_ctx);
     }
     av_packet_free(&state->av_packet);
+    if (state->picture_parser_ready) {
+        PictureTypeParser::destroy(&state->picture_parser);
+        state->picture_parser_ready = false;
+    }
     if (state->video_codec_ctx) {
         avcodec_free_context(&state->video_codec_ctx);
     }
@@ -2,6 +2,9 @@
 #define video_reader_hpp
 
 #include <vector>
+#include <functional>
+#include "media_source.hpp"
+#include "picture_type.hpp"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -10,7 +13,8 @@ extern "C" {
 }
 
 struct VideoReaderState {
-    // Public properties to show
+    // Public properties to show. The stream parameters are 0 until the
+    // first frame is decoded if the container doesn't carry them.
     bool reached_end;
     int width;
     int height;
@@ -20,34 +24,107 @@ struct VideoReaderState {
     AVSampleFormat sample_format;
     AVRational video_time_base;
     AVRational audio_time_base;
+    bool seek_by_byte;
+    bool follow; // at the end of the source, wait for it to grow instead of ending
+    bool parse_picture_types; // in video_reader_read_packets, on by default
+    bool export_side_data; // motion vectors and QP on decoded video frames, off by default
 
     // Format internal state
+    MediaSource* source;
+    AVIOContext* avio_ctx;
+    int64_t source_pos;
     AVFormatContext* av_format_ctx;
     AVPacket* av_packet;
 
-    // Video internal state
+    // Video internal state, the codec is opened on the first packet
+    AVCodec* video_codec;
     AVCodecContext* video_codec_ctx;
     int video_stream_index;
     AVFrame* video_frame;
     SwsContext* sws_scaler_ctx;
+    PictureTypeParser picture_parser; // set up on the first packet read
+    bool picture_parser_ready;
 
-    // Audio internal state
+    // Audio internal state, the codec is opened on the first packet
+    AVCodec* audio_codec;
     AVCodecContext* audio_codec_ctx;
     int audio_stream_index;
     AVFrame* audio_frame;
+
+    // Cancellation point, checked before every packet in video_reader_next_frame
+    bool (*should_cancel)(void* opaque);
+    void* should_cancel_opaque;
+
+    // If set, called with the time each video packet took to send to the
+    // decoder and receive from it
+    void (*on_video_packet_decoded)(void* opaque, int packet_pts, int64_t decode_ns);
+    void* on_video_packet_decoded_opaque;
+};
+
+// Metadata of up to CAPACITY packets as read by the demuxer, laid out as
+// one array per field so that indexing walks each field linearly
+struct PacketBatch {
+    static constexpr int CAPACITY = 1024;
+
+    int count;
+    bool is_video[CAPACITY];
+    bool is_keyframe[CAPACITY];
+    int pts[CAPACITY]; // low 32 bits, e.g. of 33 bit MPEG-TS timestamps
+    int dts[CAPACITY];
+    bool has_pts[CAPACITY]; // false for AV_NOPTS_VALUE, which leaves pts 0
+    bool has_dts[CAPACITY];
+    int duration[CAPACITY];
+    int64_t pos[CAPACITY];
+    PictureType picture_type[CAPACITY];
+    bool is_reference[CAPACITY];
 };
 
 constexpr int RECEIVED_VIDEO = -1;
 constexpr int RECEIVED_NONE = 0;
+constexpr int RECEIVED_CANCELLED = -2;
 // Positive values is the number of audio samples received
 
+// How much of a file is read at open time to discover its format and streams
+struct VideoReaderProbeLimits {
+    int64_t probe_size;       // bytes
+    int64_t analyze_duration; // microseconds
+};
+constexpr VideoReaderProbeLimits PROBE_LIMITS_FAST = { 512 * 1024, 1000000 };
+constexpr VideoReaderProbeLimits PROBE_LIMITS_FFMPEG_DEFAULT = { 5000000, 5000000 };
+
+// Applies to every reader opened afterwards, PROBE_LIMITS_FAST by default
+void video_reader_set_probe_limits(VideoReaderProbeLimits limits);
+
 bool video_reader_open(VideoReaderState* state, const char* filename);
-void video_reader_read_all_packets(VideoReaderState* state, std::function<void(bool is_video, bool is_keyframe, int pts, int dts, int duration)> visit_packet);
+bool video_reader_open_source(VideoReaderState* state, MediaSource* source);
+void video_reader_select_streams(VideoReaderState* state, bool video, bool audio);
+// Turns the export of motion vectors and QP by the video decoder on or off.
+// Changing it closes the decoder, which is opened again at the next packet,
+// so seek to a keyframe afterwards.
+void video_reader_set_export_side_data(VideoReaderState* state, bool export_side_data);
+// Frees the decoders and the scaler, which hold most of a reader's memory
+// (reference frames, frame threads). They are opened again at the next
+// packet, so seek to a keyframe before decoding again.
+void video_reader_release_decoders(VideoReaderState* state);
+// Fills the batch with the next packets of the selected streams, returns
+// the number read, 0 at the end. A followed file returns a partial batch
+// rather than wait for more data while it has packets to hand over.
+int  video_reader_read_packets(VideoReaderState* state, PacketBatch* batch);
+// Estimated packet counts from the container, for reserving memory up front.
+// 0 if the container doesn't say.
+void video_reader_estimate_packet_counts(VideoReaderState* state, int64_t* video_packets, int64_t* audio_packets);
 int  video_reader_next_frame(VideoReaderState* state, int* packet_pts, int* frame_pts);
+// Reads the next packet of the selected streams without decoding it, e.g.
+// to copy it to another file. The caller unreferences the packet. Returns
+// false at the end, on errors and when cancelled.
+bool video_reader_next_packet(VideoReaderState* state, AVPacket* packet);
 void video_reader_transfer_video_frame(VideoReaderState* state, unsigned char* frame_buffer);
+// Converts any decoded frame to RGB0, scaled to width x height
+void video_reader_convert_frame(VideoReaderState* state, const AVFrame* frame, int width, int height, unsigned char* frame_buffer);
 void video_reader_transfer_audio_frame(VideoReaderState* state, int size_1, float* buffer_1, int size_2, float* buffer_2);
 bool video_reader_reached_end(VideoReaderState* state);
 void video_reader_seek(VideoReaderState* state, bool video_pts, int pts);
+void video_reader_seek_packet(VideoReaderState* state, bool video_pts, int pts, int64_t pos);
 void video_reader_close(VideoReaderState* state);
 
 #endif